@@ -0,0 +1,97 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "alloc_trace.h"
+
+#if ALLOC_TRACE_ENABLED
+
+#if !CONFIG_HEAP_USE_HOOKS
+#error "ALLOC_TRACE_ENABLED needs CONFIG_HEAP_USE_HOOKS"
+#endif
+
+// Region depths of the running task, thread-local so the hook needs neither a lock nor a lookup
+static __thread int steady_depth;
+static __thread int exempt_depth;
+
+static atomic_bool armed;
+static atomic_uint_fast32_t violations;
+static atomic_uint_fast32_t exempt;
+static const char *volatile last_task;
+static volatile size_t last_size;
+
+// Called by the heap on every allocation, may not allocate or log itself
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (!atomic_load_explicit(&armed, memory_order_relaxed) || steady_depth == 0 || xPortInIsrContext())
+        return;
+
+    if (exempt_depth > 0)
+    {
+        atomic_fetch_add_explicit(&exempt, 1, memory_order_relaxed);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&violations, 1, memory_order_relaxed);
+    last_task = pcTaskGetName(NULL);
+    last_size = size;
+
+#if ALLOC_TRACE_ABORT
+    // Unwinding from here points straight at the offending call
+    abort();
+#endif
+}
+
+void esp_heap_trace_free_hook(void *ptr)
+{
+}
+
+void alloc_trace_arm(void)
+{
+    atomic_store(&armed, true);
+}
+
+void alloc_trace_steady(int delta)
+{
+    steady_depth += delta;
+}
+
+void alloc_trace_exempt(int delta)
+{
+    exempt_depth += delta;
+}
+
+void alloc_trace_get_stats(alloc_trace_stats_t *stats)
+{
+    stats->armed = atomic_load(&armed);
+    stats->violations = atomic_load(&violations);
+    stats->exempt = atomic_load(&exempt);
+    stats->last_task = last_task;
+    stats->last_size = last_size;
+}
+
+#else
+
+void alloc_trace_arm(void)
+{
+}
+
+void alloc_trace_steady(int delta)
+{
+}
+
+void alloc_trace_exempt(int delta)
+{
+}
+
+void alloc_trace_get_stats(alloc_trace_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Soak test build: count heap allocations made inside steady-state regions once boot is complete.
+// Needs CONFIG_HEAP_USE_HOOKS, with 0 all the macros below compile to nothing.
+#define ALLOC_TRACE_ENABLED 0
+// Abort on the first offending allocation instead of only counting it, so a soak run fails loudly
+#define ALLOC_TRACE_ABORT 0
+
+/*
+    A steady-state region is code that runs over and over after boot (a tap, a page, a DNS reply) and must
+    not touch the heap, so a long uptime cannot fragment it. Calls into third-party code that is known to
+    allocate internally (lwIP, the ST25DV driver) are wrapped in an exempt region: those allocations are
+    counted separately and do not fail the run.
+*/
+#if ALLOC_TRACE_ENABLED
+#define ALLOC_TRACE_STEADY_BEGIN() alloc_trace_steady(1)
+#define ALLOC_TRACE_STEADY_END() alloc_trace_steady(-1)
+#define ALLOC_TRACE_EXEMPT_BEGIN() alloc_trace_exempt(1)
+#define ALLOC_TRACE_EXEMPT_END() alloc_trace_exempt(-1)
+#else
+#define ALLOC_TRACE_STEADY_BEGIN() \
+    do                             \
+    {                              \
+    } while (0)
+#define ALLOC_TRACE_STEADY_END() ALLOC_TRACE_STEADY_BEGIN()
+#define ALLOC_TRACE_EXEMPT_BEGIN() ALLOC_TRACE_STEADY_BEGIN()
+#define ALLOC_TRACE_EXEMPT_END() ALLOC_TRACE_STEADY_BEGIN()
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Allocation counters, all zero unless ALLOC_TRACE_ENABLED
+     */
+    typedef struct alloc_trace_stats
+    {
+        bool armed;                  /**<! Boot is complete and regions are being checked */
+        uint32_t violations;         /**<! Allocations inside a steady-state region */
+        uint32_t exempt;             /**<! Allocations inside an exempt region */
+        const char *last_task;       /**<! Task of the last violation */
+        size_t last_size;            /**<! Size of the last violation */
+    } alloc_trace_stats_t;
+
+    /**
+     * @brief Mark boot as complete, allocations before this are never counted
+     */
+    void alloc_trace_arm(void);
+
+    /**
+     * @brief Enter (+1) or leave (-1) a steady-state region in the current task, use the macros instead
+     */
+    void alloc_trace_steady(int delta);
+
+    /**
+     * @brief Enter (+1) or leave (-1) an exempt region in the current task, use the macros instead
+     */
+    void alloc_trace_exempt(int delta);
+
+    /**
+     * @brief Copy the counters
+     */
+    void alloc_trace_get_stats(alloc_trace_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
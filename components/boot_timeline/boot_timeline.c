@@ -0,0 +1,143 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "boot_timeline.h"
+#include "fastlog.h"
+#include "metrics.h"
+#include "trace.h"
+
+static const char *TAG = "Boot";
+
+typedef struct
+{
+    const char *name;
+    uint32_t begin_ms;
+    uint32_t end_ms; // UINT32_MAX while the stage runs
+    int core;
+} boot_stage_t;
+
+static boot_stage_t stages[BOOT_TIMELINE_MAX_STAGES];
+static size_t num_stages = 0;
+static portMUX_TYPE stages_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t done_ms = 0;
+
+// 0 until reached, nothing is reached in the first millisecond
+static atomic_uint_fast32_t kpi_ms[BOOT_KPI_MAX];
+static const char *const kpi_names[BOOT_KPI_MAX] = {"first_tap", "first_page"};
+
+static metric_t *duration_metric = NULL;
+static metric_t *kpi_metrics[BOOT_KPI_MAX];
+
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void boot_timeline_init(void)
+{
+    kpi_metrics[BOOT_KPI_FIRST_TAP] = metrics_gauge("boot_first_tap_ms", "Time from boot to the first tag write, 0 until then");
+    kpi_metrics[BOOT_KPI_FIRST_PAGE] = metrics_gauge("boot_first_page_ms", "Time from boot to the first portal page, 0 until then");
+    duration_metric = metrics_gauge("boot_duration_ms", "Time from boot until every boot stage was done");
+}
+
+void boot_stage_begin(const char *name)
+{
+    trace_span_begin(name);
+    boot_stage_t stage = {
+        .name = name,
+        .begin_ms = now_ms(),
+        .end_ms = UINT32_MAX,
+        .core = xPortGetCoreID(),
+    };
+
+    taskENTER_CRITICAL(&stages_lock);
+    if (num_stages < BOOT_TIMELINE_MAX_STAGES)
+        stages[num_stages++] = stage;
+    taskEXIT_CRITICAL(&stages_lock);
+}
+
+void boot_stage_end(const char *name)
+{
+    uint32_t end_ms = now_ms();
+
+    taskENTER_CRITICAL(&stages_lock);
+    for (size_t i = 0; i < num_stages; i++)
+        if (strcmp(stages[i].name, name) == 0)
+            stages[i].end_ms = end_ms;
+    taskEXIT_CRITICAL(&stages_lock);
+    trace_span_end(name);
+}
+
+void boot_timeline_done(void)
+{
+    done_ms = now_ms();
+    metrics_set(duration_metric, (int32_t)done_ms);
+
+    ESP_LOGI(TAG, "Boot done in %" PRIu32 " ms", done_ms);
+    for (size_t i = 0; i < num_stages; i++)
+        ESP_LOGI(TAG, "  %-8s core %d %5" PRIu32 " .. %5" PRIu32 " ms", stages[i].name, stages[i].core,
+                 stages[i].begin_ms, stages[i].end_ms);
+}
+
+void boot_kpi_reached(boot_kpi_t kpi)
+{
+    if (atomic_load_explicit(&kpi_ms[kpi], memory_order_relaxed) != 0)
+        return;
+
+    uint_fast32_t expected = 0;
+    uint32_t reached_ms = now_ms();
+    if (!atomic_compare_exchange_strong(&kpi_ms[kpi], &expected, reached_ms))
+        return;
+
+    metrics_set(kpi_metrics[kpi], (int32_t)reached_ms);
+    FASTLOG_I(TAG, "KPI %s reached %u ms after boot", kpi_names[kpi], (unsigned)reached_ms);
+}
+
+size_t boot_timeline_format(char *buf, size_t size)
+{
+    size_t used = 0;
+
+#define APPEND(...)                                                       \
+    do                                                                    \
+    {                                                                     \
+        int len = snprintf(buf + used, size - used, __VA_ARGS__);         \
+        if (len < 0 || (size_t)len >= size - used)                        \
+            return used;                                                  \
+        used += len;                                                      \
+    } while (0)
+
+    if (size == 0)
+        return 0;
+    buf[0] = '\0';
+
+    boot_stage_t copy[BOOT_TIMELINE_MAX_STAGES];
+    taskENTER_CRITICAL(&stages_lock);
+    size_t count = num_stages;
+    for (size_t i = 0; i < count; i++)
+        copy[i] = stages[i];
+    taskEXIT_CRITICAL(&stages_lock);
+
+    APPEND("# stage core begin_ms end_ms\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        if (copy[i].end_ms == UINT32_MAX)
+            APPEND("%s %d %" PRIu32 " -\n", copy[i].name, copy[i].core, copy[i].begin_ms);
+        else
+            APPEND("%s %d %" PRIu32 " %" PRIu32 "\n", copy[i].name, copy[i].core, copy[i].begin_ms, copy[i].end_ms);
+    }
+
+    APPEND("# kpi ms\ndone %" PRIu32 "\n", done_ms);
+    for (int kpi = 0; kpi < BOOT_KPI_MAX; kpi++)
+        APPEND("%s %" PRIu32 "\n", kpi_names[kpi], (uint32_t)atomic_load(&kpi_ms[kpi]));
+
+#undef APPEND
+    return used;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+
+// Stages that can be recorded, further ones are left out of the timeline
+#define BOOT_TIMELINE_MAX_STAGES 12
+
+/*
+    Boot timeline: when each boot stage started and finished and on which core, relative to the start of
+    esp_timer (the bootloader is not included). Stages may overlap, they are recorded from any task.
+    On top, the time to the first tag write and the first portal page are kept as KPIs. The boot time and
+    the KPIs are exported as gauges on /metrics, the stages are logged once boot is done, served on
+    GET /boot and show up as spans in the scheduler trace.
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        BOOT_KPI_FIRST_TAP,  // First tag write for a phone
+        BOOT_KPI_FIRST_PAGE, // First portal page with a link
+        BOOT_KPI_MAX,
+    } boot_kpi_t;
+
+    /**
+     * @brief Register the boot metrics, first thing in app_main() while it is the only task of ours
+     */
+    void boot_timeline_init(void);
+
+    /**
+     * @brief Mark the start of a stage in the current task
+     * @param name String literal, only the pointer is kept
+     */
+    void boot_stage_begin(const char *name);
+
+    /**
+     * @brief Mark the end of the stage started with the same name
+     */
+    void boot_stage_end(const char *name);
+
+    /**
+     * @brief Mark boot as complete and log the timeline
+     */
+    void boot_timeline_done(void);
+
+    /**
+     * @brief Record a KPI, only the first call per KPI counts. Cheap enough for the tap and page paths.
+     */
+    void boot_kpi_reached(boot_kpi_t kpi);
+
+    /**
+     * @brief Write the timeline as text, one stage per line followed by the KPIs
+     * @return Length written, without the terminator; the text is cut short if it does not fit
+     */
+    size_t boot_timeline_format(char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
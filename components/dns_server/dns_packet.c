@@ -0,0 +1,244 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "dns_packet.h"
+
+#define DNS_HEADER_LEN (12)
+#define DNS_QUESTION_TAIL_LEN (4) // Type and class after the question name
+#define DNS_ANSWER_A_LEN (16)
+#define DNS_SOA_LEN (36)
+#define DNS_MAX_LABEL_LEN (63)
+
+// Header field offsets
+#define HDR_FLAGS (2)
+#define HDR_QD_COUNT (4)
+#define HDR_AN_COUNT (6)
+#define HDR_NS_COUNT (8)
+#define HDR_AR_COUNT (10)
+
+// Header flags
+#define QR_FLAG (1 << 15)
+#define OPCODE_MASK (0x7800)
+#define AA_FLAG (1 << 10)
+#define TC_FLAG (1 << 9)
+#define RD_FLAG (1 << 8)
+
+#define RCODE_NOERROR (0)
+#define RCODE_FORMERR (1)
+#define RCODE_SERVFAIL (2)
+#define RCODE_NXDOMAIN (3)
+#define RCODE_NOTIMP (4)
+
+#define QD_TYPE_A (0x0001)
+#define QD_TYPE_SOA (0x0006)
+#define QD_TYPE_ANY (0x00FF)
+#define QD_CLASS_IN (0x0001)
+#define ANS_TTL_SEC (300)
+#define NEG_TTL_SEC (300)
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+/*
+    Parse the name at packet[offset] from the DNS name format to a regular .-separated name,
+    checking every label against the packet length
+    returns the offset of the first byte after the name, or 0 if the name is malformed
+*/
+static size_t parse_name(const uint8_t *packet, size_t len, size_t offset, char *name, size_t *name_len)
+{
+    size_t out = 0;
+
+    while (offset < len)
+    {
+        uint8_t label_len = packet[offset++];
+        if (label_len == 0)
+        {
+            // Drop the trailing '.'
+            *name_len = (out > 0) ? out - 1 : 0;
+            return offset;
+        }
+
+        // Compression pointers and the reserved label types have no place in a question
+        if (label_len > DNS_MAX_LABEL_LEN || offset + label_len > len ||
+            out + label_len + 1 > DNS_PACKET_MAX_NAME_LEN + 1)
+        {
+            return 0;
+        }
+
+        memcpy(name + out, packet + offset, label_len);
+        out += label_len;
+        name[out++] = '.';
+        offset += label_len;
+    }
+
+    // Ran off the end of the packet before the terminating zero label
+    return 0;
+}
+
+static size_t header_only_reply(uint8_t *packet, uint16_t flags)
+{
+    put_u16(packet + HDR_FLAGS, flags);
+    put_u16(packet + HDR_QD_COUNT, 0);
+    put_u16(packet + HDR_AN_COUNT, 0);
+    put_u16(packet + HDR_NS_COUNT, 0);
+    put_u16(packet + HDR_AR_COUNT, 0);
+    return DNS_HEADER_LEN;
+}
+
+// SOA for negative answers, the owner and both names are compressed to the question name
+static void put_soa(uint8_t *record, uint16_t name_offset)
+{
+    uint16_t name_ptr = 0xC000 | name_offset;
+
+    put_u16(record, name_ptr);
+    put_u16(record + 2, QD_TYPE_SOA);
+    put_u16(record + 4, QD_CLASS_IN);
+    put_u32(record + 6, NEG_TTL_SEC);
+    put_u16(record + 10, DNS_SOA_LEN - 12);
+    put_u16(record + 12, name_ptr); // MNAME
+    put_u16(record + 14, name_ptr); // RNAME
+    put_u32(record + 16, 1);        // Serial
+    put_u32(record + 20, NEG_TTL_SEC); // Refresh
+    put_u32(record + 24, NEG_TTL_SEC); // Retry
+    put_u32(record + 28, NEG_TTL_SEC); // Expire
+    put_u32(record + 32, NEG_TTL_SEC); // Minimum, the negative caching TTL
+}
+
+size_t dns_packet_build_reply(uint8_t *packet, size_t query_len, size_t packet_size, dns_lookup_fn_t lookup, void *ctx)
+{
+    if (query_len < DNS_HEADER_LEN || query_len > packet_size)
+    {
+        return 0;
+    }
+
+    uint16_t flags = get_u16(packet + HDR_FLAGS);
+    uint16_t qd_count = get_u16(packet + HDR_QD_COUNT);
+    size_t max_len = (packet_size < DNS_PACKET_MAX_LEN) ? packet_size : DNS_PACKET_MAX_LEN;
+
+    // Never answer responses, that only invites reflection loops
+    if (flags & QR_FLAG)
+    {
+        return 0;
+    }
+
+    // Answer authoritatively, echoing the opcode and RD bit of the query
+    uint16_t reply_flags = QR_FLAG | AA_FLAG | (flags & (OPCODE_MASK | RD_FLAG));
+
+    // Not a standard query
+    if ((flags & OPCODE_MASK) != 0)
+    {
+        return header_only_reply(packet, reply_flags | RCODE_NOTIMP);
+    }
+
+    // Validate the whole question section before anything is written past it
+    char name[DNS_PACKET_MAX_NAME_LEN + 1];
+    size_t name_len;
+    size_t offset = DNS_HEADER_LEN;
+
+    for (int qd_i = 0; qd_i < qd_count; qd_i++)
+    {
+        offset = parse_name(packet, query_len, offset, name, &name_len);
+        if (offset == 0 || offset + DNS_QUESTION_TAIL_LEN > query_len)
+        {
+            return header_only_reply(packet, reply_flags | RCODE_FORMERR);
+        }
+        offset += DNS_QUESTION_TAIL_LEN;
+    }
+
+    if (qd_count == 0 || offset > max_len)
+    {
+        return header_only_reply(packet, reply_flags | RCODE_FORMERR);
+    }
+
+    // Answers go right after the questions, anything past them in the query (e.g. an EDNS OPT record) is dropped
+    size_t reply_len = offset;
+    uint16_t an_count = 0;
+    uint16_t rcode = RCODE_NOERROR;
+    offset = DNS_HEADER_LEN;
+
+    for (int qd_i = 0; qd_i < qd_count; qd_i++)
+    {
+        uint16_t name_offset = offset;
+        offset = parse_name(packet, query_len, offset, name, &name_len);
+        uint16_t qd_type = get_u16(packet + offset);
+        uint16_t qd_class = get_u16(packet + offset + 2);
+        offset += DNS_QUESTION_TAIL_LEN;
+
+        uint32_t ip;
+        dns_lookup_result_t result = lookup(ctx, name, name_len, &ip);
+        if (result == DNS_LOOKUP_NO_NAME)
+        {
+            if (rcode == RCODE_NOERROR)
+                rcode = RCODE_NXDOMAIN;
+            continue;
+        }
+        if (result == DNS_LOOKUP_NO_ADDRESS)
+        {
+            // Don't let the client cache a negative answer for a name we will serve shortly
+            rcode = RCODE_SERVFAIL;
+            continue;
+        }
+
+        // The name exists, but AAAA, HTTPS/SVCB etc. get an empty (NODATA) answer
+        if (qd_type != QD_TYPE_A && qd_type != QD_TYPE_ANY)
+        {
+            continue;
+        }
+
+        if (reply_len + DNS_ANSWER_A_LEN > max_len)
+        {
+            reply_flags |= TC_FLAG;
+            break;
+        }
+
+        // Compress the answer name to a pointer at the question name
+        uint8_t *answer = packet + reply_len;
+        put_u16(answer, 0xC000 | name_offset);
+        put_u16(answer + 2, QD_TYPE_A);
+        put_u16(answer + 4, qd_class);
+        put_u32(answer + 6, ANS_TTL_SEC);
+        put_u16(answer + 10, sizeof(ip));
+        memcpy(answer + 12, &ip, sizeof(ip));
+
+        reply_len += DNS_ANSWER_A_LEN;
+        an_count++;
+    }
+
+    // Only a single question can carry a meaningful NXDOMAIN, multi-question queries get NODATA instead
+    if (qd_count != 1 && rcode == RCODE_NXDOMAIN)
+    {
+        rcode = RCODE_NOERROR;
+    }
+
+    // NXDOMAIN and NODATA carry an SOA, so that clients cache the negative answer instead of retrying
+    uint16_t ns_count = 0;
+    if (qd_count == 1 && an_count == 0 && rcode != RCODE_SERVFAIL && reply_len + DNS_SOA_LEN <= max_len)
+    {
+        put_soa(packet + reply_len, DNS_HEADER_LEN);
+        reply_len += DNS_SOA_LEN;
+        ns_count = 1;
+    }
+
+    put_u16(packet + HDR_FLAGS, reply_flags | rcode);
+    put_u16(packet + HDR_AN_COUNT, an_count);
+    put_u16(packet + HDR_NS_COUNT, ns_count);
+    put_u16(packet + HDR_AR_COUNT, 0);
+
+    return reply_len;
+}
\ No newline at end of file
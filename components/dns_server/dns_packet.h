@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest DNS message over plain UDP (RFC 1035), both for queries and replies
+#define DNS_PACKET_MAX_LEN (512)
+// Longest name in presentation format, without the trailing dot
+#define DNS_PACKET_MAX_NAME_LEN (253)
+
+/**
+ * @brief Outcome of resolving a question name against the configured rules
+ */
+typedef enum
+{
+    DNS_LOOKUP_FOUND,      /**<! A rule applies and has an IPv4 address */
+    DNS_LOOKUP_NO_ADDRESS, /**<! A rule applies but has no address yet (e.g. its interface is down) */
+    DNS_LOOKUP_NO_NAME,    /**<! No rule covers the name */
+} dns_lookup_result_t;
+
+/**
+ * @brief Resolve a question name
+ * @param ctx User context passed to dns_packet_build_reply
+ * @param name Dotted name, not NUL-terminated
+ * @param name_len Length of the name
+ * @param[out] ip IPv4 address to answer with (network byte order), set only on DNS_LOOKUP_FOUND
+ */
+typedef dns_lookup_result_t (*dns_lookup_fn_t)(void *ctx, const char *name, size_t name_len, uint32_t *ip);
+
+/**
+ * @brief Turn a DNS query into its reply, in place
+ *
+ * The header and question section are reused as-is, answers (or an SOA for negative answers) are written right
+ * after the question section, overwriting anything the query carried past it. Every label is checked against
+ * query_len, compression pointers and oversized names in queries are rejected with FORMERR.
+ *
+ * This file has no platform dependencies, it builds the same for the ESP32 and a host.
+ *
+ * @param packet Buffer holding the query, receives the reply
+ * @param query_len Length of the query
+ * @param packet_size Size of the buffer, replies never exceed min(packet_size, DNS_PACKET_MAX_LEN)
+ * @param lookup Name resolver
+ * @param ctx User context for the resolver
+ * @return Length of the reply, or 0 if the packet should be dropped without reply
+ */
+size_t dns_packet_build_reply(uint8_t *packet, size_t query_len, size_t packet_size, dns_lookup_fn_t lookup, void *ctx);
\ No newline at end of file
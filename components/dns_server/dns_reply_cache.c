@@ -0,0 +1,137 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "dns_reply_cache.h"
+
+#define DNS_HEADER_LEN (12)
+#define DNS_QUESTION_TAIL_LEN (4)
+#define DNS_MAX_LABEL_LEN (63)
+
+// Header flag bits in the first flags byte
+#define QR_OPCODE_BITS (0xF8)
+#define RD_BIT (0x01)
+#define RCODE_MASK (0x0F)
+#define RCODE_SERVFAIL (2)
+
+#define FNV_OFFSET_BASIS (2166136261u)
+#define FNV_PRIME (16777619u)
+
+/*
+    Locate the single question of a standard query without decoding it
+    returns the length of the question (name, type and class), or 0 if the packet isn't a cacheable query
+*/
+static size_t question_len(const uint8_t *packet, size_t len)
+{
+    if (len < DNS_HEADER_LEN || packet[4] != 0 || packet[5] != 1)
+    {
+        return 0;
+    }
+
+    size_t offset = DNS_HEADER_LEN;
+    while (offset < len && packet[offset] != 0)
+    {
+        if (packet[offset] > DNS_MAX_LABEL_LEN)
+        {
+            return 0;
+        }
+        offset += packet[offset] + 1;
+    }
+
+    offset += 1 + DNS_QUESTION_TAIL_LEN;
+    return (offset <= len) ? offset - DNS_HEADER_LEN : 0;
+}
+
+static uint32_t question_hash(const uint8_t *packet, size_t qlen)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    // The RD bit is echoed in the reply, so it is part of the key
+    hash = (hash ^ (packet[2] & RD_BIT)) * FNV_PRIME;
+    for (size_t i = 0; i < qlen; i++)
+    {
+        hash = (hash ^ packet[DNS_HEADER_LEN + i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+size_t dns_reply_cache_lookup(dns_reply_cache_t *cache, uint8_t *packet, size_t query_len, size_t packet_size)
+{
+    // Only plain standard queries, anything else takes the full path
+    if (query_len < DNS_HEADER_LEN || (packet[2] & QR_OPCODE_BITS) != 0)
+    {
+        return 0;
+    }
+
+    size_t qlen = question_len(packet, query_len);
+    if (qlen == 0)
+    {
+        return 0;
+    }
+
+    uint32_t hash = question_hash(packet, qlen);
+    uint32_t generation = cache->generation;
+
+    for (int i = 0; i < DNS_REPLY_CACHE_ENTRIES; i++)
+    {
+        dns_reply_cache_entry_t *entry = &cache->entry[i];
+        if (entry->hash != hash || entry->generation != generation || entry->question_len != qlen ||
+            entry->reply_len > packet_size || (entry->reply[2] & RD_BIT) != (packet[2] & RD_BIT) ||
+            memcmp(entry->reply + DNS_HEADER_LEN, packet + DNS_HEADER_LEN, qlen) != 0)
+        {
+            continue;
+        }
+
+        // Everything but the transaction ID comes from the cache
+        memcpy(packet + 2, entry->reply + 2, entry->reply_len - 2);
+        entry->last_used = ++cache->clock;
+        cache->hits++;
+        return entry->reply_len;
+    }
+
+    cache->misses++;
+    return 0;
+}
+
+void dns_reply_cache_store(dns_reply_cache_t *cache, uint32_t generation, const uint8_t *reply, size_t reply_len)
+{
+    // Built against rules that have changed since, or a transient failure that must not stick
+    if (generation != cache->generation || reply_len < DNS_HEADER_LEN || reply_len > DNS_REPLY_CACHE_MAX_LEN ||
+        (reply[3] & RCODE_MASK) == RCODE_SERVFAIL)
+    {
+        return;
+    }
+
+    size_t qlen = question_len(reply, reply_len);
+    if (qlen == 0)
+    {
+        return;
+    }
+
+    // Replace the least recently used entry, stale generations first
+    dns_reply_cache_entry_t *victim = &cache->entry[0];
+    for (int i = 0; i < DNS_REPLY_CACHE_ENTRIES; i++)
+    {
+        dns_reply_cache_entry_t *entry = &cache->entry[i];
+        if (entry->generation != cache->generation || entry->reply_len == 0)
+        {
+            victim = entry;
+            break;
+        }
+        if (entry->last_used < victim->last_used)
+        {
+            victim = entry;
+        }
+    }
+
+    victim->hash = question_hash(reply, qlen);
+    victim->generation = generation;
+    victim->last_used = ++cache->clock;
+    victim->question_len = qlen;
+    victim->reply_len = reply_len;
+    memcpy(victim->reply, reply, reply_len);
+}
+
+void dns_reply_cache_invalidate(dns_reply_cache_t *cache)
+{
+    cache->generation++;
+}
\ No newline at end of file
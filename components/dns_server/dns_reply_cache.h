@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of cached replies, captive-portal clients only ever ask a handful of names
+#define DNS_REPLY_CACHE_ENTRIES (8)
+// Largest reply kept, comfortably covers one question with its A answer or SOA
+#define DNS_REPLY_CACHE_MAX_LEN (160)
+
+typedef struct
+{
+    uint32_t hash;        // FNV-1a of the question bytes and the RD bit
+    uint32_t generation;  // Cache generation the reply was built in
+    uint32_t last_used;
+    uint16_t question_len;
+    uint16_t reply_len;
+    uint8_t reply[DNS_REPLY_CACHE_MAX_LEN]; // Complete reply, transaction ID included but overwritten on use
+} dns_reply_cache_entry_t;
+
+/**
+ * @brief Small LRU of fully built replies to single-question queries, keyed by the raw question bytes
+ *
+ * A hit only needs the question section to be located and compared, the reply is copied over the query with the
+ * query's transaction ID. Not thread safe except for dns_reply_cache_invalidate, which may be called from anywhere.
+ */
+typedef struct dns_reply_cache
+{
+    dns_reply_cache_entry_t entry[DNS_REPLY_CACHE_ENTRIES];
+    volatile uint32_t generation;
+    uint32_t clock;
+    uint32_t hits;
+    uint32_t misses;
+} dns_reply_cache_t;
+
+/**
+ * @brief Answer a query from the cache, in place
+ * @param cache Reply cache
+ * @param packet Buffer holding the query, receives the reply on a hit
+ * @param query_len Length of the query
+ * @param packet_size Size of the buffer
+ * @return Length of the reply, or 0 on a miss
+ */
+size_t dns_reply_cache_lookup(dns_reply_cache_t *cache, uint8_t *packet, size_t query_len, size_t packet_size);
+
+/**
+ * @brief Current generation, to be read before building a reply and passed to dns_reply_cache_store
+ */
+static inline uint32_t dns_reply_cache_generation(const dns_reply_cache_t *cache)
+{
+    return cache->generation;
+}
+
+/**
+ * @brief Remember a reply built by dns_packet_build_reply. Replies that are not cacheable are ignored.
+ * @param cache Reply cache
+ * @param generation Generation read before the reply was built, so that replies racing an invalidation are discarded
+ * @param reply Reply packet
+ * @param reply_len Length of the reply
+ */
+void dns_reply_cache_store(dns_reply_cache_t *cache, uint32_t generation, const uint8_t *reply, size_t reply_len);
+
+/**
+ * @brief Drop every cached reply, e.g. because an answer IP changed
+ */
+void dns_reply_cache_invalidate(dns_reply_cache_t *cache);
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_rule_index.h"
+
+#define NODE_NONE (0xFFFF)
+#define MAX_LABEL_LEN (63)
+
+typedef struct
+{
+    const char *label;     // Points into the rule name, not NUL-terminated
+    uint8_t label_len;
+    uint16_t first_child;
+    uint16_t next_sibling;
+    int16_t exact_rule;    // Rule for exactly this name
+    int16_t wildcard_rule; // Rule for "*.<this name>"
+} trie_node_t;
+
+struct dns_rule_index
+{
+    int num_nodes;
+    trie_node_t node[]; // node[0] is the root (empty suffix), its wildcard rule is the catch-all
+};
+
+static inline char to_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+static bool label_equal(const char *a, const char *b, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (to_lower(a[i]) != to_lower(b[i]))
+            return false;
+    }
+    return true;
+}
+
+static int count_labels(const char *name)
+{
+    int labels = 1;
+    for (; *name; name++)
+    {
+        if (*name == '.')
+            labels++;
+    }
+    return labels;
+}
+
+/*
+    Take the last label of name[0..*remaining), i.e. walk the name right to left
+    updates *remaining to the length of what is left in front of the label (without its dot)
+*/
+static const char *take_last_label(const char *name, size_t *remaining, size_t *label_len)
+{
+    size_t start = *remaining;
+    while (start > 0 && name[start - 1] != '.')
+    {
+        start--;
+    }
+
+    *label_len = *remaining - start;
+    *remaining = (start > 0) ? start - 1 : 0;
+    return name + start;
+}
+
+static uint16_t find_child(const dns_rule_index_t *index, uint16_t parent, const char *label, size_t label_len)
+{
+    for (uint16_t child = index->node[parent].first_child; child != NODE_NONE; child = index->node[child].next_sibling)
+    {
+        const trie_node_t *node = &index->node[child];
+        if (node->label_len == label_len && label_equal(node->label, label, label_len))
+            return child;
+    }
+    return NODE_NONE;
+}
+
+dns_rule_index_t *dns_rule_index_build(const char *const *names, int num_names)
+{
+    if (num_names < 0 || num_names > INT16_MAX)
+        return NULL;
+
+    // Worst case every label of every rule gets its own node, plus the root
+    int max_nodes = 1;
+    for (int i = 0; i < num_names; i++)
+    {
+        if (names[i] == NULL)
+            return NULL;
+        max_nodes += count_labels(names[i]);
+    }
+    if (max_nodes >= NODE_NONE)
+        return NULL;
+
+    dns_rule_index_t *index = calloc(1, sizeof(dns_rule_index_t) + max_nodes * sizeof(trie_node_t));
+    if (index == NULL)
+        return NULL;
+
+    index->num_nodes = 1;
+    index->node[0] = (trie_node_t){
+        .first_child = NODE_NONE,
+        .next_sibling = NODE_NONE,
+        .exact_rule = DNS_RULE_NONE,
+        .wildcard_rule = DNS_RULE_NONE,
+    };
+
+    for (int i = 0; i < num_names; i++)
+    {
+        const char *name = names[i];
+        bool wildcard = false;
+
+        if (strcmp(name, "*") == 0)
+        {
+            if (index->node[0].wildcard_rule == DNS_RULE_NONE)
+                index->node[0].wildcard_rule = i;
+            continue;
+        }
+
+        if (name[0] == '*' && name[1] == '.')
+        {
+            wildcard = true;
+            name += 2;
+        }
+
+        // Only a leading "*." is supported, anything else is a configuration error
+        size_t remaining = strlen(name);
+        if (remaining == 0 || strchr(name, '*') != NULL)
+        {
+            free(index);
+            return NULL;
+        }
+
+        uint16_t node = 0;
+        while (remaining > 0)
+        {
+            size_t label_len;
+            const char *label = take_last_label(name, &remaining, &label_len);
+            if (label_len == 0 || label_len > MAX_LABEL_LEN)
+            {
+                free(index);
+                return NULL;
+            }
+
+            uint16_t child = find_child(index, node, label, label_len);
+            if (child == NODE_NONE)
+            {
+                child = index->num_nodes++;
+                index->node[child] = (trie_node_t){
+                    .label = label,
+                    .label_len = (uint8_t)label_len,
+                    .first_child = NODE_NONE,
+                    .next_sibling = index->node[node].first_child,
+                    .exact_rule = DNS_RULE_NONE,
+                    .wildcard_rule = DNS_RULE_NONE,
+                };
+                index->node[node].first_child = child;
+            }
+            node = child;
+        }
+
+        // On duplicates the first rule wins, same as the linear table did
+        int16_t *slot = wildcard ? &index->node[node].wildcard_rule : &index->node[node].exact_rule;
+        if (*slot == DNS_RULE_NONE)
+            *slot = i;
+    }
+
+    return index;
+}
+
+int dns_rule_index_lookup(const dns_rule_index_t *index, const char *name, size_t name_len)
+{
+    return dns_rule_index_lookup_usable(index, name, name_len, NULL, NULL);
+}
+
+int dns_rule_index_lookup_usable(const dns_rule_index_t *index, const char *name, size_t name_len,
+                                 dns_rule_usable_fn_t usable, void *ctx)
+{
+    // Matches are met from the least to the most specific, the last one kept wins
+    int best = DNS_RULE_NONE;
+    int best_usable = DNS_RULE_NONE;
+#define CONSIDER(rule)                                          \
+    do                                                          \
+    {                                                           \
+        int r = (rule);                                         \
+        if (r != DNS_RULE_NONE)                                 \
+        {                                                       \
+            best = r;                                           \
+            if (usable == NULL || usable(ctx, r))               \
+                best_usable = r;                                \
+        }                                                       \
+    } while (0)
+
+    CONSIDER(index->node[0].wildcard_rule);
+    uint16_t node = 0;
+    size_t remaining = name_len;
+
+    while (remaining > 0)
+    {
+        size_t label_len;
+        const char *label = take_last_label(name, &remaining, &label_len);
+
+        node = find_child(index, node, label, label_len);
+        if (node == NODE_NONE)
+            break;
+
+        // A wildcard only covers names with at least one more label in front of its suffix
+        if (remaining > 0)
+            CONSIDER(index->node[node].wildcard_rule);
+        else
+            CONSIDER(index->node[node].exact_rule);
+    }
+#undef CONSIDER
+
+    return (best_usable != DNS_RULE_NONE) ? best_usable : best;
+}
+
+void dns_rule_index_free(dns_rule_index_t *index)
+{
+    free(index);
+}
\ No newline at end of file
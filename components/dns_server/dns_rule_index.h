@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DNS_RULE_NONE (-1)
+
+/**
+ * @brief Compiled rule index: a trie over reversed labels ("www.example.com" is stored as com -> example -> www)
+ *
+ * Supported rule names:
+ *  - "*"              catch-all, answers every name
+ *  - "*.example.com"  any name with at least one more label than "example.com"
+ *  - "portal.local"   exact name
+ *
+ * The most specific rule wins: exact name, then the longest matching wildcard suffix, then the catch-all.
+ * Names are compared case-insensitively, and the index keeps pointers into the rule names, so they must outlive it.
+ */
+typedef struct dns_rule_index dns_rule_index_t;
+
+/**
+ * @brief Build the index over a set of rule names, allocated as a single block
+ * @param names Rule names, the position in the array is the rule ID returned by lookups
+ * @param num_names Number of rule names
+ * @return The index, or NULL on allocation failure or invalid name
+ */
+dns_rule_index_t *dns_rule_index_build(const char *const *names, int num_names);
+
+/**
+ * @brief Find the rule answering a dotted name, in O(label count)
+ * @param index Rule index
+ * @param name Name to look up, without the trailing dot
+ * @param name_len Length of the name
+ * @return Rule ID, or DNS_RULE_NONE if no rule applies
+ */
+int dns_rule_index_lookup(const dns_rule_index_t *index, const char *name, size_t name_len);
+
+/**
+ * @brief Tells whether a rule can answer right now, e.g. whether its interface has an address
+ */
+typedef bool (*dns_rule_usable_fn_t)(void *ctx, int rule);
+
+/**
+ * @brief Find the most specific rule answering a dotted name that is also usable, in O(label count)
+ *
+ * Less specific rules are tried in turn, so "*" still answers when a more specific rule's interface is down.
+ *
+ * @param index Rule index
+ * @param name Name to look up, without the trailing dot
+ * @param name_len Length of the name
+ * @param usable Called for each matching rule
+ * @param ctx User context for usable
+ * @return The most specific usable rule, else the most specific matching one, or DNS_RULE_NONE if no rule applies
+ */
+int dns_rule_index_lookup_usable(const dns_rule_index_t *index, const char *name, size_t name_len,
+                                 dns_rule_usable_fn_t usable, void *ctx);
+
+/**
+ * @brief Free an index returned by dns_rule_index_build
+ */
+void dns_rule_index_free(dns_rule_index_t *index);
\ No newline at end of file
@@ -5,198 +5,180 @@
  */
 
 #include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_check.h"
 #include "esp_netif.h"
+#include "esp_event.h"
 
-#include "lwip/err.h"
-#include "lwip/sockets.h"
-#include "lwip/sys.h"
-#include "lwip/netdb.h"
 #include "dns_server.h"
-
+#include "dns_packet.h"
+#include "dns_reply_cache.h"
+#include "dns_rule_index.h"
+#include "rate_limiter.h"
+#include "fastlog.h"
+#include "metrics.h"
+#include "trace.h"
+#include "alloc_trace.h"
+
+// The simulation build serves on the host, where port 53 needs root
+#if CONFIG_IDF_TARGET_LINUX
+#define DNS_PORT (8053)
+#else
 #define DNS_PORT (53)
-#define DNS_MAX_LEN (256)
-
-#define OPCODE_MASK (0x7800)
-#define QR_FLAG (1 << 7)
-#define QD_TYPE_A (0x0001)
-#define ANS_TTL_SEC (300)
+#endif
 
 static const char *TAG = "dns_redirect_server";
 
-// DNS Header Packet
-typedef struct __attribute__((__packed__))
-{
-    uint16_t id;
-    uint16_t flags;
-    uint16_t qd_count;
-    uint16_t an_count;
-    uint16_t ns_count;
-    uint16_t ar_count;
-} dns_header_t;
-
-// DNS Question Packet
+// Rule compiled from a dns_entry_pair_t at start-up, so queries never touch the netif layer
 typedef struct
 {
-    uint16_t type;
-    uint16_t class;
-} dns_question_t;
-
-// DNS Answer Packet
-typedef struct __attribute__((__packed__))
-{
-    uint16_t ptr_offset;
-    uint16_t type;
-    uint16_t class;
-    uint32_t ttl;
-    uint16_t addr_len;
-    uint32_t ip_addr;
-} dns_answer_t;
+    const char *name;
+    const char *if_key;
+    volatile uint32_t ip;  // Answer IP, refreshed on IP events for netif-based rules
+} dns_rule_t;
 
 // DNS server handle
 struct dns_server_handle
 {
     bool started;
     TaskHandle_t task;
-    int num_of_entries;
-    dns_entry_pair_t entry[];
+    int sock; // Socket served by the caller's reactor, -1 when the server runs its own task
+    esp_event_handler_instance_t ip_event_handler;
+    dns_rule_index_t *index;
+    dns_reply_cache_t cache;
+    uint32_t queries;
+    uint32_t rate_limited;
+    metric_t *queries_metric;
+    metric_t *rate_limited_metric;
+    metric_t *cache_hits_metric;
+    int num_of_rules;
+    dns_rule_t rule[];
 };
 
-/*
-    Parse the name from the packet from the DNS name format to a regular .-seperated name
-    returns the pointer to the next part of the packet
-*/
-static char *parse_dns_name(char *raw_name, char *parsed_name, size_t parsed_name_max_len)
+static bool rule_has_address(void *ctx, int rule)
 {
+    dns_server_handle_t h = ctx;
+    return h->rule[rule].ip != htonl(INADDR_ANY);
+}
 
-    char *label = raw_name;
-    char *name_itr = parsed_name;
-    int name_len = 0;
+// Resolve a question name through the compiled rules, touches no netif APIs
+static dns_lookup_result_t lookup_rule(void *ctx, const char *name, size_t name_len, uint32_t *ip)
+{
+    dns_server_handle_t h = ctx;
 
-    do
+    // Pick the most specific rule with an address: exact name, then longest wildcard suffix, then catch-all ("*"),
+    // so a rule whose interface is down falls through to the next one instead of answering SERVFAIL
+    int rule = dns_rule_index_lookup_usable(h->index, name, name_len, rule_has_address, h);
+    if (rule == DNS_RULE_NONE)
     {
-        int sub_name_len = *label;
-        // (len + 1) since we are adding  a '.'
-        name_len += (sub_name_len + 1);
-        if (name_len > parsed_name_max_len)
-        {
-            return NULL;
-        }
+        return DNS_LOOKUP_NO_NAME;
+    }
 
-        // Copy the sub name that follows the the label
-        memcpy(name_itr, label + 1, sub_name_len);
-        name_itr[sub_name_len] = '.';
-        name_itr += (sub_name_len + 1);
-        label += sub_name_len + 1;
-    } while (*label != 0);
-
-    // Terminate the final string, replacing the last '.'
-    parsed_name[name_len - 1] = '\0';
-    // Return pointer to first char after the name
-    return label + 1;
+    *ip = h->rule[rule].ip;
+    return (*ip != htonl(INADDR_ANY)) ? DNS_LOOKUP_FOUND : DNS_LOOKUP_NO_ADDRESS;
 }
 
-// Parses the DNS request and prepares a DNS response with the IP of the softAP
-static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t dns_reply_max_len, dns_server_handle_t h)
+// UDP socket bound to DNS_PORT on all interfaces, -1 if it can't be created
+static int open_socket(void)
 {
-    if (req_len > dns_reply_max_len)
+    struct sockaddr_in dest_addr;
+    dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(DNS_PORT);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
     {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
         return -1;
     }
+    ESP_LOGI(TAG, "Socket created");
 
-    // Prepare the reply
-    memset(dns_reply, 0, dns_reply_max_len);
-    memcpy(dns_reply, req, req_len);
-
-    // Endianess of NW packet different from chip
-    dns_header_t *header = (dns_header_t *)dns_reply;
-    ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d",
-             ntohs(header->id), ntohs(header->flags), ntohs(header->qd_count));
-
-    // Not a standard query
-    if ((header->flags & OPCODE_MASK) != 0)
+    int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (err < 0)
     {
-        return 0;
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
     }
+    ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
+    return sock;
+}
 
-    // Set question response flag
-    header->flags |= QR_FLAG;
+// Receive one query and answer it, false if the socket failed and has to be reopened
+static bool serve_query(dns_server_handle_t handle, int sock)
+{
+    // Queries are turned into replies in place, so one buffer of the largest UDP message is all it takes
+    uint8_t packet[DNS_PACKET_MAX_LEN];
+    struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+    socklen_t socklen = sizeof(source_addr);
+    int len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&source_addr, &socklen);
+
+    // Error occurred during receiving
+    if (len < 0)
+    {
+        ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+        return false;
+    }
 
-    uint16_t qd_count = ntohs(header->qd_count);
-    header->an_count = htons(qd_count);
+    handle->queries++;
+    metrics_inc(handle->queries_metric);
 
-    int reply_len = qd_count * sizeof(dns_answer_t) + req_len;
-    if (reply_len > dns_reply_max_len)
+    // Drop probe storms before spending any time on parsing
+    if (source_addr.sin6_family == PF_INET &&
+        !rate_limiter_allow(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr))
     {
-        return -1;
+        handle->rate_limited++;
+        metrics_inc(handle->rate_limited_metric);
+        return true;
     }
 
-    // Pointer to current answer and question
-    char *cur_ans_ptr = dns_reply + req_len;
-    char *cur_qd_ptr = dns_reply + sizeof(dns_header_t);
-    char name[128];
+    trace_span_begin("dns_reply");
+    ALLOC_TRACE_STEADY_BEGIN();
 
-    // Respond to all questions based on configured rules
-    for (int qd_i = 0; qd_i < qd_count; qd_i++)
+    // Repeated questions are answered straight from the cache, without parsing or rule evaluation
+    size_t reply_len = dns_reply_cache_lookup(&handle->cache, packet, len, sizeof(packet));
+    if (reply_len != 0)
     {
-        char *name_end_ptr = parse_dns_name(cur_qd_ptr, name, sizeof(name));
-        if (name_end_ptr == NULL)
-        {
-            ESP_LOGE(TAG, "Failed to parse DNS question: %s", cur_qd_ptr);
-            return -1;
-        }
-
-        dns_question_t *question = (dns_question_t *)(name_end_ptr);
-        uint16_t qd_type = ntohs(question->type);
-        uint16_t qd_class = ntohs(question->class);
+        metrics_inc(handle->cache_hits_metric);
+    }
+    else
+    {
+        uint32_t generation = dns_reply_cache_generation(&handle->cache);
+        reply_len = dns_packet_build_reply(packet, len, sizeof(packet), lookup_rule, handle);
+        dns_reply_cache_store(&handle->cache, generation, packet, reply_len);
+    }
 
-        ESP_LOGD(TAG, "Received type: %d | Class: %d | Question for: %s", qd_type, qd_class, name);
+    // Deferred, the address is logged as raw octets instead of formatting it here; IPv6 senders show as 0.0.0.0
+    esp_ip4_addr_t sender = {0};
+    if (source_addr.sin6_family == PF_INET)
+        sender.addr = ((struct sockaddr_in *)&source_addr)->sin_addr.s_addr;
+    FASTLOG_I(TAG, "Received %d bytes from " IPSTR " | DNS reply with len: %d", len, IP2STR(&sender), (int)reply_len);
+    if (reply_len == 0)
+    {
+        ALLOC_TRACE_STEADY_END();
+        trace_span_end("dns_reply");
+        FASTLOG_W(TAG, "Dropped malformed DNS packet");
+        return true;
+    }
 
-        if (qd_type == QD_TYPE_A)
-        {
-            esp_ip4_addr_t ip = {.addr = IPADDR_ANY};
-            // Check the configured rules to decide whether to answer this question or not
-            for (int i = 0; i < h->num_of_entries; ++i)
-            {
-                // check if the name either corresponds to the entry, or if we should answer to all queries ("*")
-                if (strcmp(h->entry[i].name, "*") == 0 || strcmp(h->entry[i].name, name) == 0)
-                {
-                    if (h->entry[i].if_key)
-                    {
-                        esp_netif_ip_info_t ip_info;
-                        esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey(h->entry[i].if_key), &ip_info);
-                        ip.addr = ip_info.ip.addr;
-                        break;
-                    }
-                    else if (h->entry->ip.addr != IPADDR_ANY)
-                    {
-                        ip.addr = h->entry[i].ip.addr;
-                        break;
-                    }
-                }
-            }
-            if (ip.addr == IPADDR_ANY)
-            { // no rule applies, continue with another question
-                continue;
-            }
-            dns_answer_t *answer = (dns_answer_t *)cur_ans_ptr;
-
-            answer->ptr_offset = htons(0xC000 | (cur_qd_ptr - dns_reply));
-            answer->type = htons(qd_type);
-            answer->class = htons(qd_class);
-            answer->ttl = htonl(ANS_TTL_SEC);
-
-            ESP_LOGD(TAG, "Answer with PTR offset: 0x%" PRIX16 " and IP 0x%" PRIX32, ntohs(answer->ptr_offset), ip.addr);
-
-            answer->addr_len = htons(sizeof(ip.addr));
-            answer->ip_addr = ip.addr;
-        }
+    // lwIP allocates the outgoing pbuf from its own pool
+    ALLOC_TRACE_EXEMPT_BEGIN();
+    int err = sendto(sock, packet, reply_len, 0, (struct sockaddr *)&source_addr, socklen);
+    ALLOC_TRACE_EXEMPT_END();
+    ALLOC_TRACE_STEADY_END();
+    trace_span_end("dns_reply");
+    if (err < 0)
+    {
+        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+        return false;
     }
-    return reply_len;
+    return true;
 }
 
 /*
@@ -205,117 +187,162 @@ static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t
 */
 void dns_server_task(void *pvParameters)
 {
-    char rx_buffer[128];
-    char addr_str[128];
-    int addr_family;
-    int ip_protocol;
     dns_server_handle_t handle = pvParameters;
 
     while (handle->started)
     {
-
-        struct sockaddr_in dest_addr;
-        dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(DNS_PORT);
-        addr_family = AF_INET;
-        ip_protocol = IPPROTO_IP;
-        inet_ntoa_r(dest_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
-
-        int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
+        int sock = open_socket();
         if (sock < 0)
         {
-            ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
             break;
         }
-        ESP_LOGI(TAG, "Socket created");
 
-        int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        if (err < 0)
+        while (handle->started && serve_query(handle, sock))
         {
-            ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
         }
-        ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
 
-        while (handle->started)
-        {
-            ESP_LOGI(TAG, "Waiting for data");
-            struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-            socklen_t socklen = sizeof(source_addr);
-            int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
-
-            // Error occurred during receiving
-            if (len < 0)
-            {
-                ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-                close(sock);
-                break;
-            }
-            // Data received
-            else
-            {
-                // Get the sender's ip address as string
-                if (source_addr.sin6_family == PF_INET)
-                {
-                    inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                }
-                else if (source_addr.sin6_family == PF_INET6)
-                {
-                    inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-                }
-
-                // Null-terminate whatever we received and treat like a string...
-                rx_buffer[len] = 0;
-
-                char reply[DNS_MAX_LEN];
-                int reply_len = parse_dns_request(rx_buffer, len, reply, DNS_MAX_LEN, handle);
-
-                ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
-                if (reply_len <= 0)
-                {
-                    ESP_LOGE(TAG, "Failed to prepare a DNS reply");
-                }
-                else
-                {
-                    int err = sendto(sock, reply, reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                    if (err < 0)
-                    {
-                        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                        break;
-                    }
-                }
-            }
-        }
+        ESP_LOGE(TAG, "Shutting down socket");
+        shutdown(sock, 0);
+        close(sock);
+    }
+    vTaskDelete(NULL);
+}
 
-        if (sock != -1)
+// Resolve the answer IP of every netif-based rule, called at start-up and whenever an interface's IP may have changed
+static void refresh_rule_ips(dns_server_handle_t h)
+{
+    for (int i = 0; i < h->num_of_rules; ++i)
+    {
+        if (h->rule[i].if_key == NULL)
+            continue;
+
+        esp_netif_ip_info_t ip_info = {0};
+        esp_netif_t *netif = esp_netif_get_handle_from_ifkey(h->rule[i].if_key);
+        if (netif == NULL || esp_netif_get_ip_info(netif, &ip_info) != ESP_OK)
         {
-            ESP_LOGE(TAG, "Shutting down socket");
-            shutdown(sock, 0);
-            close(sock);
+            ESP_LOGW(TAG, "Interface '%s' has no IP yet, rule '%s' is inactive", h->rule[i].if_key, h->rule[i].name);
         }
+        h->rule[i].ip = ip_info.ip.addr;
     }
-    vTaskDelete(NULL);
+
+    // Cached replies may carry the old addresses
+    dns_reply_cache_invalidate(&h->cache);
+}
+
+static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    refresh_rule_ips((dns_server_handle_t)arg);
 }
 
 dns_server_handle_t start_dns_server(dns_server_config_t *config)
 {
-    dns_server_handle_t handle = calloc(1, sizeof(struct dns_server_handle) + config->num_of_entries * sizeof(dns_entry_pair_t));
+    dns_server_handle_t handle = calloc(1, sizeof(struct dns_server_handle) + config->num_of_entries * sizeof(dns_rule_t));
     ESP_RETURN_ON_FALSE(handle, NULL, TAG, "Failed to allocate dns server handle");
 
+    const char **names = calloc(config->num_of_entries, sizeof(const char *));
+    if (names == NULL)
+    {
+        free(handle);
+        ESP_LOGE(TAG, "Failed to allocate rule names");
+        return NULL;
+    }
+
     handle->started = true;
-    handle->num_of_entries = config->num_of_entries;
-    memcpy(handle->entry, config->item, config->num_of_entries * sizeof(dns_entry_pair_t));
+    handle->queries_metric = metrics_counter("dns_queries_total", "DNS packets received, including rate-limited ones");
+    handle->rate_limited_metric = metrics_counter("dns_rate_limited_total", "DNS packets dropped by the rate limiter");
+    handle->cache_hits_metric = metrics_counter("dns_cache_hits_total", "DNS replies served from the reply cache");
+    handle->num_of_rules = config->num_of_entries;
+    for (int i = 0; i < config->num_of_entries; ++i)
+    {
+        handle->rule[i].name = config->item[i].name;
+        handle->rule[i].if_key = config->item[i].if_key;
+        handle->rule[i].ip = config->item[i].ip.addr;
+        names[i] = config->item[i].name;
+    }
+
+    // The index only keeps pointers to the names themselves, the temporary array can go
+    handle->index = dns_rule_index_build(names, config->num_of_entries);
+    free(names);
+    if (handle->index == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to build the rule index, check the rule names");
+        free(handle);
+        return NULL;
+    }
+    refresh_rule_ips(handle);
+
+    // Any IP event may mean an interface was (re)addressed, keep the cached answers in sync
+    esp_err_t err = esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler,
+                                                        handle, &handle->ip_event_handler);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to register IP event handler, cached answers won't follow IP changes: %s", esp_err_to_name(err));
+    }
 
-    xTaskCreate(dns_server_task, "dns_server", 4096, handle, 5, &handle->task);
+    if (config->task == NULL)
+    {
+        // No task of its own, the caller's reactor waits on the socket and hands over whatever arrives
+        handle->sock = open_socket();
+    }
+    else
+    {
+        handle->sock = -1;
+        task_config_create(dns_server_task, handle, config->task, &handle->task);
+    }
     return handle;
 }
 
+void dns_server_refresh(dns_server_handle_t handle)
+{
+    if (handle)
+    {
+        refresh_rule_ips(handle);
+    }
+}
+
+int dns_server_socket(dns_server_handle_t handle)
+{
+    return handle ? handle->sock : -1;
+}
+
+void dns_server_on_readable(void *ctx)
+{
+    dns_server_handle_t handle = ctx;
+    if (handle && handle->sock >= 0)
+    {
+        serve_query(handle, handle->sock);
+    }
+}
+
+void dns_server_get_stats(dns_server_handle_t handle, dns_server_stats_t *stats)
+{
+    if (handle && stats)
+    {
+        stats->queries = handle->queries;
+        stats->rate_limited = handle->rate_limited;
+        stats->cache_hits = handle->cache.hits;
+        stats->cache_misses = handle->cache.misses;
+    }
+}
+
 void stop_dns_server(dns_server_handle_t handle)
 {
     if (handle)
     {
         handle->started = false;
-        vTaskDelete(handle->task);
+        if (handle->ip_event_handler)
+        {
+            esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID, handle->ip_event_handler);
+        }
+        if (handle->task)
+        {
+            vTaskDelete(handle->task);
+        }
+        if (handle->sock >= 0)
+        {
+            close(handle->sock);
+        }
+        dns_rule_index_free(handle->index);
         free(handle);
     }
 }
\ No newline at end of file
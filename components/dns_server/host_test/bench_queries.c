@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "dns_host.h"
+
+/*
+    Queries per second through the DNS reply path, for the same mix of phone queries on three variants:
+     - netif per answer: linear scan with strcmp against "*" and a netif list walked under a lock per answer,
+       standing in for the esp_netif_get_handle_from_ifkey/esp_netif_get_ip_info calls made before rules were compiled
+     - rule index: compiled rules with cached addresses, every query parsed and built
+     - reply cache: the firmware's path, repeated questions copied from the cache
+    Host numbers only compare the variants with each other, they say nothing about the ESP32's absolute rate. The
+    host lock is never contended here, on the device the netif lock is shared with the lwIP and WiFi tasks.
+
+      bench_queries [-seconds=S]
+*/
+
+typedef struct
+{
+    const char *name;
+    uint16_t type;
+} bench_query_t;
+
+// What a handful of phones joining at once ask, no more distinct questions than the reply cache holds
+static const bench_query_t workload[] = {
+    {"captive.apple.com", DNS_TYPE_HTTPS},
+    {"captive.apple.com", DNS_TYPE_A},
+    {"captive.apple.com", DNS_TYPE_AAAA},
+    {"connectivitycheck.gstatic.com", DNS_TYPE_A},
+    {"connectivitycheck.gstatic.com", DNS_TYPE_AAAA},
+    {"www.google.com", DNS_TYPE_A},
+    {"clients3.google.com", DNS_TYPE_A},
+    {"www.msftconnecttest.com", DNS_TYPE_A},
+};
+#define WORKLOAD_LEN (sizeof(workload) / sizeof(workload[0]))
+
+// Stand-in for the esp_netif list: a lock, and the interfaces looked up by key
+static pthread_mutex_t netif_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *const netif_keys[] = {"WIFI_STA_DEF", "WIFI_AP_DEF"};
+
+static bool name_matches(const char *rule, const char *name, size_t name_len)
+{
+    if (strcmp(rule, "*") == 0)
+        return true;
+    if (rule[0] == '*' && rule[1] == '.')
+    {
+        size_t suffix_len = strlen(rule + 1);
+        return name_len > suffix_len && strncasecmp(name + name_len - suffix_len, rule + 1, suffix_len) == 0;
+    }
+    return strlen(rule) == name_len && strncasecmp(rule, name, name_len) == 0;
+}
+
+// What esp_netif_get_handle_from_ifkey and esp_netif_get_ip_info did per answer: walk the list under its lock
+static uint32_t netif_ip(const char *if_key, uint32_t ip)
+{
+    uint32_t found = 0;
+    pthread_mutex_lock(&netif_lock);
+    for (size_t i = 0; i < sizeof(netif_keys) / sizeof(netif_keys[0]); i++)
+    {
+        if (strcmp(netif_keys[i], if_key) == 0)
+            found = ip;
+    }
+    pthread_mutex_unlock(&netif_lock);
+    return found;
+}
+
+// The rule set as the server walked it before rules were compiled: first match in order, address of the SoftAP
+// netif read per answer
+static dns_lookup_result_t lookup_netif_per_answer(void *ctx, const char *name, size_t name_len, uint32_t *ip)
+{
+    dns_host_t *host = ctx;
+    for (int i = 0; i < host->num_rules; i++)
+    {
+        if (!name_matches(host->rule[i].name, name, name_len))
+            continue;
+
+        *ip = netif_ip("WIFI_AP_DEF", host->rule[i].ip);
+        return (*ip != htonl(INADDR_ANY)) ? DNS_LOOKUP_FOUND : DNS_LOOKUP_NO_ADDRESS;
+    }
+    return DNS_LOOKUP_NO_NAME;
+}
+
+typedef enum
+{
+    PATH_NETIF_PER_ANSWER,
+    PATH_RULE_INDEX,
+    PATH_REPLY_CACHE,
+} bench_path_t;
+
+static const char *const path_names[] = {"netif per answer", "rule index", "reply cache"};
+
+static size_t answer(bench_path_t path, dns_host_t *host, uint8_t *packet, size_t len)
+{
+    if (path == PATH_NETIF_PER_ANSWER)
+        return dns_packet_build_reply(packet, len, DNS_PACKET_MAX_LEN, lookup_netif_per_answer, host);
+    return dns_host_answer(host, packet, len, DNS_PACKET_MAX_LEN);
+}
+
+static double run(bench_path_t path, dns_host_t *host, double seconds)
+{
+    uint8_t queries[WORKLOAD_LEN][DNS_PACKET_MAX_LEN];
+    size_t lens[WORKLOAD_LEN];
+    for (size_t i = 0; i < WORKLOAD_LEN; i++)
+        lens[i] = dns_host_make_query(queries[i], (uint16_t)i, workload[i].name, workload[i].type, 1232);
+
+    // Batches between clock reads, so reading the clock doesn't dominate
+    const int batch = 4096;
+    uint64_t count = 0;
+    uint64_t sink = 0;
+    uint64_t start_ns = dns_host_now_ns();
+    uint64_t end_ns = start_ns + (uint64_t)(seconds * 1e9);
+    uint64_t now_ns;
+    do
+    {
+        for (int i = 0; i < batch; i++)
+        {
+            uint8_t packet[DNS_PACKET_MAX_LEN];
+            size_t q = (count + i) % WORKLOAD_LEN;
+            memcpy(packet, queries[q], lens[q]);
+            packet[1] = (uint8_t)(count + i); // A fresh transaction ID, as from a real client
+            sink += answer(path, host, packet, lens[q]);
+        }
+        count += batch;
+        now_ns = dns_host_now_ns();
+    } while (now_ns < end_ns);
+
+    if (sink == 0)
+        abort();
+    return count / ((now_ns - start_ns) / 1e9);
+}
+
+// Every variant must give the same replies, or the comparison is meaningless
+static void check_same_replies(dns_host_t *host, dns_host_t *cached)
+{
+    for (size_t i = 0; i < WORKLOAD_LEN; i++)
+    {
+        uint8_t reference[DNS_PACKET_MAX_LEN];
+        size_t len = dns_host_make_query(reference, 0x4242, workload[i].name, workload[i].type, 1232);
+        size_t reference_len = answer(PATH_RULE_INDEX, host, reference, len);
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            bench_path_t path = pass == 0 ? PATH_NETIF_PER_ANSWER : PATH_REPLY_CACHE;
+            uint8_t packet[DNS_PACKET_MAX_LEN];
+            dns_host_make_query(packet, 0x4242, workload[i].name, workload[i].type, 1232);
+            size_t reply_len = answer(path, pass == 0 ? host : cached, packet, len);
+            if (reply_len != reference_len || memcmp(packet, reference, reply_len) != 0)
+            {
+                fprintf(stderr, "%s answers %s type %u differently\n", path_names[path], workload[i].name,
+                        workload[i].type);
+                exit(1);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 1.0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-seconds=", 9) == 0)
+            seconds = atof(argv[i] + 9);
+    }
+
+    // The firmware's single catch-all, and a fuller set where the linear scan has more to compare
+    static const dns_host_rule_t portal[] = {
+        {.name = "*", .ip = DNS_HOST_PORTAL_IP},
+    };
+    static const dns_host_rule_t full[] = {
+        {.name = "portal.local", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "*.backend.local", .ip = 0x6404A8C0},
+        {.name = "*.apple.com", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "connectivitycheck.gstatic.com", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "*.google.com", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "*.msftconnecttest.com", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "*.msftncsi.com", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "*", .ip = DNS_HOST_PORTAL_IP},
+    };
+    static const struct
+    {
+        const char *name;
+        const dns_host_rule_t *rules;
+        int num_rules;
+    } sets[] = {
+        {"1 rule", portal, sizeof(portal) / sizeof(portal[0])},
+        {"8 rules", full, sizeof(full) / sizeof(full[0])},
+    };
+
+    printf("%-8s %-18s %14s %10s\n", "rules", "path", "queries/s", "ns/query");
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+    {
+        dns_host_t host, cached;
+        if (!dns_host_init(&host, sets[s].rules, sets[s].num_rules, false) ||
+            !dns_host_init(&cached, sets[s].rules, sets[s].num_rules, true))
+            return 1;
+        check_same_replies(&host, &cached);
+
+        for (int path = PATH_NETIF_PER_ANSWER; path <= PATH_REPLY_CACHE; path++)
+        {
+            double rate = run((bench_path_t)path, path == PATH_REPLY_CACHE ? &cached : &host, seconds);
+            printf("%-8s %-18s %14.0f %10.1f\n", sets[s].name, path_names[path], rate, 1e9 / rate);
+        }
+
+        dns_host_free(&host);
+        dns_host_free(&cached);
+    }
+    return 0;
+}
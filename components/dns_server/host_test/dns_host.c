@@ -0,0 +1,194 @@
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "dns_host.h"
+
+#define DNS_HEADER_LEN (12)
+#define DNS_TYPE_SOA (6)
+#define DNS_TYPE_OPT (41)
+#define DNS_CLASS_IN (1)
+#define RD_FLAG (0x0100)
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static bool rule_has_address(void *ctx, int rule)
+{
+    dns_host_t *host = ctx;
+    return host->rule[rule].ip != htonl(INADDR_ANY);
+}
+
+// Same as lookup_rule in dns_server.c
+static dns_lookup_result_t lookup_rule(void *ctx, const char *name, size_t name_len, uint32_t *ip)
+{
+    dns_host_t *host = ctx;
+
+    int rule = dns_rule_index_lookup_usable(host->index, name, name_len, rule_has_address, host);
+    if (rule == DNS_RULE_NONE)
+        return DNS_LOOKUP_NO_NAME;
+
+    *ip = host->rule[rule].ip;
+    return (*ip != htonl(INADDR_ANY)) ? DNS_LOOKUP_FOUND : DNS_LOOKUP_NO_ADDRESS;
+}
+
+bool dns_host_init(dns_host_t *host, const dns_host_rule_t *rules, int num_rules, bool use_cache)
+{
+    if (num_rules > DNS_HOST_MAX_RULES)
+        return false;
+
+    memset(host, 0, sizeof(*host));
+    const char *names[DNS_HOST_MAX_RULES];
+    for (int i = 0; i < num_rules; i++)
+    {
+        host->rule[i] = rules[i];
+        names[i] = rules[i].name;
+    }
+    host->num_rules = num_rules;
+    host->use_cache = use_cache;
+    host->index = dns_rule_index_build(names, num_rules);
+    return host->index != NULL;
+}
+
+bool dns_host_init_portal(dns_host_t *host, bool use_cache)
+{
+    static const dns_host_rule_t portal_rules[] = {
+        {.name = "*", .ip = DNS_HOST_PORTAL_IP},
+    };
+    return dns_host_init(host, portal_rules, sizeof(portal_rules) / sizeof(portal_rules[0]), use_cache);
+}
+
+void dns_host_free(dns_host_t *host)
+{
+    dns_rule_index_free(host->index);
+    host->index = NULL;
+}
+
+size_t dns_host_answer(dns_host_t *host, uint8_t *packet, size_t len, size_t size)
+{
+    if (!host->use_cache)
+        return dns_packet_build_reply(packet, len, size, lookup_rule, host);
+
+    size_t reply_len = dns_reply_cache_lookup(&host->cache, packet, len, size);
+    if (reply_len != 0)
+        return reply_len;
+
+    uint32_t generation = dns_reply_cache_generation(&host->cache);
+    reply_len = dns_packet_build_reply(packet, len, size, lookup_rule, host);
+    dns_reply_cache_store(&host->cache, generation, packet, reply_len);
+    return reply_len;
+}
+
+size_t dns_host_make_query(uint8_t *packet, uint16_t id, const char *name, uint16_t type, uint16_t edns_payload)
+{
+    memset(packet, 0, DNS_HEADER_LEN);
+    put_u16(packet, id);
+    put_u16(packet + 2, RD_FLAG);
+    put_u16(packet + 4, 1);
+    put_u16(packet + 10, edns_payload ? 1 : 0);
+
+    size_t offset = DNS_HEADER_LEN;
+    while (*name)
+    {
+        const char *dot = strchr(name, '.');
+        size_t label_len = dot ? (size_t)(dot - name) : strlen(name);
+        packet[offset++] = (uint8_t)label_len;
+        memcpy(packet + offset, name, label_len);
+        offset += label_len;
+        name += label_len + (dot ? 1 : 0);
+    }
+    packet[offset++] = 0;
+    put_u16(packet + offset, type);
+    put_u16(packet + offset + 2, DNS_CLASS_IN);
+    offset += 4;
+
+    if (edns_payload)
+    {
+        // OPT pseudo-record: root name, type, payload size as class, extended RCODE and flags, no options
+        packet[offset++] = 0;
+        put_u16(packet + offset, DNS_TYPE_OPT);
+        put_u16(packet + offset + 2, edns_payload);
+        memset(packet + offset + 4, 0, 6);
+        offset += 10;
+    }
+    return offset;
+}
+
+// Skip a name in a record, labels or a compression pointer, 0 if it runs past the packet
+static size_t skip_name(const uint8_t *packet, size_t len, size_t offset)
+{
+    while (offset < len)
+    {
+        uint8_t label_len = packet[offset];
+        if ((label_len & 0xC0) == 0xC0)
+            return offset + 2 <= len ? offset + 2 : 0;
+        offset += 1 + label_len;
+        if (label_len == 0)
+            return offset;
+    }
+    return 0;
+}
+
+bool dns_host_parse_reply(const uint8_t *packet, size_t len, dns_host_reply_t *reply)
+{
+    if (len < DNS_HEADER_LEN)
+        return false;
+
+    memset(reply, 0, sizeof(*reply));
+    reply->id = get_u16(packet);
+    reply->flags = get_u16(packet + 2);
+    reply->rcode = reply->flags & 0x000F;
+    reply->an_count = get_u16(packet + 6);
+    reply->ns_count = get_u16(packet + 8);
+    reply->ar_count = get_u16(packet + 10);
+
+    size_t offset = DNS_HEADER_LEN;
+    for (int i = 0; i < get_u16(packet + 4); i++)
+    {
+        offset = skip_name(packet, len, offset);
+        if (offset == 0 || offset + 4 > len)
+            return false;
+        offset += 4;
+    }
+
+    int records = reply->an_count + reply->ns_count + reply->ar_count;
+    for (int i = 0; i < records; i++)
+    {
+        offset = skip_name(packet, len, offset);
+        if (offset == 0 || offset + 10 > len)
+            return false;
+
+        uint16_t type = get_u16(packet + offset);
+        uint16_t rd_len = get_u16(packet + offset + 8);
+        offset += 10;
+        if (offset + rd_len > len)
+            return false;
+
+        if (type == DNS_TYPE_A && rd_len == 4 && reply->a == 0)
+            memcpy(&reply->a, packet + offset, 4);
+        else if (type == DNS_TYPE_SOA && rd_len >= 4)
+            reply->soa_min = get_u32(packet + offset + rd_len - 4);
+        offset += rd_len;
+    }
+    return offset == len;
+}
+
+uint64_t dns_host_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dns_packet.h"
+#include "dns_reply_cache.h"
+#include "dns_rule_index.h"
+
+// Address the firmware's "*" rule answers with, the SoftAP's default IP
+#define DNS_HOST_PORTAL_IP (0x0104A8C0) // 192.168.4.1 in network byte order
+
+#define DNS_HOST_MAX_RULES (8)
+
+// DNS record types the phone sequences ask for
+#define DNS_TYPE_A (1)
+#define DNS_TYPE_AAAA (28)
+#define DNS_TYPE_HTTPS (65)
+
+/**
+ * @brief One rule as dns_server.c compiles it from a dns_entry_pair_t, with the netif already resolved
+ */
+typedef struct
+{
+    const char *name;
+    uint32_t ip; // Network byte order, INADDR_ANY for a netif without an address
+} dns_host_rule_t;
+
+/**
+ * @brief The query path of dns_server.c without its socket and platform: rule index, reply cache and packet builder
+ */
+typedef struct
+{
+    dns_host_rule_t rule[DNS_HOST_MAX_RULES];
+    int num_rules;
+    dns_rule_index_t *index;
+    dns_reply_cache_t cache;
+    bool use_cache;
+} dns_host_t;
+
+/**
+ * @brief Compile the rules, as start_dns_server does
+ * @return false if the index can't be built
+ */
+bool dns_host_init(dns_host_t *host, const dns_host_rule_t *rules, int num_rules, bool use_cache);
+
+/**
+ * @brief The firmware's rule set: "*" answered with the SoftAP address
+ */
+bool dns_host_init_portal(dns_host_t *host, bool use_cache);
+
+void dns_host_free(dns_host_t *host);
+
+/**
+ * @brief Turn a query into its reply in place, exactly like serve_query does between recvfrom and sendto
+ * @return Length of the reply, 0 if the firmware would drop the packet
+ */
+size_t dns_host_answer(dns_host_t *host, uint8_t *packet, size_t len, size_t size);
+
+/**
+ * @brief Write a single-question query the way phone resolvers send them
+ * @param packet Buffer of at least DNS_PACKET_MAX_LEN bytes
+ * @param id Transaction ID
+ * @param name Dotted name without the trailing dot
+ * @param type Record type
+ * @param edns_payload EDNS UDP payload size advertised in an OPT record, 0 for none
+ * @return Length of the query
+ */
+size_t dns_host_make_query(uint8_t *packet, uint16_t id, const char *name, uint16_t type, uint16_t edns_payload);
+
+/**
+ * @brief Fields of a reply, as a phone's resolver would read them
+ */
+typedef struct
+{
+    uint16_t id;
+    uint16_t flags;
+    uint16_t rcode;
+    uint16_t an_count;
+    uint16_t ns_count;
+    uint16_t ar_count;
+    uint32_t a;        // Address of the first A answer, network byte order, 0 if none
+    uint32_t soa_min;  // Negative caching TTL of the SOA, 0 if none
+} dns_host_reply_t;
+
+/**
+ * @brief Parse a reply to a single-question query
+ * @return false if the reply isn't well formed
+ */
+bool dns_host_parse_reply(const uint8_t *packet, size_t len, dns_host_reply_t *reply);
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ */
+uint64_t dns_host_now_ns(void);
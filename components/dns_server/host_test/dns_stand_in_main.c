@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "udp_stand_in.h"
+
+/*
+    Serve the firmware's DNS rules on 127.0.0.1 for manual testing, e.g.
+    dig @127.0.0.1 -p 8053 +edns=0 captive.apple.com HTTPS
+*/
+int main(int argc, char **argv)
+{
+    uint16_t port = argc > 1 ? (uint16_t)atoi(argv[1]) : 8053;
+
+    dns_host_t host;
+    if (!dns_host_init_portal(&host, true))
+        return 1;
+
+    int sock = udp_stand_in_open(port, &port);
+    if (sock < 0)
+        return 1;
+
+    printf("Serving DNS on 127.0.0.1:%u\n", port);
+    fflush(stdout);
+    while (udp_stand_in_serve_one(&host, sock))
+    {
+    }
+
+    dns_host_free(&host);
+    return 1;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "dns_host.h"
+
+/*
+    Fuzz entry point around dns_packet_build_reply, run on every packet a client could send.
+    Checked for every input, on top of the sanitizers:
+     - parsing stays within the query, replies never exceed the buffer nor the 512 byte UDP limit
+     - replies always have QR set
+     - every reply is well formed, its records stay within its length
+     - the reply cache hands out exactly what a fresh build produces
+
+    Built for libFuzzer with -DDNS_HOST_LIBFUZZER=ON (clang), otherwise a built-in mutator drives it:
+      fuzz_build_reply [-runs=N] [-seed=N] [crash files...]
+*/
+
+static dns_host_t plain;
+static dns_host_t cached;
+
+static void setup(void)
+{
+    static bool done = false;
+    if (done)
+        return;
+    done = true;
+
+    // A rule per kind, one of them on an interface without an address so fallbacks and SERVFAIL are reachable
+    static const dns_host_rule_t rules[] = {
+        {.name = "*", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "*.apple.com", .ip = 0},
+        {.name = "connectivitycheck.gstatic.com", .ip = DNS_HOST_PORTAL_IP},
+        {.name = "backend.local", .ip = 0},
+        {.name = "*.backend.local", .ip = 0x6404A8C0}, // 192.168.4.100
+    };
+    int num_rules = sizeof(rules) / sizeof(rules[0]);
+    if (!dns_host_init(&plain, rules, num_rules, false) || !dns_host_init(&cached, rules, num_rules, true))
+        abort();
+}
+
+static void check(bool ok, const char *what, const uint8_t *data, size_t size)
+{
+    if (ok)
+        return;
+
+    fprintf(stderr, "Check failed: %s, input of %zu bytes:", what, size);
+    for (size_t i = 0; i < size; i++)
+        fprintf(stderr, "%s%02x", i % 16 ? " " : "\n  ", data[i]);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    setup();
+
+    // recvfrom truncates to the buffer, the firmware never sees more
+    if (size > DNS_PACKET_MAX_LEN)
+        size = DNS_PACKET_MAX_LEN;
+
+    // In a buffer of exactly the query's size, so the sanitizers catch any read or write past it
+    uint8_t *exact = malloc(size ? size : 1);
+    memcpy(exact, data, size);
+    size_t exact_len = dns_host_answer(&plain, exact, size, size);
+    check(exact_len <= size, "reply overruns the buffer", data, size);
+    free(exact);
+
+    uint8_t fresh[DNS_PACKET_MAX_LEN];
+    memcpy(fresh, data, size);
+    size_t fresh_len = dns_host_answer(&plain, fresh, size, sizeof(fresh));
+    check(fresh_len <= DNS_PACKET_MAX_LEN, "reply too long", data, size);
+
+    if (fresh_len != 0)
+    {
+        dns_host_reply_t reply;
+        check(dns_host_parse_reply(fresh, fresh_len, &reply), "malformed reply", data, size);
+        check(reply.flags & 0x8000, "reply without QR", data, size);
+    }
+
+    // Twice through the cache: the first stores, the second is answered from the cache if the query is cacheable
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint8_t packet[DNS_PACKET_MAX_LEN];
+        memcpy(packet, data, size);
+        size_t len = dns_host_answer(&cached, packet, size, sizeof(packet));
+        check(len == fresh_len && memcmp(packet, fresh, len) == 0, "cached reply differs", data, size);
+    }
+    return 0;
+}
+
+#ifndef DNS_HOST_LIBFUZZER
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)rng_state;
+}
+
+// One random edit of the kind that breaks parsers: flipped bits, boundary bytes, truncation, duplicated chunks
+static size_t mutate(uint8_t *data, size_t size, size_t max_size)
+{
+    static const uint8_t interesting[] = {0x00, 0x01, 0x3F, 0x40, 0x7F, 0x80, 0xC0, 0xC1, 0xFF};
+
+    switch (rng() % 5)
+    {
+    case 0:
+        if (size > 0)
+            data[rng() % size] ^= 1 << (rng() % 8);
+        break;
+    case 1:
+        if (size > 0)
+            data[rng() % size] = interesting[rng() % sizeof(interesting)];
+        break;
+    case 2:
+        if (size > 0)
+            size = rng() % size;
+        break;
+    case 3:
+        if (size > 0 && size < max_size)
+        {
+            // Copy a chunk of the packet to another place in it, e.g. a second question or a nested label
+            uint8_t chunk[DNS_PACKET_MAX_LEN];
+            size_t from = rng() % size;
+            size_t len = 1 + rng() % (size - from);
+            size_t to = rng() % (size + 1);
+            if (size + len > max_size)
+                len = max_size - size;
+            memcpy(chunk, data + from, len);
+            memmove(data + to + len, data + to, size - to);
+            memcpy(data + to, chunk, len);
+            size += len;
+        }
+        break;
+    default:
+        // Counts are where most of the parsing decisions are made
+        if (size >= 12)
+            data[4 + rng() % 8] = (uint8_t)(rng() % 4);
+        break;
+    }
+    return size;
+}
+
+static size_t make_seeds(uint8_t seeds[][DNS_PACKET_MAX_LEN], size_t *lens)
+{
+    static const struct
+    {
+        const char *name;
+        uint16_t type;
+        uint16_t edns_payload;
+    } queries[] = {
+        {"captive.apple.com", DNS_TYPE_A, 0},
+        {"captive.apple.com", DNS_TYPE_HTTPS, 1232},
+        {"connectivitycheck.gstatic.com", DNS_TYPE_AAAA, 1232},
+        {"x.backend.local", DNS_TYPE_A, 0},
+        {"backend.local", 255, 4096},
+    };
+    size_t n = 0;
+    for (; n < sizeof(queries) / sizeof(queries[0]); n++)
+        lens[n] = dns_host_make_query(seeds[n], (uint16_t)(0x1000 + n), queries[n].name, queries[n].type,
+                                      queries[n].edns_payload);
+
+    // Two questions in one query
+    size_t len = dns_host_make_query(seeds[n], 0x6789, "a.b", DNS_TYPE_A, 0);
+    size_t second = dns_host_make_query(seeds[n] + len, 0, "www.apple.com", DNS_TYPE_A, 0);
+    memmove(seeds[n] + len, seeds[n] + len + 12, second - 12);
+    seeds[n][5] = 2;
+    lens[n] = len + second - 12;
+    n++;
+
+    // A name at the length limit, made of 63 byte labels
+    char long_name[DNS_PACKET_MAX_NAME_LEN + 1];
+    memset(long_name, 'a', sizeof(long_name) - 1);
+    long_name[63] = long_name[127] = long_name[191] = '.';
+    long_name[DNS_PACKET_MAX_NAME_LEN] = '\0';
+    lens[n] = dns_host_make_query(seeds[n], 0x789A, long_name, DNS_TYPE_A, 0);
+    n++;
+    return n;
+}
+
+static int replay(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    uint8_t data[4096];
+    size_t size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(data, size);
+    printf("%s: ok\n", path);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long runs = 200000;
+    int files = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-runs=", 6) == 0)
+            runs = strtoul(argv[i] + 6, NULL, 0);
+        else if (strncmp(argv[i], "-seed=", 6) == 0)
+            rng_state = strtoull(argv[i] + 6, NULL, 0) | 1;
+        else if (replay(argv[i]) == 0)
+            files++;
+        else
+            return 1;
+    }
+    if (files > 0)
+        return 0;
+
+    static uint8_t seeds[8][DNS_PACKET_MAX_LEN];
+    size_t seed_lens[8];
+    size_t num_seeds = make_seeds(seeds, seed_lens);
+    for (size_t i = 0; i < num_seeds; i++)
+        LLVMFuzzerTestOneInput(seeds[i], seed_lens[i]);
+
+    uint8_t data[DNS_PACKET_MAX_LEN];
+    for (unsigned long run = 0; run < runs; run++)
+    {
+        size_t seed = rng() % num_seeds;
+        size_t size = seed_lens[seed];
+        memcpy(data, seeds[seed], size);
+
+        int edits = 1 + rng() % 4;
+        for (int i = 0; i < edits; i++)
+            size = mutate(data, size, sizeof(data));
+        LLVMFuzzerTestOneInput(data, size);
+    }
+
+    printf("%lu inputs, all checks passed\n", runs + num_seeds);
+    return 0;
+}
+
+#endif
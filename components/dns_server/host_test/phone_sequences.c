@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dns_host.h"
+#include "udp_stand_in.h"
+
+/*
+    Replays the DNS queries phones send when they join the SoftAP, in the order and with the record types and
+    EDNS OPT records their resolvers use, and checks every reply is final: an A answer with the portal address, or
+    NODATA with an SOA for AAAA and HTTPS, so nothing is retried. Anything else (no reply, SERVFAIL, a reply the
+    resolver can't parse) costs the phone a resolver timeout before it sends its captive-portal probe.
+
+    Time-to-portal is measured from the first query to the last reply the phone needs before that probe, both
+    in-process against dns_packet_build_reply and over UDP on 127.0.0.1 through the socket stand-in, with every
+    query of a phone in flight at once as resolvers send them.
+*/
+
+#define REPLY_TIMEOUT_MS (1000)
+// Generous for the host, only catches a reply path that stalls or makes the phone retry
+#define MAX_TIME_TO_PORTAL_US (50000)
+
+typedef struct
+{
+    const char *name;
+    uint16_t type;
+} phone_query_t;
+
+typedef struct
+{
+    const char *phone;
+    uint16_t edns_payload;
+    const phone_query_t *queries;
+    int num_queries;
+} phone_sequence_t;
+
+// iOS: the captive network assistant asks for the probe host's HTTPS record alongside A and AAAA
+static const phone_query_t ios_queries[] = {
+    {"captive.apple.com", DNS_TYPE_HTTPS},
+    {"captive.apple.com", DNS_TYPE_A},
+    {"captive.apple.com", DNS_TYPE_AAAA},
+};
+
+// Android: HTTP and HTTPS probes run side by side, each resolving both address families
+static const phone_query_t android_queries[] = {
+    {"connectivitycheck.gstatic.com", DNS_TYPE_A},
+    {"connectivitycheck.gstatic.com", DNS_TYPE_AAAA},
+    {"www.google.com", DNS_TYPE_A},
+    {"www.google.com", DNS_TYPE_AAAA},
+};
+
+// Android with Private DNS: the HTTPS record of the probe host is asked for as well
+static const phone_query_t android_svcb_queries[] = {
+    {"connectivitycheck.gstatic.com", DNS_TYPE_HTTPS},
+    {"connectivitycheck.gstatic.com", DNS_TYPE_A},
+    {"connectivitycheck.gstatic.com", DNS_TYPE_AAAA},
+    {"www.google.com", DNS_TYPE_HTTPS},
+    {"www.google.com", DNS_TYPE_A},
+    {"www.google.com", DNS_TYPE_AAAA},
+};
+
+static const phone_sequence_t sequences[] = {
+    {"iOS", 1232, ios_queries, sizeof(ios_queries) / sizeof(ios_queries[0])},
+    {"Android", 1232, android_queries, sizeof(android_queries) / sizeof(android_queries[0])},
+    {"Android HTTPS", 1232, android_svcb_queries, sizeof(android_svcb_queries) / sizeof(android_svcb_queries[0])},
+    {"no EDNS", 0, ios_queries, sizeof(ios_queries) / sizeof(ios_queries[0])},
+};
+
+static int failures = 0;
+
+// A reply the phone's resolver accepts as final
+static void check_reply(const phone_sequence_t *seq, const phone_query_t *query, uint16_t id, const uint8_t *packet,
+                        size_t len)
+{
+    dns_host_reply_t reply;
+    const char *problem = NULL;
+
+    if (len == 0)
+        problem = "no reply";
+    else if (!dns_host_parse_reply(packet, len, &reply))
+        problem = "malformed reply";
+    else if (reply.id != id || !(reply.flags & 0x8000))
+        problem = "not a reply to the query";
+    else if (reply.rcode != 0)
+        problem = "error rcode";
+    else if (query->type == DNS_TYPE_A && (reply.an_count != 1 || reply.a != DNS_HOST_PORTAL_IP))
+        problem = "no portal address";
+    else if (query->type != DNS_TYPE_A && (reply.an_count != 0 || reply.ns_count != 1 || reply.soa_min == 0))
+        problem = "not NODATA with an SOA";
+
+    if (problem)
+    {
+        fprintf(stderr, "%s: %s type %u: %s\n", seq->phone, query->name, query->type, problem);
+        failures++;
+    }
+}
+
+static uint64_t replay_in_process(const phone_sequence_t *seq, dns_host_t *host)
+{
+    uint64_t start_ns = dns_host_now_ns();
+    for (int i = 0; i < seq->num_queries; i++)
+    {
+        uint8_t packet[DNS_PACKET_MAX_LEN];
+        uint16_t id = (uint16_t)(0x100 + i);
+        size_t len = dns_host_make_query(packet, id, seq->queries[i].name, seq->queries[i].type, seq->edns_payload);
+        size_t reply_len = dns_host_answer(host, packet, len, sizeof(packet));
+        check_reply(seq, &seq->queries[i], id, packet, reply_len);
+    }
+    return (dns_host_now_ns() - start_ns) / 1000;
+}
+
+static uint64_t replay_over_udp(const phone_sequence_t *seq, uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = REPLY_TIMEOUT_MS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in server = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    uint64_t start_ns = dns_host_now_ns();
+    for (int i = 0; i < seq->num_queries; i++)
+    {
+        uint8_t packet[DNS_PACKET_MAX_LEN];
+        size_t len = dns_host_make_query(packet, (uint16_t)(0x200 + i), seq->queries[i].name, seq->queries[i].type,
+                                         seq->edns_payload);
+        sendto(sock, packet, len, 0, (struct sockaddr *)&server, sizeof(server));
+    }
+
+    // Replies come back in order here, match them by ID anyway as a resolver would
+    bool answered[16] = {false};
+    for (int i = 0; i < seq->num_queries; i++)
+    {
+        uint8_t packet[DNS_PACKET_MAX_LEN];
+        ssize_t len = recv(sock, packet, sizeof(packet), 0);
+        if (len < 2)
+            break;
+        int q = ((packet[0] << 8) | packet[1]) - 0x200;
+        if (q < 0 || q >= seq->num_queries || answered[q])
+            continue;
+        answered[q] = true;
+        check_reply(seq, &seq->queries[q], (uint16_t)(0x200 + q), packet, (size_t)len);
+    }
+    uint64_t elapsed_us = (dns_host_now_ns() - start_ns) / 1000;
+    close(sock);
+
+    for (int i = 0; i < seq->num_queries; i++)
+    {
+        if (!answered[i])
+            check_reply(seq, &seq->queries[i], (uint16_t)(0x200 + i), NULL, 0);
+    }
+    return elapsed_us;
+}
+
+typedef struct
+{
+    dns_host_t *host;
+    int sock;
+    volatile bool running;
+} server_thread_t;
+
+static void *serve(void *arg)
+{
+    server_thread_t *server = arg;
+    while (server->running && udp_stand_in_serve_one(server->host, server->sock))
+    {
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    // Phones join one after the other, so later ones find the probe hosts in the reply cache
+    dns_host_t host;
+    if (!dns_host_init_portal(&host, true))
+        return 1;
+
+    uint16_t port;
+    server_thread_t server = {.host = &host, .running = true};
+    server.sock = udp_stand_in_open(0, &port);
+    if (server.sock < 0)
+        return 1;
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 100 * 1000};
+    setsockopt(server.sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve, &server) != 0)
+        return 1;
+
+    printf("%-14s %8s %14s %14s\n", "phone", "queries", "in-process us", "loopback us");
+    for (size_t i = 0; i < sizeof(sequences) / sizeof(sequences[0]); i++)
+    {
+        // Against a cold cache first, as the first phone to join sees it
+        dns_host_t cold;
+        if (!dns_host_init_portal(&cold, true))
+            return 1;
+        uint64_t in_process_us = replay_in_process(&sequences[i], &cold);
+        dns_host_free(&cold);
+
+        uint64_t loopback_us = replay_over_udp(&sequences[i], port);
+        printf("%-14s %8d %14llu %14llu\n", sequences[i].phone, sequences[i].num_queries,
+               (unsigned long long)in_process_us, (unsigned long long)loopback_us);
+        if (loopback_us > MAX_TIME_TO_PORTAL_US)
+        {
+            fprintf(stderr, "%s: %llu us to portal over loopback\n", sequences[i].phone,
+                    (unsigned long long)loopback_us);
+            failures++;
+        }
+    }
+
+    server.running = false;
+    pthread_join(thread, NULL);
+    close(server.sock);
+    dns_host_free(&host);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d replies would make a phone wait for a resolver timeout\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "udp_stand_in.h"
+
+int udp_stand_in_open(uint16_t port, uint16_t *bound_port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(sock, (struct sockaddr *)&addr, &addr_len) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+
+    *bound_port = ntohs(addr.sin_port);
+    return sock;
+}
+
+bool udp_stand_in_serve_one(dns_host_t *host, int sock)
+{
+    uint8_t packet[DNS_PACKET_MAX_LEN];
+    struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+    socklen_t socklen = sizeof(source_addr);
+    ssize_t len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&source_addr, &socklen);
+    // A receive timeout set by the caller isn't a failure, it just lets the caller look at its own state
+    if (len < 0)
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+
+    size_t reply_len = dns_host_answer(host, packet, (size_t)len, sizeof(packet));
+    if (reply_len == 0)
+        return true;
+
+    return sendto(sock, packet, reply_len, 0, (struct sockaddr *)&source_addr, socklen) >= 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dns_host.h"
+
+/**
+ * @brief POSIX socket stand-in for the firmware's DNS socket, serving dns_host_answer on the loopback interface
+ *
+ * Mirrors serve_query in dns_server.c: one buffer of DNS_PACKET_MAX_LEN, the reply is built in place and sent back
+ * to the sender. Rate limiting, metrics and tracing are left out.
+ */
+
+/**
+ * @brief Bind a UDP socket on 127.0.0.1
+ * @param port Port to bind, 0 for any free one
+ * @param[out] bound_port Port actually bound
+ * @return The socket, or -1 on failure
+ */
+int udp_stand_in_open(uint16_t port, uint16_t *bound_port);
+
+/**
+ * @brief Receive one query and answer it
+ * @return false if the socket failed
+ */
+bool udp_stand_in_serve_one(dns_host_t *host, int sock);
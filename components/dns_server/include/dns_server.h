@@ -7,22 +7,13 @@
 #pragma once
 
 #include "esp_netif_ip_addr.h"
+#include "task_config.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-#ifndef DNS_SERVER_MAX_ITEMS
-#define DNS_SERVER_MAX_ITEMS 1
-#endif
-
-#define DNS_SERVER_CONFIG_SINGLE(queried_name, netif_key)       \
-    {                                                           \
-        .num_of_entries = 1,                                    \
-        .item = { {.name = queried_name, .if_key = netif_key} } \
-    }
-
     /**
      * @brief Definition of one DNS entry: NAME - IP (or the netif whose IP to answer)
      *
@@ -31,7 +22,7 @@ extern "C"
      */
     typedef struct dns_entry_pair
     {
-        const char *name;   /**<! Exact match of the name field of the DNS query to answer */
+        const char *name;   /**<! Name to answer: exact name, "*.suffix" for any subdomain of suffix, or "*" for everything */
         const char *if_key; /**<! Use this network interface IP to answer, only if NULL, use the static IP below */
         esp_ip4_addr_t ip;  /**<! Constant IP address to answer this query, if "if_key==NULL" */
     } dns_entry_pair_t;
@@ -39,25 +30,38 @@ extern "C"
     /**
      * @brief DNS server config struct defining the rules for answering DNS (A type) queries
      *
-     * @note If you want to define more rules, you can set `DNS_SERVER_MAX_ITEMS` before including this header
-     * Example of using 2 entries with constant IP addresses
+     * @note The most specific rule wins: an exact name, then the longest "*.suffix" wildcard, then the "*" catch-all.
+     * A rule whose interface has no IP yet is skipped in favour of the next most specific one.
+     * The rules are compiled into an index at `start_dns_server`, so the array may be of any size and need not
+     * outlive that call (the strings it points to still must).
+     * Example of answering the portal by netif IP and a backend by constant IP
      * \code{.c}
-     * #define DNS_SERVER_MAX_ITEMS 2
-     * #include "dns_server.h"
+     * static const dns_entry_pair_t rules[] = {
+     *   {.name = "*", .if_key = "WIFI_AP_DEF"},
+     *   {.name = "*.my-backend.com", .ip = { .addr = ESP_IP4TOADDR( 192, 168, 4, 100) } } };
      *
-     * dns_server_config_t config = {
-     *   .num_of_entries = 2,
-     *   .item = { {.name = "my-esp32.com", .ip = { .addr = ESP_IP4TOADDR( 192, 168, 4, 1) } } ,
-     *             {.name = "my-utils.com", .ip = { .addr = ESP_IP4TOADDR( 192, 168, 4, 100) } } } };
+     * dns_server_config_t config = { .num_of_entries = 2, .item = rules, .task = &dns_task };
      * start_dns_server(&config);
      * \endcode
      */
     typedef struct dns_server_config
     {
-        int num_of_entries;                          /**<! Number of rules specified in the config struct */
-        dns_entry_pair_t item[DNS_SERVER_MAX_ITEMS]; /**<! Array of pairs */
+        int num_of_entries;           /**<! Number of rules specified in the config struct */
+        const dns_entry_pair_t *item; /**<! Array of pairs */
+        const task_config_t *task;    /**<! Where the server task runs, NULL to serve from a reactor, see dns_server_socket() */
     } dns_server_config_t;
 
+    /**
+     * @brief DNS server counters, all cumulative since start
+     */
+    typedef struct dns_server_stats
+    {
+        uint32_t queries;      /**<! Packets received, including rate-limited ones */
+        uint32_t rate_limited; /**<! Packets dropped by the per-client rate limiter */
+        uint32_t cache_hits;   /**<! Queries answered from the reply cache */
+        uint32_t cache_misses; /**<! Queries that needed a full parse and rule lookup */
+    } dns_server_stats_t;
+
     /**
      * @brief DNS server handle
      */
@@ -72,6 +76,35 @@ extern "C"
      */
     dns_server_handle_t start_dns_server(dns_server_config_t *config);
 
+    /**
+     * @brief Re-read the IP of every netif-based rule
+     *
+     * @note IP events already trigger this, call it only after changing an interface's IP without an event
+     * (e.g. `esp_netif_set_ip_info` on the SoftAP)
+     * @param handle DNS server's handle
+     */
+    void dns_server_refresh(dns_server_handle_t handle);
+
+    /**
+     * @brief Socket of a server started without a task, for the caller's reactor to wait on
+     * @param handle DNS server's handle
+     * @return The bound UDP socket, -1 if the server has a task of its own or the socket couldn't be opened
+     */
+    int dns_server_socket(dns_server_handle_t handle);
+
+    /**
+     * @brief Answer one query on the socket of a server started without a task, call it when the socket is readable
+     * @param ctx DNS server's handle, void * so it fits net_reactor_udp_t
+     */
+    void dns_server_on_readable(void *ctx);
+
+    /**
+     * @brief Read the server's counters, the cache hit rate is cache_hits / (cache_hits + cache_misses)
+     * @param handle DNS server's handle
+     * @param stats Receives the counters
+     */
+    void dns_server_get_stats(dns_server_handle_t handle, dns_server_stats_t *stats);
+
     /**
      * @brief Stops and destroys DNS server's task and structs
      * @param handle DNS server's handle to destroy
@@ -0,0 +1,208 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "fastlog.h"
+
+_Static_assert((FASTLOG_RING_SIZE & (FASTLOG_RING_SIZE - 1)) == 0, "FASTLOG_RING_SIZE must be a power of two");
+_Static_assert(FASTLOG_TAG_MAX_PER_SEC < 0xFF, "Per-tag count is kept in 8 bits");
+
+static const char *TAG = "fastlog";
+
+typedef struct
+{
+    // Position this slot is ready for, stored minus the slot index so the zeroed ring starts out valid
+    atomic_uint_fast32_t seq;
+    uint32_t timestamp;
+    uint8_t level;
+    uint8_t nargs;
+    const char *tag;
+    const char *format;
+    uintptr_t args[FASTLOG_MAX_ARGS];
+} fastlog_slot_t;
+
+// Bounded multi-producer ring after Vyukov, the drain task is the only consumer
+static fastlog_slot_t ring[FASTLOG_RING_SIZE];
+static atomic_uint_fast32_t ring_head;
+static uint32_t ring_tail;
+
+// Per-tag window, the state packs the second the window started in the upper 24 bits and the count in the lower 8
+static _Atomic(const char *) tag_names[FASTLOG_MAX_TAGS];
+static atomic_uint_fast32_t tag_state[FASTLOG_MAX_TAGS];
+
+static atomic_uint_fast32_t written;
+static atomic_uint_fast32_t dropped_full;
+static atomic_uint_fast32_t rate_limited;
+
+static TaskHandle_t drain_task_handle = NULL;
+
+static bool tag_allowed(const char *tag, uint32_t now_ms)
+{
+    // Tags are literals, so comparing pointers is enough, a free slot is claimed with a CAS
+    atomic_uint_fast32_t *state = NULL;
+    for (int i = 0; i < FASTLOG_MAX_TAGS && state == NULL; i++)
+    {
+        const char *name = atomic_load_explicit(&tag_names[i], memory_order_acquire);
+        if (name == NULL)
+        {
+            const char *expected = NULL;
+            if (atomic_compare_exchange_strong(&tag_names[i], &expected, tag) || expected == tag)
+                state = &tag_state[i];
+        }
+        else if (name == tag)
+            state = &tag_state[i];
+    }
+    if (state == NULL)
+        return false;
+
+    uint32_t window = (now_ms / 1000) & 0xFFFFFF;
+    uint_fast32_t current = atomic_load_explicit(state, memory_order_relaxed);
+    uint_fast32_t next;
+    do
+    {
+        if ((current >> 8) != window)
+            next = (window << 8) | 1;
+        else if ((current & 0xFF) >= FASTLOG_TAG_MAX_PER_SEC)
+            return false;
+        else
+            next = current + 1;
+    } while (!atomic_compare_exchange_weak_explicit(state, &current, next, memory_order_relaxed, memory_order_relaxed));
+
+    return true;
+}
+
+bool fastlog_write(esp_log_level_t level, const char *tag, const char *format, int nargs, ...)
+{
+    uint32_t now_ms = esp_log_timestamp();
+
+    if (!tag_allowed(tag, now_ms))
+    {
+        atomic_fetch_add_explicit(&rate_limited, 1, memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    fastlog_slot_t *slot;
+    while (1)
+    {
+        uint32_t index = pos & (FASTLOG_RING_SIZE - 1);
+        slot = &ring[index];
+        uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire) + index;
+        int32_t diff = (int32_t)(seq - pos);
+
+        if (diff == 0)
+        {
+            uint_fast32_t expected = pos;
+            if (atomic_compare_exchange_weak_explicit(&ring_head, &expected, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+            pos = expected;
+        }
+        else if (diff < 0)
+        {
+            // The drain task has not freed this slot yet, the ring is full
+            atomic_fetch_add_explicit(&dropped_full, 1, memory_order_relaxed);
+            return false;
+        }
+        else
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    }
+
+    slot->timestamp = now_ms;
+    slot->level = level;
+    slot->tag = tag;
+    slot->format = format;
+    slot->nargs = nargs > FASTLOG_MAX_ARGS ? FASTLOG_MAX_ARGS : nargs;
+
+    va_list args;
+    va_start(args, nargs);
+    for (int i = 0; i < slot->nargs; i++)
+        slot->args[i] = va_arg(args, uintptr_t);
+    va_end(args);
+
+    atomic_store_explicit(&slot->seq, pos + 1 - (pos & (FASTLOG_RING_SIZE - 1)), memory_order_release);
+    atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+    return true;
+}
+
+static char level_letter(esp_log_level_t level)
+{
+    switch (level)
+    {
+    case ESP_LOG_ERROR:
+        return 'E';
+    case ESP_LOG_WARN:
+        return 'W';
+    case ESP_LOG_INFO:
+        return 'I';
+    case ESP_LOG_DEBUG:
+        return 'D';
+    default:
+        return 'V';
+    }
+}
+
+// Prints everything queued so far, returns false once the ring is empty
+static bool drain_one(void)
+{
+    uint32_t index = ring_tail & (FASTLOG_RING_SIZE - 1);
+    fastlog_slot_t *slot = &ring[index];
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire) + index;
+    if ((int32_t)(seq - (ring_tail + 1)) < 0)
+        return false;
+
+    // Unused arguments are passed too, printf ignores the surplus
+    char line[160];
+    const uintptr_t *a = slot->args;
+    snprintf(line, sizeof(line), slot->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+    esp_log_write((esp_log_level_t)slot->level, slot->tag, "%c (%" PRIu32 ") %s: %s\n",
+                  level_letter((esp_log_level_t)slot->level), slot->timestamp, slot->tag, line);
+
+    atomic_store_explicit(&slot->seq, ring_tail + FASTLOG_RING_SIZE - index, memory_order_release);
+    ring_tail++;
+    return true;
+}
+
+static void fastlog_drain_task(void *pvParameters)
+{
+    uint32_t reported_full = 0;
+    uint32_t reported_limited = 0;
+
+    while (1)
+    {
+        while (drain_one())
+            ;
+
+        // Losses are reported in aggregate, never per entry
+        fastlog_stats_t stats;
+        fastlog_get_stats(&stats);
+        if (stats.dropped_full != reported_full || stats.rate_limited != reported_limited)
+        {
+            ESP_LOGW(TAG, "Dropped %" PRIu32 " entries (ring full), %" PRIu32 " rate limited",
+                     stats.dropped_full - reported_full, stats.rate_limited - reported_limited);
+            reported_full = stats.dropped_full;
+            reported_limited = stats.rate_limited;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(FASTLOG_DRAIN_INTERVAL_MS));
+    }
+}
+
+void fastlog_init(const task_config_t *task)
+{
+    if (drain_task_handle != NULL)
+        return;
+
+    task_config_create(fastlog_drain_task, NULL, task, &drain_task_handle);
+}
+
+void fastlog_get_stats(fastlog_stats_t *stats)
+{
+    stats->written = atomic_load_explicit(&written, memory_order_relaxed);
+    stats->dropped_full = atomic_load_explicit(&dropped_full, memory_order_relaxed);
+    stats->rate_limited = atomic_load_explicit(&rate_limited, memory_order_relaxed);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+
+#include "task_config.h"
+
+// Entries buffered between the hot paths and the drain task, must be a power of two
+#define FASTLOG_RING_SIZE 64
+// Arguments stored per entry, each one 32 bits wide
+#define FASTLOG_MAX_ARGS 6
+// Entries a single tag may log per second, the rest is counted and dropped
+#define FASTLOG_TAG_MAX_PER_SEC 20
+// Tags tracked for rate limiting, entries from any further tag are dropped
+#define FASTLOG_MAX_TAGS 16
+// How often the drain task empties the ring
+#define FASTLOG_DRAIN_INTERVAL_MS 50
+
+/*
+    Deferred logging for hot paths: the call only copies the format string pointer and up to
+    FASTLOG_MAX_ARGS 32-bit arguments into a lock-free ring, formatting and UART output happen later
+    in a low-priority task. It never blocks and is safe from any task.
+
+    The tag, format string and any %s argument must be string literals or otherwise outlive the entry,
+    only their pointers are stored. 64-bit and floating point arguments are not supported.
+*/
+#define FASTLOG_E(tag, format, ...) FASTLOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define FASTLOG_W(tag, format, ...) FASTLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define FASTLOG_I(tag, format, ...) FASTLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define FASTLOG_D(tag, format, ...) FASTLOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+#define FASTLOG_LEVEL(level, tag, format, ...)                                                             \
+    do                                                                                                     \
+    {                                                                                                      \
+        if ((level) <= LOG_LOCAL_LEVEL)                                                                    \
+            fastlog_write((level), (tag), (format), FASTLOG_NARGS(__VA_ARGS__) FASTLOG_ARGS(__VA_ARGS__)); \
+    } while (0)
+
+#define FASTLOG_NARGS(...) FASTLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define FASTLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+
+// Every argument goes through the varargs as uintptr_t, which is what fastlog_write() reads back
+#define FASTLOG_ARGS(...) FASTLOG_ARGS_N(FASTLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define FASTLOG_ARGS_N(n, ...) FASTLOG_ARGS_N_(n, ##__VA_ARGS__)
+#define FASTLOG_ARGS_N_(n, ...) FASTLOG_ARGS_##n(__VA_ARGS__)
+#define FASTLOG_ARGS_0()
+#define FASTLOG_ARGS_1(a) , (uintptr_t)(a)
+#define FASTLOG_ARGS_2(a, b) FASTLOG_ARGS_1(a), (uintptr_t)(b)
+#define FASTLOG_ARGS_3(a, b, c) FASTLOG_ARGS_2(a, b), (uintptr_t)(c)
+#define FASTLOG_ARGS_4(a, b, c, d) FASTLOG_ARGS_3(a, b, c), (uintptr_t)(d)
+#define FASTLOG_ARGS_5(a, b, c, d, e) FASTLOG_ARGS_4(a, b, c, d), (uintptr_t)(e)
+#define FASTLOG_ARGS_6(a, b, c, d, e, f) FASTLOG_ARGS_5(a, b, c, d, e), (uintptr_t)(f)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Counters of the deferred log
+     */
+    typedef struct fastlog_stats
+    {
+        uint32_t written;      /**<! Entries queued */
+        uint32_t dropped_full; /**<! Entries lost because the ring was full */
+        uint32_t rate_limited; /**<! Entries lost to the per-tag limit */
+    } fastlog_stats_t;
+
+    /**
+     * @brief Start the drain task, entries logged before this are kept and printed once it runs
+     * @param task Where the drain task runs, normally the lowest priority above idle
+     */
+    void fastlog_init(const task_config_t *task);
+
+    /**
+     * @brief Queue one entry, use the FASTLOG_x macros instead of calling this directly
+     * @return false if the entry was dropped
+     */
+    bool fastlog_write(esp_log_level_t level, const char *tag, const char *format, int nargs, ...);
+
+    /**
+     * @brief Copy the counters
+     */
+    void fastlog_get_stats(fastlog_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,12 +1,40 @@
-#include <stdexcept>
 #include <cstring>
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
 
 #include "mbedtls/md.h"
 
 #include "hmac_token_generator.h"
+#include "power.h"
 
 // Constructor with secret key and HMAC function
-HMACTokenGenerator::HMACTokenGenerator(const std::string &key) : secret_key(key) {}
+HMACTokenGenerator::HMACTokenGenerator(const std::string &key) : secret_key(key)
+{
+    // Setting up the context allocates, so it is done once here rather than per token
+    mbedtls_md_init(&hmac_ctx);
+    mbedtls_md_setup(&hmac_ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&hmac_ctx, reinterpret_cast<const unsigned char *>(secret_key.c_str()), secret_key.length());
+    hmac_lock = xSemaphoreCreateMutexStatic(&hmac_lock_buffer);
+}
+
+HMACTokenGenerator::~HMACTokenGenerator()
+{
+    mbedtls_md_free(&hmac_ctx);
+}
+
+// Lowercase hex of len bytes, out needs room for 2 * len characters and the terminator. Returns the terminator.
+static char *hex_encode(const unsigned char *hash, size_t len, char *out)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; ++i)
+    {
+        *out++ = hex_digits[hash[i] >> 4];
+        *out++ = hex_digits[hash[i] & 0x0F];
+    }
+    *out = '\0';
+    return out;
+}
 
 // HMAC-SHA256 function using mbedTLS (for ESP-IDF)
 std::string HMACTokenGenerator::mbedTLS_HMAC_SHA256(const std::string &secret_key, const std::string &data)
@@ -21,13 +49,12 @@ std::string HMACTokenGenerator::mbedTLS_HMAC_SHA256(const std::string &secret_ke
                               data.length(),
                               hash);
 
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    for (int i = 0; i < 32; ++i)
-    {
-        ss << std::setw(2) << static_cast<int>(hash[i]);
-    }
-    return ss.str();
+    if (ret != 0)
+        return std::string();
+
+    char hex[2 * sizeof(hash) + 1];
+    hex_encode(hash, sizeof(hash), hex);
+    return hex;
 }
 
 // Utility function to get current timestamp
@@ -39,16 +66,38 @@ uint64_t HMACTokenGenerator::getCurrentTimestamp()
 // Generate a single token for the current exact timestamp
 std::string HMACTokenGenerator::generateToken(const int accessMethod)
 {
-    uint64_t currentTimestamp = getCurrentTimestamp();
+    char token[HMAC_TOKEN_MAX_LEN];
+    generateToken(token, sizeof(token), accessMethod);
+    return token;
+}
+
+// Same token, built in place: "ts=<timestamp>&am=<method>&hmac=<hex HMAC of everything before &hmac>"
+size_t HMACTokenGenerator::generateToken(char *buffer, size_t size, const int accessMethod)
+{
+    static const char hmac_label[] = "&hmac=";
+    const size_t hmac_hex_len = 64;
 
-    // Create token data with exact timestamp
-    std::stringstream ss;
-    ss << "ts=" << currentTimestamp << "&am=" << accessMethod;
+    int data_len = snprintf(buffer, size, "ts=%" PRIu64 "&am=%d", getCurrentTimestamp(), accessMethod);
+    if (data_len < 0 || (size_t)data_len + sizeof(hmac_label) - 1 + hmac_hex_len >= size)
+    {
+        if (size > 0)
+            buffer[0] = '\0';
+        return 0;
+    }
+
+    unsigned char hash[32]; // SHA256 produces 32 bytes
+    xSemaphoreTake(hmac_lock, portMAX_DELAY);
+    power_hold(POWER_LOCK_HMAC);
+    mbedtls_md_hmac_reset(&hmac_ctx);
+    mbedtls_md_hmac_update(&hmac_ctx, reinterpret_cast<const unsigned char *>(buffer), data_len);
+    mbedtls_md_hmac_finish(&hmac_ctx, hash);
+    power_release(POWER_LOCK_HMAC);
+    xSemaphoreGive(hmac_lock);
 
-    // Generate HMAC for the token data
-    std::string hmac = mbedTLS_HMAC_SHA256(secret_key, ss.str());
+    char *out = buffer + data_len;
+    memcpy(out, hmac_label, sizeof(hmac_label) - 1);
+    out += sizeof(hmac_label) - 1;
+    out = hex_encode(hash, sizeof(hash), out);
 
-    // Combine token data and HMAC
-    ss << "&hmac=" << hmac;
-    return ss.str();
+    return out - buffer;
 }
\ No newline at end of file
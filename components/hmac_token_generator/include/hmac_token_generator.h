@@ -1,23 +1,36 @@
 #pragma once
 
 #include <string>
-#include <vector>
-#include <ctime>
-#include <sstream>
-#include <iomanip>
-#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+#include "mbedtls/md.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Longest token generateToken() can produce, terminator included: "ts=<20 digits>&am=<11>&hmac=<64 hex>"
+#define HMAC_TOKEN_MAX_LEN 128
 
 class HMACTokenGenerator
 {
 private:
     std::string secret_key;
 
+    // Keyed once in the constructor and reset per token, shared by the portal and NFC tasks
+    mbedtls_md_context_t hmac_ctx;
+    StaticSemaphore_t hmac_lock_buffer;
+    SemaphoreHandle_t hmac_lock;
+
 public:
     /**
      * Constructor - Initialize with secret key and HMAC function
      * @param key Secret key for HMAC generation (keep secure!)
      */
     explicit HMACTokenGenerator(const std::string &key);
+    ~HMACTokenGenerator();
+
+    HMACTokenGenerator(const HMACTokenGenerator &) = delete;
+    HMACTokenGenerator &operator=(const HMACTokenGenerator &) = delete;
 
     /**
      * HMAC-SHA256 function using mbedTLS
@@ -39,4 +52,13 @@ public:
      * @return Single token for current exact timestamp
      */
     std::string generateToken(const int accessMethod = 0);
-};
\ No newline at end of file
+
+    /**
+     * Generate a single token for the current exact timestamp into a caller buffer, without touching the heap
+     * @param buffer Receives the NUL-terminated token, HMAC_TOKEN_MAX_LEN always fits
+     * @param size Size of the buffer
+     * @param accessMethod Method of access (e.g., NFC, Web Access")
+     * @return Length of the token, 0 if it did not fit
+     */
+    size_t generateToken(char *buffer, size_t size, const int accessMethod = 0);
+};
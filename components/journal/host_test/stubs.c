@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "esp_err.h"
+#include "esp_rom_crc.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "system_ready.h"
+#include "metrics.h"
+#include "task_config.h"
+
+#include "stubs.h"
+
+const char *esp_err_to_name(esp_err_t err)
+{
+    return err == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+// Any CRC-8 does for the tests, the records are only ever checked by the code that wrote them
+uint8_t esp_rom_crc8_le(uint8_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xE0 : crc >> 1;
+    }
+    return ~crc;
+}
+
+/* Flash: NOR semantics, writes can only clear bits and erases set whole sectors back to 0xFF */
+
+uint8_t stub_flash[STUB_FLASH_SIZE];
+long stub_flash_budget = -1;
+bool stub_partition_missing = false;
+static const esp_partition_t journal_partition = {.size = STUB_FLASH_SIZE, .label = "journal"};
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    return !stub_partition_missing && strcmp(label, journal_partition.label) == 0 ? &journal_partition : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, stub_flash + offset, size);
+    return ESP_OK;
+}
+
+// Spends the budget byte by byte, the byte that exhausts it and everything after is lost, as in a power cut
+static bool flash_power(void)
+{
+    if (stub_flash_budget == 0)
+        return false;
+    if (stub_flash_budget > 0)
+        stub_flash_budget--;
+    return true;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (!flash_power())
+            return ESP_ERR_FLASH_OP_FAIL;
+        stub_flash[offset + i] &= ((const uint8_t *)src)[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset + size > partition->size || offset % STUB_SECTOR_SIZE || size % STUB_SECTOR_SIZE)
+        return ESP_ERR_INVALID_ARG;
+    if (!flash_power())
+        return ESP_ERR_FLASH_OP_FAIL;
+    memset(stub_flash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+/* NVS: the one key the journal keeps */
+
+bool stub_nvs_has_uploaded = false;
+uint32_t stub_nvs_uploaded;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    if (!stub_nvs_has_uploaded)
+        return ESP_ERR_NOT_FOUND;
+    *out_value = stub_nvs_uploaded;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    stub_nvs_has_uploaded = true;
+    stub_nvs_uploaded = value;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+/* HTTP client: one keep-alive connection per client, to the host of the URL on stub_http_port */
+
+uint16_t stub_http_port;
+int stub_http_connections;
+
+struct esp_http_client
+{
+    int sock;
+    char host[64];
+    char path[64];
+    char headers[256];
+    const char *body;
+    int body_len;
+    int status;
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    struct esp_http_client *client = calloc(1, sizeof(*client));
+    client->sock = -1;
+    if (sscanf(config->url, "http://%63[^:/]%*[^/]%63s", client->host, client->path) != 2)
+    {
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    size_t used = strlen(client->headers);
+    snprintf(client->headers + used, sizeof(client->headers) - used, "%s: %s\r\n", key, value);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+    client->body = data;
+    client->body_len = len;
+    return ESP_OK;
+}
+
+static bool http_connect(esp_http_client_handle_t client)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(stub_http_port)};
+    struct hostent *host = gethostbyname(client->host);
+    if (host == NULL)
+        return false;
+    memcpy(&addr.sin_addr, host->h_addr_list[0], sizeof(addr.sin_addr));
+
+    client->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(client->sock);
+        client->sock = -1;
+        return false;
+    }
+    int one = 1;
+    setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    stub_http_connections++;
+    return true;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    client->status = 0;
+    if (client->sock < 0 && !http_connect(client))
+        return ESP_FAIL;
+
+    char head[512];
+    int head_len = snprintf(head, sizeof(head), "POST %s HTTP/1.1\r\nHost: %s\r\n%sContent-Length: %d\r\n\r\n",
+                            client->path, client->host, client->headers, client->body_len);
+    if (send(client->sock, head, head_len, 0) != head_len ||
+        send(client->sock, client->body, client->body_len, 0) != client->body_len)
+        return ESP_FAIL;
+
+    // The sink answers with an empty body, the response ends with its headers
+    char response[1024];
+    int len = 0;
+    while (len < (int)sizeof(response) - 1)
+    {
+        int got = recv(client->sock, response + len, sizeof(response) - 1 - len, 0);
+        if (got <= 0)
+            return ESP_FAIL;
+        len += got;
+        response[len] = '\0';
+        if (strstr(response, "\r\n\r\n"))
+            break;
+    }
+    return sscanf(response, "HTTP/1.%*d %d", &client->status) == 1 ? ESP_OK : ESP_FAIL;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    if (client->sock >= 0)
+        close(client->sock);
+    free(client);
+    return ESP_OK;
+}
+
+/* FreeRTOS, readiness, metrics and tasks: the journal task is never started, the test calls its steps */
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout)
+{
+    return 0;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return 0;
+}
+
+EventBits_t stub_ready_bits = SYSTEM_READY_STA_GOT_IP;
+
+bool system_ready_is_set(EventBits_t bits)
+{
+    return (stub_ready_bits & bits) == bits;
+}
+
+BaseType_t task_config_create(TaskFunction_t function, void *arg, const task_config_t *config, TaskHandle_t *handle)
+{
+    return pdPASS;
+}
+
+struct metric
+{
+    const char *name;
+    int64_t value;
+};
+
+static struct metric metrics[METRICS_MAX];
+
+static metric_t *metrics_register(const char *name)
+{
+    for (int i = 0; i < METRICS_MAX; i++)
+    {
+        if (metrics[i].name == NULL || strcmp(metrics[i].name, name) == 0)
+        {
+            metrics[i].name = name;
+            return &metrics[i];
+        }
+    }
+    return NULL;
+}
+
+metric_t *metrics_counter(const char *name, const char *help)
+{
+    return metrics_register(name);
+}
+
+metric_t *metrics_gauge(const char *name, const char *help)
+{
+    return metrics_register(name);
+}
+
+void metrics_inc(metric_t *metric)
+{
+    metric->value++;
+}
+
+void metrics_add(metric_t *metric, uint32_t amount)
+{
+    metric->value += amount;
+}
+
+void metrics_set(metric_t *metric, int32_t value)
+{
+    metric->value = value;
+}
+
+int64_t stub_metric(const char *name)
+{
+    for (int i = 0; i < METRICS_MAX && metrics[i].name; i++)
+    {
+        if (strcmp(metrics[i].name, name) == 0)
+            return metrics[i].value;
+    }
+    return 0;
+}
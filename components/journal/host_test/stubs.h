@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/event_groups.h"
+
+#define STUB_SECTOR_SIZE 4096
+#define STUB_SECTORS 3
+#define STUB_FLASH_SIZE (STUB_SECTORS * STUB_SECTOR_SIZE)
+
+// Contents of the journal partition
+extern uint8_t stub_flash[STUB_FLASH_SIZE];
+// Bytes that can still be written (an erase counts as one) before the power is cut, -1 for no limit
+extern long stub_flash_budget;
+// The partition table has no journal partition
+extern bool stub_partition_missing;
+
+// The upload position in NVS
+extern bool stub_nvs_has_uploaded;
+extern uint32_t stub_nvs_uploaded;
+
+// Port the HTTP client connects to instead of the one in the URL, and connections it opened
+extern uint16_t stub_http_port;
+extern int stub_http_connections;
+
+extern EventBits_t stub_ready_bits;
+
+// Value of a registered metric, 0 if it isn't registered
+int64_t stub_metric(const char *name);
@@ -0,0 +1,15 @@
+#pragma once
+
+// Host stand-in for the parts of ESP-IDF journal.c uses
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_FLASH_OP_FAIL 0x6001
+
+const char *esp_err_to_name(esp_err_t err);
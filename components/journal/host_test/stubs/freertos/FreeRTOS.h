@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef struct
+{
+    int unused;
+} StaticTask_t;
+typedef struct
+{
+    int unused;
+} portMUX_TYPE;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// Single threaded on the host, nothing to lock against
+#define taskENTER_CRITICAL(mux) ((void)(mux))
+#define taskEXIT_CRITICAL(mux) ((void)(mux))
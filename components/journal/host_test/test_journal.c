@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "stubs.h"
+
+// The code under test, static functions included
+#include "journal.c"
+
+/*
+    Drives journal_mount(), journal_flush() and journal_upload() against an in-memory flash partition and
+    tools/journal_sink.py, the collector stand-in, whose CSV output is compared with what was recorded:
+     - batch encoding: every field survives the round trip, over one connection for all batches
+     - mount after a power cut tearing a record and then a sector header
+     - wraparound: the oldest sector is recycled, the records the collector missed are counted as lost
+     - a sector that can't be started keeps the records staged until it can
+     - without a partition records are refused up front and counted apart from a full staging buffer
+*/
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                        \
+    do                                                          \
+    {                                                           \
+        if (!(cond))                                            \
+        {                                                       \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            failures++;                                         \
+        }                                                       \
+    } while (0)
+
+/* Collector stand-in */
+
+typedef struct
+{
+    uint32_t index;
+    bool torn;
+    char method[16];
+    char mac[16];
+    uint32_t latency_ms;
+    time_t timestamp;
+} sink_row_t;
+
+#define MAX_ROWS 2048
+
+static pid_t sink_pid;
+static char sink_output[] = "/tmp/journal_sink_XXXXXX";
+
+static uint16_t free_port(void)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(sock, (struct sockaddr *)&addr, &len);
+    close(sock);
+    return ntohs(addr.sin_port);
+}
+
+static void sink_start(void)
+{
+    int out = mkstemp(sink_output);
+    stub_http_port = free_port();
+    stub_http_connections = 0;
+
+    sink_pid = fork();
+    if (sink_pid == 0)
+    {
+        char port[8];
+        snprintf(port, sizeof(port), "%u", stub_http_port);
+        dup2(out, STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO);
+        execlp("python3", "python3", JOURNAL_SINK_PY, "--port", port, (char *)NULL);
+        _exit(127);
+    }
+    close(out);
+
+    // Up once it accepts connections
+    for (int i = 0; i < 100; i++)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(stub_http_port),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        int ok = connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(sock);
+        if (ok)
+            return;
+        usleep(50 * 1000);
+    }
+    fprintf(stderr, "journal_sink.py did not come up\n");
+    exit(1);
+}
+
+// Stop the sink and read back what it printed
+static int sink_stop(sink_row_t *rows)
+{
+    kill(sink_pid, SIGTERM);
+    waitpid(sink_pid, NULL, 0);
+
+    FILE *f = fopen(sink_output, "r");
+    char line[256];
+    int count = 0;
+    while (f && fgets(line, sizeof(line), f) && count < MAX_ROWS)
+    {
+        char device[32], when[40], method[16], mac[16];
+        sink_row_t *row = &rows[count];
+        memset(row, 0, sizeof(*row));
+        if (sscanf(line, "%31[^,],%u,,,torn,", device, &row->index) == 2 && strstr(line, ",torn,"))
+        {
+            row->torn = true;
+            count++;
+        }
+        else if (sscanf(line, "%31[^,],%u,%39[^,],%15[^,],%15[^,],%u", device, &row->index, when, method, mac,
+                        &row->latency_ms) == 6)
+        {
+            struct tm tm = {0};
+            strptime(when, "%Y-%m-%dT%H:%M:%S", &tm);
+            row->timestamp = timegm(&tm);
+            snprintf(row->method, sizeof(row->method), "%s", method);
+            snprintf(row->mac, sizeof(row->mac), "%s", mac);
+            count++;
+        }
+    }
+    if (f)
+        fclose(f);
+    unlink(sink_output);
+    strcpy(sink_output, "/tmp/journal_sink_XXXXXX");
+    return count;
+}
+
+/* Device */
+
+static void wipe(void)
+{
+    memset(stub_flash, 0xFF, sizeof(stub_flash));
+    stub_flash_budget = -1;
+    stub_nvs_has_uploaded = false;
+}
+
+// What survives a reset is the flash and NVS, RAM starts over
+static void reboot(void)
+{
+    staging_head = staging_tail = 0;
+    head_seq = head_slot = tail_seq = uploaded = 0;
+    partition = NULL;
+    unavailable = false;
+    journal_init(NULL);
+    if (partition == NULL)
+    {
+        fprintf(stderr, "FAIL: journal not mounted\n");
+        exit(1);
+    }
+}
+
+// Token of record n, its HMAC prefix is n spelled in hex
+static void record(uint32_t n, uint32_t latency_ms)
+{
+    char token[64];
+    snprintf(token, sizeof(token), "t=1700000000&m=%u&hmac=%08x0011223344", n % 2, n);
+    CHECK(journal_record_token(n % 2, token, latency_ms), "record %u not staged", n);
+    if (staging_head - staging_tail == JOURNAL_STAGING_SIZE)
+        journal_flush();
+}
+
+static void record_range(uint32_t first, uint32_t end)
+{
+    for (uint32_t n = first; n < end; n++)
+        record(n, n % 1000);
+    journal_flush();
+}
+
+// Rows must be the records first..end in order, torn ones aside each with the fields record() gave it
+static void check_rows(const sink_row_t *rows, int count, uint32_t first, uint32_t end)
+{
+    CHECK(count == (int)(end - first), "%d rows, expected %u", count, end - first);
+    for (int i = 0; i < count && i < (int)(end - first); i++)
+    {
+        const sink_row_t *row = &rows[i];
+        uint32_t n = first + i;
+        char mac[16];
+        snprintf(mac, sizeof(mac), "%08x", n);
+        CHECK(row->index == first + i, "row %d has index %u", i, row->index);
+        if (row->torn)
+            continue;
+        CHECK(strcmp(row->method, n % 2 ? "nfc" : "portal") == 0, "record %u method %s", n, row->method);
+        CHECK(strcmp(row->mac, mac) == 0, "record %u HMAC prefix %s", n, row->mac);
+        CHECK(row->latency_ms == n % 1000, "record %u latency %u", n, row->latency_ms);
+        CHECK(labs((long)(row->timestamp - time(NULL))) < 60, "record %u timestamp off", n);
+    }
+}
+
+static void test_batch_encoding(void)
+{
+    static sink_row_t rows[MAX_ROWS];
+    wipe();
+    reboot();
+
+    // More than two batches, and latencies at the edges of the varint and uint16 ranges
+    record_range(0, 150);
+    CHECK(journal_record_token(1, "no hmac here", 70000), "not staged");
+    CHECK(journal_record_token(0, NULL, 127), "not staged");
+    journal_flush();
+
+    sink_start();
+    CHECK(journal_upload(), "upload failed");
+    int count = sink_stop(rows);
+
+    check_rows(rows, count < 150 ? count : 150, 0, 150);
+    CHECK(count == 152, "%d rows, expected 152", count);
+    CHECK(rows[150].latency_ms == UINT16_MAX && strcmp(rows[150].mac, "00000000") == 0, "clamped record wrong");
+    CHECK(rows[151].latency_ms == 127 && strcmp(rows[151].method, "portal") == 0, "token-less record wrong");
+    CHECK(stub_http_connections == 1, "%d connections for one upload", stub_http_connections);
+    CHECK(uploaded == 152 && stub_nvs_uploaded == 152, "upload position %u, saved %u", uploaded, stub_nvs_uploaded);
+}
+
+static void test_mount_after_torn_writes(void)
+{
+    static sink_row_t rows[MAX_ROWS];
+    wipe();
+    reboot();
+
+    // Power cut 5 bytes into a record: the slot is taken but its CRC fails, the collector gets it as torn
+    record_range(0, 10);
+    stub_flash_budget = 5;
+    record_range(10, 11);
+    stub_flash_budget = -1;
+    reboot();
+    CHECK(write_index() == 11, "mounted at %u after a torn record, expected 11", write_index());
+    record_range(11, 16);
+
+    sink_start();
+    CHECK(journal_upload(), "upload failed");
+    int count = sink_stop(rows);
+    check_rows(rows, count, 0, 16);
+    CHECK(count > 10 && rows[10].torn, "record 10 not reported torn");
+    for (int i = 0; i < count; i++)
+        CHECK(rows[i].torn == (i == 10), "record %d torn", i);
+
+    // Power cut while the next sector is started: erased, header half written. Mount must fall back to the
+    // full sector before it and start the next one again, losing nothing
+    record_range(16, RECORDS_PER_SECTOR);
+    CHECK(head_slot == RECORDS_PER_SECTOR, "sector 0 not full");
+    stub_flash_budget = 1 + sizeof(sector_header_t) / 2;
+    record_range(RECORDS_PER_SECTOR, RECORDS_PER_SECTOR + 1);
+    stub_flash_budget = -1;
+    reboot();
+    CHECK(head_seq == 0 && head_slot == RECORDS_PER_SECTOR, "mounted at sector %u slot %u after a torn header",
+          head_seq, head_slot);
+    CHECK(uploaded == 16, "upload position %u after reboot, expected 16", uploaded);
+
+    record_range(RECORDS_PER_SECTOR, RECORDS_PER_SECTOR + 20);
+    CHECK(head_seq == 1 && head_slot == 20, "appending at sector %u slot %u", head_seq, head_slot);
+
+    sink_start();
+    CHECK(journal_upload(), "upload failed");
+    count = sink_stop(rows);
+    check_rows(rows, count, 16, RECORDS_PER_SECTOR + 20);
+    CHECK(stub_metric("journal_lost_total") == 0, "records lost");
+}
+
+static void test_wraparound(void)
+{
+    static sink_row_t rows[MAX_ROWS];
+    wipe();
+    reboot();
+    int64_t lost_before = stub_metric("journal_lost_total");
+
+    // 100 uploaded, then the partition wraps with the uplink down: sector 0 is recycled with the 240 records in
+    // it the collector never got
+    record_range(0, 100);
+    sink_start();
+    CHECK(journal_upload(), "upload failed");
+    sink_stop(rows);
+
+    // The power goes halfway through the header of sector 0 as it is recycled: it must not be taken for the newest
+    const uint32_t total = STUB_SECTORS * RECORDS_PER_SECTOR + 100;
+    record_range(100, STUB_SECTORS * RECORDS_PER_SECTOR);
+    stub_flash_budget = 1 + sizeof(uint32_t);
+    record_range(STUB_SECTORS * RECORDS_PER_SECTOR, STUB_SECTORS * RECORDS_PER_SECTOR + 1);
+    stub_flash_budget = -1;
+    reboot();
+    CHECK(tail_seq == 1 && head_seq == STUB_SECTORS - 1 && head_slot == RECORDS_PER_SECTOR,
+          "mounted tail %u head %u slot %u after a torn recycle", tail_seq, head_seq, head_slot);
+
+    record_range(STUB_SECTORS * RECORDS_PER_SECTOR, total);
+    CHECK(stub_metric("journal_lost_total") - lost_before == RECORDS_PER_SECTOR - 100, "%lld lost, expected %u",
+          (long long)(stub_metric("journal_lost_total") - lost_before), RECORDS_PER_SECTOR - 100);
+    CHECK(tail_seq == 1 && head_seq == STUB_SECTORS, "tail %u head %u after wrapping", tail_seq, head_seq);
+
+    // The saved position now points into the recycled sector, mount must move it to the oldest record left
+    reboot();
+    CHECK(tail_seq == 1 && head_seq == STUB_SECTORS && write_index() == total, "mounted tail %u head %u at %u",
+          tail_seq, head_seq, write_index());
+    CHECK(uploaded == RECORDS_PER_SECTOR, "upload position %u, expected %u", uploaded, RECORDS_PER_SECTOR);
+
+    sink_start();
+    CHECK(journal_upload(), "upload failed");
+    int count = sink_stop(rows);
+    check_rows(rows, count, RECORDS_PER_SECTOR, total);
+    CHECK(uploaded == total, "upload position %u, expected %u", uploaded, total);
+}
+
+static void test_failed_sector_start(void)
+{
+    static sink_row_t rows[MAX_ROWS];
+    wipe();
+    reboot();
+
+    // The erase of the next sector fails: the records must wait in the staging buffer, not be dropped
+    record_range(0, RECORDS_PER_SECTOR);
+    stub_flash_budget = 0;
+    record_range(RECORDS_PER_SECTOR, RECORDS_PER_SECTOR + 10);
+    CHECK(staging_head - staging_tail == 10, "%u records staged after a failed sector start, expected 10",
+          staging_head - staging_tail);
+    CHECK(write_index() == RECORDS_PER_SECTOR, "write index %u, expected %u", write_index(), RECORDS_PER_SECTOR);
+
+    stub_flash_budget = -1;
+    journal_flush();
+    CHECK(staging_head == staging_tail, "%u records still staged", staging_head - staging_tail);
+    CHECK(head_seq == 1 && head_slot == 10, "appending at sector %u slot %u", head_seq, head_slot);
+
+    sink_start();
+    CHECK(journal_upload(), "upload failed");
+    int count = sink_stop(rows);
+    check_rows(rows, count, 0, RECORDS_PER_SECTOR + 10);
+    CHECK(stub_metric("journal_dropped_total") == 0, "records dropped");
+}
+
+static void test_no_partition(void)
+{
+    wipe();
+    staging_head = staging_tail = 0;
+    partition = NULL;
+    stub_partition_missing = true;
+    journal_init(NULL);
+    stub_partition_missing = false;
+    CHECK(partition == NULL, "mounted without a partition");
+
+    int64_t dropped_before = stub_metric("journal_dropped_total");
+    int64_t refused_before = stub_metric("journal_unavailable_total");
+    for (int i = 0; i < JOURNAL_STAGING_SIZE + 1; i++)
+        CHECK(!journal_record_token(0, NULL, 1), "record %d staged without a partition", i);
+    CHECK(staging_head == staging_tail, "%u records staged without a partition", staging_head - staging_tail);
+    CHECK(stub_metric("journal_unavailable_total") - refused_before == JOURNAL_STAGING_SIZE + 1, "%lld refused",
+          (long long)(stub_metric("journal_unavailable_total") - refused_before));
+    CHECK(stub_metric("journal_dropped_total") == dropped_before, "refused records counted as dropped");
+}
+
+int main(void)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    test_batch_encoding();
+    test_mount_after_torn_writes();
+    test_wraparound();
+    test_failed_sector_start();
+    test_no_partition();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("journal: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "task_config.h"
+
+// Data partition the journal lives in, see partitions.csv
+#define JOURNAL_PARTITION_LABEL "journal"
+// Records held in RAM until the journal task writes them to flash, must be a power of two
+#define JOURNAL_STAGING_SIZE 32
+// How often staged records are written out and the uplink is checked for an upload
+#define JOURNAL_FLUSH_INTERVAL_MS 10000
+// Collector the records are posted to while the STA is connected, tools/journal_sink.py on the host for the simulation
+#if CONFIG_IDF_TARGET_LINUX
+#define JOURNAL_UPLOAD_URL "http://127.0.0.1:8080/journal"
+#else
+#define JOURNAL_UPLOAD_URL "http://192.168.1.10:8080/journal"
+#endif
+// Records per request, all requests of one upload share a connection
+#define JOURNAL_UPLOAD_BATCH 64
+#define JOURNAL_UPLOAD_TIMEOUT_MS 5000
+
+/*
+    Attendance journal: every token handed out, on the tag or the portal page, leaves a 12-byte record
+    (wall time, access method, first 4 bytes of the token's HMAC, latency) in a dedicated flash partition.
+    Records are appended sector by sector around the partition, so every sector is erased equally often,
+    and the oldest sector is recycled once the partition is full.
+
+    journal_record_token() only copies the record into a RAM staging buffer, flash is written by the
+    journal task, which also uploads what the collector has not acknowledged yet whenever the STA has
+    an address. The upload position survives reboots in NVS.
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Find the journal partition and start the journal task
+     * @param task Where the journal task runs, it writes flash and talks HTTP, so in the background tier
+     */
+    void journal_init(const task_config_t *task);
+
+    /**
+     * @brief Stage a record for a token that was handed out, never blocks and never touches flash
+     * @param access_method Access method the token was generated with (0 portal, 1 NFC)
+     * @param token Token as returned by HMACTokenGenerator::generateToken()
+     * @param latency_ms Time to hand it out, tap to tag written or request to page sent
+     * @return false if the staging buffer was full or there is no usable journal partition, and the record was dropped
+     */
+    bool journal_record_token(uint8_t access_method, const char *token, uint32_t latency_ms);
+
+#ifdef __cplusplus
+}
+#endif
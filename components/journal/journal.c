@@ -0,0 +1,497 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_mac.h"
+#endif
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "journal.h"
+#include "system_ready.h"
+#include "metrics.h"
+
+_Static_assert((JOURNAL_STAGING_SIZE & (JOURNAL_STAGING_SIZE - 1)) == 0, "JOURNAL_STAGING_SIZE must be a power of two");
+
+static const char *TAG = "Journal";
+
+#define JOURNAL_MAGIC 0x4C4E524A // "JRNL"
+#define JOURNAL_SECTOR_SIZE 4096 // Erase unit of the flash
+#define JOURNAL_UPLOAD_RETRY_MS 60000
+#define NVS_NAMESPACE "journal"
+#define NVS_KEY_UPLOADED "uploaded"
+
+typedef struct __attribute__((packed))
+{
+    uint32_t timestamp;   // Unix seconds
+    uint8_t token_mac[4]; // First bytes of the token's HMAC, ties the record to the link the phone got
+    uint16_t latency_ms;
+    uint8_t access_method;
+    uint8_t crc; // CRC-8 of the bytes before it, tells a record torn by a power cut from a valid one
+} journal_record_t;
+
+_Static_assert(sizeof(journal_record_t) == 12, "Records are 12 bytes in flash");
+
+// Start of every sector in use, sector seq is the seq-th sector ever started and sits at seq % sector_count
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq;
+} sector_header_t;
+
+#define RECORDS_PER_SECTOR ((uint32_t)((JOURNAL_SECTOR_SIZE - sizeof(sector_header_t)) / sizeof(journal_record_t)))
+
+// Records are numbered from the first one ever written, record i is slot i % RECORDS_PER_SECTOR of sector seq i / RECORDS_PER_SECTOR
+static const esp_partition_t *partition = NULL;
+static uint32_t sector_count;
+static uint32_t head_seq;  // Sector being appended to
+static uint32_t head_slot; // Next free slot in it
+static uint32_t tail_seq;  // Oldest sector still holding records
+static uint32_t uploaded;  // First record the collector has not acknowledged
+
+// Filled by the token paths, emptied by the journal task
+static journal_record_t staging[JOURNAL_STAGING_SIZE];
+static uint32_t staging_head;
+static uint32_t staging_tail;
+static portMUX_TYPE staging_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t journal_task_handle = NULL;
+static char device_id[18];
+// Set once journal_init() finds no usable partition, records are refused from then on instead of staged
+static bool unavailable = false;
+
+static metric_t *records_metric = NULL;
+static metric_t *dropped_metric = NULL;
+static metric_t *unavailable_metric = NULL;
+static metric_t *lost_metric = NULL;
+static metric_t *pending_metric = NULL;
+static metric_t *uploaded_metric = NULL;
+static metric_t *upload_failures_metric = NULL;
+
+static uint32_t write_index(void)
+{
+    return head_seq * RECORDS_PER_SECTOR + head_slot;
+}
+
+static size_t record_offset(uint32_t index)
+{
+    uint32_t sector = (index / RECORDS_PER_SECTOR) % sector_count;
+    return sector * JOURNAL_SECTOR_SIZE + sizeof(sector_header_t) + (index % RECORDS_PER_SECTOR) * sizeof(journal_record_t);
+}
+
+static uint8_t record_crc(const journal_record_t *record)
+{
+    return esp_rom_crc8_le(0, (const uint8_t *)record, offsetof(journal_record_t, crc));
+}
+
+static bool record_is_erased(const journal_record_t *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (size_t i = 0; i < sizeof(*record); i++)
+        if (bytes[i] != 0xFF)
+            return false;
+    return true;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// First 4 bytes of the "hmac=<hex>" field, zeros if the token has none
+static void token_mac_prefix(const char *token, uint8_t prefix[4])
+{
+    memset(prefix, 0, 4);
+    const char *hmac = token ? strstr(token, "hmac=") : NULL;
+    if (hmac == NULL)
+        return;
+
+    hmac += strlen("hmac=");
+    for (int i = 0; i < 8; i++)
+    {
+        int value = hex_value(hmac[i]);
+        if (value < 0)
+            return;
+        prefix[i / 2] |= value << (i % 2 ? 0 : 4);
+    }
+}
+
+bool journal_record_token(uint8_t access_method, const char *token, uint32_t latency_ms)
+{
+    if (unavailable)
+    {
+        metrics_inc(unavailable_metric);
+        return false;
+    }
+
+    journal_record_t record = {
+        .timestamp = (uint32_t)time(NULL),
+        .latency_ms = (uint16_t)MIN(latency_ms, UINT16_MAX),
+        .access_method = access_method,
+    };
+    token_mac_prefix(token, record.token_mac);
+    record.crc = record_crc(&record);
+
+    taskENTER_CRITICAL(&staging_lock);
+    uint32_t used = staging_head - staging_tail;
+    bool staged = used < JOURNAL_STAGING_SIZE;
+    if (staged)
+        staging[staging_head++ % JOURNAL_STAGING_SIZE] = record;
+    taskEXIT_CRITICAL(&staging_lock);
+
+    if (!staged)
+        metrics_inc(dropped_metric);
+    else if (used + 1 == JOURNAL_STAGING_SIZE / 2 && journal_task_handle != NULL)
+        xTaskNotifyGive(journal_task_handle);
+    return staged;
+}
+
+static void save_upload_position(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return;
+    if (nvs_set_u32(handle, NVS_KEY_UPLOADED, uploaded) == ESP_OK)
+        nvs_commit(handle);
+    nvs_close(handle);
+}
+
+static esp_err_t start_sector(uint32_t seq)
+{
+    // Recycling the oldest sector drops whatever of it the collector has not got yet
+    if (seq - tail_seq >= sector_count)
+    {
+        uint32_t tail_end = (tail_seq + 1) * RECORDS_PER_SECTOR;
+        if ((int32_t)(tail_end - uploaded) > 0)
+        {
+            metrics_add(lost_metric, tail_end - uploaded);
+            ESP_LOGW(TAG, "Journal full, %" PRIu32 " records overwritten before upload", tail_end - uploaded);
+            uploaded = tail_end;
+        }
+        tail_seq++;
+    }
+
+    // Erase first and write the header last, its magic after its seq: a sector cut off anywhere in between has no
+    // magic and is started again, rather than mounted with an erased seq that makes it look like the newest one
+    size_t offset = (seq % sector_count) * JOURNAL_SECTOR_SIZE;
+    const uint32_t magic = JOURNAL_MAGIC;
+    esp_err_t err = esp_partition_erase_range(partition, offset, JOURNAL_SECTOR_SIZE);
+    if (err == ESP_OK)
+        err = esp_partition_write(partition, offset + offsetof(sector_header_t, seq), &seq, sizeof(seq));
+    if (err == ESP_OK)
+        err = esp_partition_write(partition, offset + offsetof(sector_header_t, magic), &magic, sizeof(magic));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start sector %" PRIu32 ": %s", seq, esp_err_to_name(err));
+        return err;
+    }
+
+    head_seq = seq;
+    head_slot = 0;
+    return ESP_OK;
+}
+
+// Find the newest and oldest sectors, then the end of the newest one
+static esp_err_t journal_mount(void)
+{
+    bool found = false;
+    for (uint32_t i = 0; i < sector_count; i++)
+    {
+        sector_header_t header;
+        if (esp_partition_read(partition, i * JOURNAL_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK ||
+            header.magic != JOURNAL_MAGIC || header.seq % sector_count != i)
+            continue;
+
+        if (!found || header.seq > head_seq)
+            head_seq = header.seq;
+        if (!found || header.seq < tail_seq)
+            tail_seq = header.seq;
+        found = true;
+    }
+
+    if (!found)
+    {
+        ESP_LOGI(TAG, "Formatting journal, %" PRIu32 " sectors", sector_count);
+        tail_seq = 0;
+        uploaded = 0;
+        return start_sector(0);
+    }
+
+    head_slot = RECORDS_PER_SECTOR;
+    journal_record_t block[16];
+    for (uint32_t slot = 0; slot < RECORDS_PER_SECTOR && head_slot == RECORDS_PER_SECTOR; slot += 16)
+    {
+        uint32_t count = MIN(16, RECORDS_PER_SECTOR - slot);
+        esp_err_t err = esp_partition_read(partition, record_offset(head_seq * RECORDS_PER_SECTOR + slot), block,
+                                           count * sizeof(journal_record_t));
+        if (err != ESP_OK)
+            return err;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (record_is_erased(&block[i]))
+            {
+                head_slot = slot + i;
+                break;
+            }
+        }
+    }
+
+    // A position outside the journal means it was wiped since, everything in it is new then
+    nvs_handle_t handle;
+    uploaded = tail_seq * RECORDS_PER_SECTOR;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        uint32_t saved;
+        if (nvs_get_u32(handle, NVS_KEY_UPLOADED, &saved) == ESP_OK &&
+            saved - uploaded <= write_index() - uploaded)
+            uploaded = saved;
+        nvs_close(handle);
+    }
+
+    ESP_LOGI(TAG, "Journal holds %" PRIu32 " records, %" PRIu32 " not uploaded",
+             write_index() - tail_seq * RECORDS_PER_SECTOR, write_index() - uploaded);
+    return ESP_OK;
+}
+
+// Move the staged records to flash. Only this task takes them out, so they are copied first and released once
+// written: a record that didn't make it stays staged and is tried again on the next flush. Writing it again over a
+// partly written slot is safe, flash writes only clear bits and the bytes are the same.
+static void journal_flush(void)
+{
+    journal_record_t records[JOURNAL_STAGING_SIZE];
+    uint32_t count = 0;
+
+    taskENTER_CRITICAL(&staging_lock);
+    for (uint32_t pos = staging_tail; pos != staging_head; pos++)
+        records[count++] = staging[pos % JOURNAL_STAGING_SIZE];
+    taskEXIT_CRITICAL(&staging_lock);
+
+    uint32_t written = 0;
+    while (written < count)
+    {
+        if (head_slot == RECORDS_PER_SECTOR && start_sector(head_seq + 1) != ESP_OK)
+            break;
+
+        uint32_t run = MIN(count - written, RECORDS_PER_SECTOR - head_slot);
+        esp_err_t err = esp_partition_write(partition, record_offset(write_index()), &records[written],
+                                            run * sizeof(journal_record_t));
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to write records: %s", esp_err_to_name(err));
+            break;
+        }
+
+        head_slot += run;
+        written += run;
+        metrics_add(records_metric, run);
+    }
+
+    taskENTER_CRITICAL(&staging_lock);
+    staging_tail += written;
+    taskEXIT_CRITICAL(&staging_lock);
+
+    if (written < count)
+        ESP_LOGW(TAG, "%" PRIu32 " records kept staged for the next flush", count - written);
+}
+
+static esp_err_t read_records(uint32_t index, journal_record_t *records, uint32_t count)
+{
+    while (count > 0)
+    {
+        uint32_t run = MIN(count, RECORDS_PER_SECTOR - index % RECORDS_PER_SECTOR);
+        esp_err_t err = esp_partition_read(partition, record_offset(index), records, run * sizeof(journal_record_t));
+        if (err != ESP_OK)
+            return err;
+
+        index += run;
+        records += run;
+        count -= run;
+    }
+    return ESP_OK;
+}
+
+static size_t put_varint(uint8_t *out, uint32_t value)
+{
+    size_t len = 0;
+    do
+    {
+        out[len] = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+            out[len] |= 0x80;
+        len++;
+    } while (value != 0);
+    return len;
+}
+
+/*
+    Upload body, 'J' '1' then varint first index, varint count, and per record:
+    varint zigzag(timestamp - previous timestamp), access method, 4 HMAC bytes, varint latency.
+    An access method of 0xFF marks a record torn by a power cut, nothing else follows it.
+*/
+#define BATCH_MAX_LEN (2 + 5 + 5 + JOURNAL_UPLOAD_BATCH * (5 + 1 + 4 + 3))
+
+static size_t encode_batch(uint8_t *out, uint32_t first, const journal_record_t *records, uint32_t count)
+{
+    size_t len = 0;
+    out[len++] = 'J';
+    out[len++] = '1';
+    len += put_varint(out + len, first);
+    len += put_varint(out + len, count);
+
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const journal_record_t *record = &records[i];
+        if (record->crc != record_crc(record))
+        {
+            out[len++] = 0xFF;
+            continue;
+        }
+
+        int32_t delta = (int32_t)(record->timestamp - previous);
+        len += put_varint(out + len, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+        out[len++] = record->access_method;
+        memcpy(out + len, record->token_mac, sizeof(record->token_mac));
+        len += sizeof(record->token_mac);
+        len += put_varint(out + len, record->latency_ms);
+        previous = record->timestamp;
+    }
+    return len;
+}
+
+// Send everything not acknowledged yet, returns false if the collector could not be reached
+static bool journal_upload(void)
+{
+    static journal_record_t records[JOURNAL_UPLOAD_BATCH];
+    static uint8_t body[BATCH_MAX_LEN];
+
+    esp_http_client_config_t config = {
+        .url = JOURNAL_UPLOAD_URL,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = JOURNAL_UPLOAD_TIMEOUT_MS,
+    };
+
+    // One client for the whole backlog, esp_http_client keeps the HTTP/1.1 connection open between requests
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+        return false;
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+    esp_http_client_set_header(client, "X-Device-Id", device_id);
+
+    bool ok = true;
+    uint32_t sent = 0;
+    while (uploaded != write_index() && system_ready_is_set(SYSTEM_READY_STA_GOT_IP))
+    {
+        uint32_t count = MIN(write_index() - uploaded, JOURNAL_UPLOAD_BATCH);
+        if (read_records(uploaded, records, count) != ESP_OK)
+        {
+            ok = false;
+            break;
+        }
+
+        size_t len = encode_batch(body, uploaded, records, count);
+        esp_http_client_set_post_field(client, (const char *)body, len);
+        esp_err_t err = esp_http_client_perform(client);
+        int status = err == ESP_OK ? esp_http_client_get_status_code(client) : 0;
+        if (status / 100 != 2)
+        {
+            ESP_LOGW(TAG, "Upload failed: %s, status %d", esp_err_to_name(err), status);
+            metrics_inc(upload_failures_metric);
+            ok = false;
+            break;
+        }
+
+        uploaded += count;
+        sent += count;
+        metrics_add(uploaded_metric, count);
+        save_upload_position();
+
+        // Taps keep coming during a long upload, keep the staging buffer from filling up
+        journal_flush();
+    }
+
+    esp_http_client_cleanup(client);
+    if (sent > 0)
+        ESP_LOGI(TAG, "Uploaded %" PRIu32 " records", sent);
+    return ok;
+}
+
+static void journal_task(void *pvParameters)
+{
+    bool backing_off = false;
+    TickType_t retry_at = 0;
+
+    while (1)
+    {
+        // Woken early when the staging buffer is half full
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(JOURNAL_FLUSH_INTERVAL_MS));
+        journal_flush();
+
+        // The first wake-up after the STA got its address starts the upload
+        if (uploaded != write_index() && system_ready_is_set(SYSTEM_READY_STA_GOT_IP) &&
+            (!backing_off || (int32_t)(xTaskGetTickCount() - retry_at) >= 0))
+        {
+            backing_off = !journal_upload();
+            retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(JOURNAL_UPLOAD_RETRY_MS);
+        }
+
+        metrics_set(pending_metric, (int32_t)(write_index() - uploaded));
+    }
+}
+
+void journal_init(const task_config_t *task)
+{
+    records_metric = metrics_counter("journal_records_total", "Records written to the journal");
+    dropped_metric = metrics_counter("journal_dropped_total", "Records dropped because the staging buffer was full");
+    unavailable_metric = metrics_counter("journal_unavailable_total", "Records refused because there is no usable journal partition");
+    lost_metric = metrics_counter("journal_lost_total", "Records overwritten before they were uploaded");
+    pending_metric = metrics_gauge("journal_pending_records", "Records waiting for upload");
+    uploaded_metric = metrics_counter("journal_uploaded_total", "Records acknowledged by the collector");
+    upload_failures_metric = metrics_counter("journal_upload_failures_total", "Uploads cut short by an error");
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, JOURNAL_PARTITION_LABEL);
+    if (partition == NULL || partition->size < 2 * JOURNAL_SECTOR_SIZE)
+    {
+        ESP_LOGE(TAG, "No usable '%s' partition, tokens will not be journaled", JOURNAL_PARTITION_LABEL);
+        partition = NULL;
+        unavailable = true;
+        return;
+    }
+    sector_count = partition->size / JOURNAL_SECTOR_SIZE;
+
+    if (journal_mount() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to read the journal, tokens will not be journaled");
+        partition = NULL;
+        unavailable = true;
+        return;
+    }
+
+#if CONFIG_IDF_TARGET_LINUX
+    // Simulation build, there is no factory MAC
+    snprintf(device_id, sizeof(device_id), "simulator");
+#else
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(device_id, sizeof(device_id), MACSTR, MAC2STR(mac));
+#endif
+
+    if (journal_task_handle == NULL)
+        task_config_create(journal_task, NULL, task, &journal_task_handle);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Metrics that can be registered in total, registering more returns NULL
+#define METRICS_MAX 40
+// Upper bounds a histogram may have, the +Inf bucket comes on top
+#define METRICS_MAX_BUCKETS 8
+// Tasks whose stack high-water mark is reported, the rest is left out
+#define METRICS_MAX_TASKS 24
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct metric metric_t;
+
+    /**
+     * @brief Write callback for metrics_render(), called with each full buffer and once with the rest
+     * @return ESP_OK to continue, anything else aborts the render
+     */
+    typedef esp_err_t (*metrics_flush_fn)(const char *data, size_t len, void *ctx);
+
+    /**
+     * @brief Register a monotonically increasing counter
+     *
+     * Registering a name twice returns the existing metric. Names, help texts and histogram bounds must outlive the
+     * registry, in practice they are literals.
+     *
+     * @return The metric, or NULL if the registry is full. All update functions accept NULL and do nothing.
+     */
+    metric_t *metrics_counter(const char *name, const char *help);
+
+    /**
+     * @brief Register a gauge holding the last value set
+     */
+    metric_t *metrics_gauge(const char *name, const char *help);
+
+    /**
+     * @brief Register a histogram with fixed buckets
+     * @param bounds Ascending upper bounds of the buckets, inclusive
+     * @param num_bounds Number of bounds, at most METRICS_MAX_BUCKETS
+     */
+    metric_t *metrics_histogram(const char *name, const char *help, const int32_t *bounds, size_t num_bounds);
+
+    /**
+     * @brief Add one to a counter
+     */
+    void metrics_inc(metric_t *metric);
+
+    /**
+     * @brief Add to a counter
+     */
+    void metrics_add(metric_t *metric, uint32_t amount);
+
+    /**
+     * @brief Set a gauge
+     */
+    void metrics_set(metric_t *metric, int32_t value);
+
+    /**
+     * @brief Count one observation in a histogram
+     */
+    void metrics_observe(metric_t *metric, int32_t value);
+
+    /**
+     * @brief Render all metrics in the Prometheus text format, followed by heap and per-task stack figures
+     *
+     * @note Only one render runs at a time, a concurrent call fails with ESP_ERR_INVALID_STATE.
+     *
+     * @param buf Scratch buffer, every line must fit
+     * @param size Size of the scratch buffer
+     * @param flush Receives the rendered text piece by piece
+     * @return ESP_OK, or the first error returned by flush
+     */
+    esp_err_t metrics_render(char *buf, size_t size, metrics_flush_fn flush, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
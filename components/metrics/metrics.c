@@ -0,0 +1,232 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "metrics.h"
+
+typedef enum
+{
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+} metric_type_t;
+
+struct metric
+{
+    const char *name;
+    const char *help;
+    metric_type_t type;
+    atomic_int_fast32_t value; // Counter or gauge value, histogram sum
+    const int32_t *bounds;
+    size_t num_bounds;
+    atomic_uint_fast32_t buckets[METRICS_MAX_BUCKETS + 1]; // Per bucket, not cumulative, the last one is +Inf
+};
+
+// Slots are only ever added, and published through num_metrics once filled, so rendering needs no lock
+static struct metric registry[METRICS_MAX];
+static atomic_size_t num_metrics;
+static portMUX_TYPE registry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static atomic_flag render_busy = ATOMIC_FLAG_INIT;
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+
+static metric_t *metrics_register(const char *name, const char *help, metric_type_t type,
+                                  const int32_t *bounds, size_t num_bounds)
+{
+    metric_t *metric = NULL;
+
+    taskENTER_CRITICAL(&registry_lock);
+    size_t count = atomic_load(&num_metrics);
+    for (size_t i = 0; i < count && metric == NULL; i++)
+        if (strcmp(registry[i].name, name) == 0)
+            metric = &registry[i];
+
+    if (metric == NULL && count < METRICS_MAX)
+    {
+        metric = &registry[count];
+        metric->name = name;
+        metric->help = help;
+        metric->type = type;
+        metric->bounds = bounds;
+        metric->num_bounds = num_bounds;
+        atomic_store(&num_metrics, count + 1);
+    }
+    taskEXIT_CRITICAL(&registry_lock);
+
+    return metric;
+}
+
+metric_t *metrics_counter(const char *name, const char *help)
+{
+    return metrics_register(name, help, METRIC_COUNTER, NULL, 0);
+}
+
+metric_t *metrics_gauge(const char *name, const char *help)
+{
+    return metrics_register(name, help, METRIC_GAUGE, NULL, 0);
+}
+
+metric_t *metrics_histogram(const char *name, const char *help, const int32_t *bounds, size_t num_bounds)
+{
+    if (num_bounds > METRICS_MAX_BUCKETS)
+        num_bounds = METRICS_MAX_BUCKETS;
+
+    return metrics_register(name, help, METRIC_HISTOGRAM, bounds, num_bounds);
+}
+
+void metrics_inc(metric_t *metric)
+{
+    metrics_add(metric, 1);
+}
+
+void metrics_add(metric_t *metric, uint32_t amount)
+{
+    if (metric != NULL)
+        atomic_fetch_add_explicit(&metric->value, amount, memory_order_relaxed);
+}
+
+void metrics_set(metric_t *metric, int32_t value)
+{
+    if (metric != NULL)
+        atomic_store_explicit(&metric->value, value, memory_order_relaxed);
+}
+
+void metrics_observe(metric_t *metric, int32_t value)
+{
+    if (metric == NULL)
+        return;
+
+    size_t bucket = 0;
+    while (bucket < metric->num_bounds && value > metric->bounds[bucket])
+        bucket++;
+
+    atomic_fetch_add_explicit(&metric->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metric->value, value, memory_order_relaxed);
+}
+
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t used;
+    metrics_flush_fn flush;
+    void *ctx;
+    esp_err_t err;
+} render_state_t;
+
+// Appends one line, handing the buffer to flush first when the line would not fit
+static void emit(render_state_t *state, const char *format, ...)
+{
+    if (state->err != ESP_OK)
+        return;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(state->buf + state->used, state->size - state->used, format, args);
+        va_end(args);
+
+        if (len >= 0 && (size_t)len < state->size - state->used)
+        {
+            state->used += len;
+            return;
+        }
+        if (state->used == 0)
+            break;
+
+        state->err = state->flush(state->buf, state->used, state->ctx);
+        state->used = 0;
+        if (state->err != ESP_OK)
+            return;
+    }
+
+    // A line larger than the whole buffer is left out rather than sent in half
+}
+
+static void emit_header(render_state_t *state, const char *name, const char *help, const char *type)
+{
+    emit(state, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void render_metric(render_state_t *state, metric_t *metric)
+{
+    static const char *const type_names[] = {"counter", "gauge", "histogram"};
+    emit_header(state, metric->name, metric->help, type_names[metric->type]);
+
+    int32_t value = atomic_load_explicit(&metric->value, memory_order_relaxed);
+    if (metric->type == METRIC_COUNTER)
+    {
+        emit(state, "%s %" PRIu32 "\n", metric->name, (uint32_t)value);
+        return;
+    }
+    if (metric->type == METRIC_GAUGE)
+    {
+        emit(state, "%s %" PRId32 "\n", metric->name, value);
+        return;
+    }
+
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < metric->num_bounds; i++)
+    {
+        cumulative += atomic_load_explicit(&metric->buckets[i], memory_order_relaxed);
+        emit(state, "%s_bucket{le=\"%" PRId32 "\"} %" PRIu32 "\n", metric->name, metric->bounds[i], cumulative);
+    }
+    cumulative += atomic_load_explicit(&metric->buckets[metric->num_bounds], memory_order_relaxed);
+    emit(state, "%s_bucket{le=\"+Inf\"} %" PRIu32 "\n", metric->name, cumulative);
+    emit(state, "%s_sum %" PRId32 "\n%s_count %" PRIu32 "\n", metric->name, value, metric->name, cumulative);
+}
+
+// Figures read on demand rather than tracked from the hot paths
+static void render_system(render_state_t *state)
+{
+    emit_header(state, "uptime_seconds", "Time since boot", "gauge");
+    emit(state, "uptime_seconds %" PRId64 "\n", esp_timer_get_time() / 1000000);
+
+    emit_header(state, "heap_free_bytes", "Free heap", "gauge");
+    emit(state, "heap_free_bytes %" PRIu32 "\n", esp_get_free_heap_size());
+
+    emit_header(state, "heap_min_free_bytes", "Lowest free heap since boot", "gauge");
+    emit(state, "heap_min_free_bytes %" PRIu32 "\n", esp_get_minimum_free_heap_size());
+
+    // The stack high-water mark is in bytes on ESP-IDF
+    UBaseType_t num_tasks = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, NULL);
+    emit_header(state, "task_stack_free_min_bytes", "Lowest free stack since the task started", "gauge");
+    for (UBaseType_t i = 0; i < num_tasks; i++)
+        emit(state, "task_stack_free_min_bytes{task=\"%s\"} %" PRIu32 "\n",
+             task_status[i].pcTaskName, (uint32_t)task_status[i].usStackHighWaterMark);
+}
+
+esp_err_t metrics_render(char *buf, size_t size, metrics_flush_fn flush, void *ctx)
+{
+    if (atomic_flag_test_and_set(&render_busy))
+        return ESP_ERR_INVALID_STATE;
+
+    render_state_t state = {
+        .buf = buf,
+        .size = size,
+        .used = 0,
+        .flush = flush,
+        .ctx = ctx,
+        .err = ESP_OK,
+    };
+
+    size_t count = atomic_load(&num_metrics);
+    for (size_t i = 0; i < count; i++)
+        render_metric(&state, &registry[i]);
+    render_system(&state);
+
+    if (state.err == ESP_OK && state.used > 0)
+        state.err = flush(buf, state.used, ctx);
+
+    atomic_flag_clear(&render_busy);
+    return state.err;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "task_config.h"
+
+// Reactor build: DNS and the portal's HTTP sockets are served by one task instead of the dns_server and httpd tasks
+#define NET_REACTOR_ENABLED 0
+
+// HTTP connections read from at once, further ones wait in the listen backlog until a slot frees up
+#define NET_REACTOR_MAX_CLIENTS 10
+#define NET_REACTOR_BACKLOG 5
+// Only the request line is kept, headers are read and dropped; longer lines are answered 414
+#define NET_REACTOR_REQUEST_LINE_LEN 128
+// A client has this long to send its whole request, after that the connection is closed
+#define NET_REACTOR_REQUEST_TIMEOUT_MS 5000
+// A response not sent in full by then is cut off; until then a client that stops reading holds up the other HTTP
+// connections, DNS is answered while the reactor waits for it
+#define NET_REACTOR_RESPONSE_TIMEOUT_MS 2000
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct net_reactor_conn net_reactor_conn_t;
+
+    /**
+     * @brief Called once the request of a connection is complete, the connection is closed when it returns
+     *
+     * Runs in the reactor task, so other HTTP connections wait meanwhile; DNS is still answered while a send waits for
+     * the client. Respond with net_reactor_send_head() followed by net_reactor_send() for the body, the end of the body
+     * is marked by closing the connection. The whole response has NET_REACTOR_RESPONSE_TIMEOUT_MS.
+     *
+     * @param method Request method, e.g. "GET"
+     * @param uri Request path, without the query string
+     */
+    typedef void (*net_reactor_request_fn)(net_reactor_conn_t *conn, const char *method, const char *uri, void *ctx);
+
+    /**
+     * @brief Decide whether to keep a new connection, checked before anything is read from it
+     * @param ip Client IPv4 address (network byte order)
+     * @return false to close the connection right away
+     */
+    typedef bool (*net_reactor_admit_fn)(uint32_t ip, void *ctx);
+
+    /**
+     * @brief UDP socket owned by someone else, the reactor only waits for it to become readable
+     */
+    typedef struct net_reactor_udp
+    {
+        int sock;                       /**<! Bound socket, -1 for none */
+        void (*on_readable)(void *ctx); /**<! Reads and answers one datagram, must not block */
+        void *ctx;
+    } net_reactor_udp_t;
+
+    typedef struct net_reactor_config
+    {
+        uint16_t http_port;
+        int max_clients;                 /**<! HTTP connections held at once, at most NET_REACTOR_MAX_CLIENTS */
+        net_reactor_admit_fn admit;      /**<! NULL to keep every connection */
+        net_reactor_request_fn handler;
+        void *ctx;                       /**<! Passed to admit and handler */
+        const net_reactor_udp_t *udp;    /**<! NULL for none, copied */
+        const task_config_t *task;       /**<! Where the reactor task runs */
+    } net_reactor_config_t;
+
+    /**
+     * @brief Open the HTTP listener and start the reactor task, only one reactor may run
+     * @return ESP_OK, or an error if the listener or the task couldn't be created
+     */
+    esp_err_t net_reactor_start(const net_reactor_config_t *config);
+
+    /**
+     * @brief Send the status line and headers of a close-delimited response
+     * @param status Status code and reason, e.g. "302 Found"
+     * @param type Content-Type
+     * @param location Location header, NULL for none
+     */
+    esp_err_t net_reactor_send_head(net_reactor_conn_t *conn, const char *status, const char *type, const char *location);
+
+    /**
+     * @brief Send part of the response body
+     * @param ctx The connection, void * so the function fits metrics_render() and trace_dump()
+     * @return ESP_OK, or ESP_FAIL once the client is gone or the response deadline has passed, and for every send after
+     */
+    esp_err_t net_reactor_send(const char *data, size_t len, void *ctx);
+
+    /**
+     * @brief IPv4 address of the client (network byte order)
+     */
+    uint32_t net_reactor_client_ip(const net_reactor_conn_t *conn);
+
+#ifdef __cplusplus
+}
+#endif
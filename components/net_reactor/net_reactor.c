@@ -0,0 +1,384 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "net_reactor.h"
+#include "metrics.h"
+
+/*
+    One task waits in select() on the DNS socket, the HTTP listener and every HTTP connection, and
+    serves whichever is ready. Each connection owns a fixed slot holding just its request line; the
+    headers are read in pieces into a scratch buffer on the task's stack and dropped, only the blank
+    line ending them is looked for. Responses are close-delimited and written straight from the
+    handler; sockets are non-blocking, and a send that finds the socket full waits in select() for it
+    to drain while still answering DNS. Each response has a deadline, a client that stops reading is
+    cut off there, so it holds up the other HTTP clients at most that long and DNS not at all.
+*/
+
+static const char *TAG = "net_reactor";
+
+struct net_reactor_conn
+{
+    int sock;              // -1 while the slot is free
+    uint32_t ip;
+    int64_t deadline_us;   // Closed if the request isn't complete by then, or the response sent
+    bool send_failed;      // Client gone or too slow, the rest of the response is dropped
+    bool line_done;        // Request line complete, headers are being skipped
+    bool blank;            // Nothing but CR on the header line so far, the empty line ends the request
+    uint16_t len;
+    char line[NET_REACTOR_REQUEST_LINE_LEN];
+};
+
+static net_reactor_conn_t conns[NET_REACTOR_MAX_CLIENTS];
+static net_reactor_config_t reactor;
+static net_reactor_udp_t udp = {.sock = -1};
+static int listen_sock = -1;
+static TaskHandle_t reactor_task = NULL;
+
+static metric_t *connections_metric = NULL;
+static metric_t *dropped_metric = NULL;
+
+static void close_conn(net_reactor_conn_t *conn)
+{
+    shutdown(conn->sock, SHUT_RDWR);
+    close(conn->sock);
+    conn->sock = -1;
+}
+
+// Close a connection that never got its response
+static void drop_conn(net_reactor_conn_t *conn)
+{
+    metrics_inc(dropped_metric);
+    close_conn(conn);
+}
+
+static int open_listener(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Unable to create the listener: errno %d", errno);
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, NET_REACTOR_BACKLOG) < 0)
+    {
+        ESP_LOGE(TAG, "Unable to listen on port %d: errno %d", port, errno);
+        close(sock);
+        return -1;
+    }
+
+    // A client may be gone again by the time it's accepted, which must not block the reactor
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    return sock;
+}
+
+static void accept_client(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int sock = accept(listen_sock, (struct sockaddr *)&addr, &addr_len);
+    if (sock < 0)
+        return;
+
+    metrics_inc(connections_metric);
+    uint32_t ip = addr.sin_addr.s_addr;
+    if (reactor.admit && !reactor.admit(ip, reactor.ctx))
+    {
+        metrics_inc(dropped_metric);
+        close(sock);
+        return;
+    }
+
+    // Only called with a slot free, the listener isn't watched otherwise
+    net_reactor_conn_t *conn = &conns[0];
+    while (conn->sock >= 0)
+        conn++;
+
+    // lwIP doesn't pass O_NONBLOCK on from the listener
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    conn->sock = sock;
+    conn->ip = ip;
+    conn->deadline_us = esp_timer_get_time() + NET_REACTOR_REQUEST_TIMEOUT_MS * 1000LL;
+    conn->send_failed = false;
+    conn->line_done = false;
+    conn->blank = true;
+    conn->len = 0;
+}
+
+// Start the response deadline, everything sent on the connection from here on has to be out by then
+static void begin_response(net_reactor_conn_t *conn)
+{
+    conn->deadline_us = esp_timer_get_time() + NET_REACTOR_RESPONSE_TIMEOUT_MS * 1000LL;
+}
+
+// Close a connection after its response, counted as dropped if the response didn't make it out
+static void finish_conn(net_reactor_conn_t *conn)
+{
+    if (conn->send_failed)
+        drop_conn(conn);
+    else
+        close_conn(conn);
+}
+
+// Split "METHOD URI VERSION" in place and hand it to the handler, false if the line isn't one
+static bool dispatch(net_reactor_conn_t *conn)
+{
+    char *method = conn->line;
+    char *uri = strchr(method, ' ');
+    if (uri == NULL)
+        return false;
+    *uri++ = '\0';
+
+    char *end = strpbrk(uri, " ?");
+    if (end)
+        *end = '\0';
+    if (*uri != '/')
+        return false;
+
+    reactor.handler(conn, method, uri, reactor.ctx);
+    return true;
+}
+
+// Read whatever arrived, and answer once the headers are complete
+static void read_request(net_reactor_conn_t *conn)
+{
+    char scratch[64];
+    int len = recv(conn->sock, scratch, sizeof(scratch), MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (len <= 0)
+    {
+        // Gone before the request was complete
+        drop_conn(conn);
+        return;
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        char c = scratch[i];
+        if (c == '\r')
+            continue;
+
+        if (c != '\n')
+        {
+            conn->blank = false;
+            if (conn->line_done)
+                continue;
+            if (conn->len == sizeof(conn->line) - 1)
+            {
+                begin_response(conn);
+                net_reactor_send_head(conn, "414 URI Too Long", "text/plain", NULL);
+                drop_conn(conn);
+                return;
+            }
+            conn->line[conn->len++] = c;
+        }
+        else if (!conn->line_done)
+        {
+            // Lines end in CRLF or a bare LF, empty lines before the request line are skipped
+            conn->line[conn->len] = '\0';
+            conn->line_done = conn->len > 0;
+            conn->blank = true;
+        }
+        else if (!conn->blank)
+        {
+            conn->blank = true;
+        }
+        else
+        {
+            // Anything after the headers, a body or a pipelined request, is ignored
+            begin_response(conn);
+            if (!dispatch(conn))
+            {
+                net_reactor_send_head(conn, "400 Bad Request", "text/plain", NULL);
+                drop_conn(conn);
+                return;
+            }
+            finish_conn(conn);
+            return;
+        }
+    }
+}
+
+static void net_reactor_task(void *arg)
+{
+    while (true)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        int max_fd = -1;
+        if (udp.sock >= 0)
+        {
+            FD_SET(udp.sock, &readable);
+            max_fd = MAX(max_fd, udp.sock);
+        }
+
+        int open = 0;
+        for (int i = 0; i < reactor.max_clients; i++)
+        {
+            if (conns[i].sock >= 0)
+            {
+                FD_SET(conns[i].sock, &readable);
+                max_fd = MAX(max_fd, conns[i].sock);
+                open++;
+            }
+        }
+
+        // With every slot taken, new clients wait in the listen backlog until a response frees one
+        bool accepting = open < reactor.max_clients;
+        if (accepting)
+        {
+            FD_SET(listen_sock, &readable);
+            max_fd = MAX(max_fd, listen_sock);
+        }
+
+        // Wake up once a second while requests are pending so stale ones are closed, sleep otherwise
+        struct timeval tick = {.tv_sec = 1, .tv_usec = 0};
+        int ready = select(max_fd + 1, &readable, NULL, NULL, open > 0 ? &tick : NULL);
+        if (ready < 0)
+        {
+            ESP_LOGE(TAG, "select failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        // DNS first, it's the cheapest to answer and phones retry it the soonest
+        if (udp.sock >= 0 && FD_ISSET(udp.sock, &readable))
+            udp.on_readable(udp.ctx);
+
+        // Connections before the listener, so a slot reused for a new client isn't read from a stale readiness bit
+        int64_t now_us = esp_timer_get_time();
+        for (int i = 0; i < reactor.max_clients; i++)
+        {
+            if (conns[i].sock < 0)
+                continue;
+            if (FD_ISSET(conns[i].sock, &readable))
+                read_request(&conns[i]);
+            else if (now_us > conns[i].deadline_us)
+                drop_conn(&conns[i]);
+        }
+
+        if (accepting && FD_ISSET(listen_sock, &readable))
+            accept_client();
+    }
+}
+
+esp_err_t net_reactor_start(const net_reactor_config_t *config)
+{
+    if (reactor_task != NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    reactor = *config;
+    if (reactor.max_clients <= 0 || reactor.max_clients > NET_REACTOR_MAX_CLIENTS)
+        reactor.max_clients = NET_REACTOR_MAX_CLIENTS;
+    if (config->udp)
+        udp = *config->udp;
+    for (int i = 0; i < NET_REACTOR_MAX_CLIENTS; i++)
+        conns[i].sock = -1;
+
+    connections_metric = metrics_counter("reactor_connections_total", "HTTP connections accepted by the reactor");
+    dropped_metric = metrics_counter("reactor_dropped_total", "HTTP connections closed unanswered or cut off: throttled, timed out, malformed or not reading");
+
+    listen_sock = open_listener(config->http_port);
+    if (listen_sock < 0)
+        return ESP_FAIL;
+
+    if (task_config_create(net_reactor_task, NULL, config->task, &reactor_task) != pdPASS)
+    {
+        close(listen_sock);
+        listen_sock = -1;
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Serving HTTP on port %d%s", config->http_port, udp.sock >= 0 ? " and a UDP socket" : "");
+    return ESP_OK;
+}
+
+esp_err_t net_reactor_send_head(net_reactor_conn_t *conn, const char *status, const char *type, const char *location)
+{
+    char head[160];
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\n%s%s%sConnection: close\r\n\r\n",
+                       status, type, location ? "Location: " : "", location ? location : "", location ? "\r\n" : "");
+    if (len < 0 || len >= (int)sizeof(head))
+        return ESP_ERR_INVALID_SIZE;
+    return net_reactor_send(head, len, conn);
+}
+
+// Wait until the connection can take more or its response deadline passes, answering DNS meanwhile.
+// Other HTTP connections are left alone: their handlers would run nested in this one.
+static bool wait_writable(net_reactor_conn_t *conn)
+{
+    while (true)
+    {
+        int64_t remaining_us = conn->deadline_us - esp_timer_get_time();
+        if (remaining_us <= 0)
+            return false;
+
+        fd_set writable, readable;
+        FD_ZERO(&writable);
+        FD_ZERO(&readable);
+        FD_SET(conn->sock, &writable);
+        int max_fd = conn->sock;
+        if (udp.sock >= 0)
+        {
+            FD_SET(udp.sock, &readable);
+            max_fd = MAX(max_fd, udp.sock);
+        }
+
+        struct timeval timeout = {.tv_sec = remaining_us / 1000000, .tv_usec = remaining_us % 1000000};
+        int ready = select(max_fd + 1, &readable, &writable, NULL, &timeout);
+        if (ready < 0)
+            return false;
+
+        if (udp.sock >= 0 && FD_ISSET(udp.sock, &readable))
+            udp.on_readable(udp.ctx);
+        if (FD_ISSET(conn->sock, &writable))
+            return true;
+    }
+}
+
+esp_err_t net_reactor_send(const char *data, size_t len, void *ctx)
+{
+    net_reactor_conn_t *conn = ctx;
+    while (len > 0 && !conn->send_failed)
+    {
+        int sent = send(conn->sock, data, len, MSG_DONTWAIT);
+        if (sent > 0)
+        {
+            data += sent;
+            len -= sent;
+        }
+        else if (sent == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || !wait_writable(conn))
+        {
+            conn->send_failed = true;
+        }
+    }
+    return conn->send_failed ? ESP_FAIL : ESP_OK;
+}
+
+uint32_t net_reactor_client_ip(const net_reactor_conn_t *conn)
+{
+    return conn->ip;
+}
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "hmac_token_generator.h"
-#include "st25dv.hpp"
+#include "task_config.h"
 
 // NFC configuration
 #define NFC_SDA_GPIO 21
@@ -18,8 +18,9 @@ extern "C"
     /**
      * Configure I2C for NFC
      * @param hmac_generator HMAC token generator instance
+     * @param task Where the GPO (tap) task runs
      */
-    void start_nfc_task(HMACTokenGenerator *hmac_generator);
+    void start_nfc_task(HMACTokenGenerator *hmac_generator, const task_config_t *task);
 
 #ifdef __cplusplus
 }
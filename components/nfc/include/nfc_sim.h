@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "task_config.h"
+
+/*
+    Simulation build only (IDF_TARGET linux): the ST25DV is an in-memory EEPROM that takes as long to write
+    as the real one over 100 kHz I2C, and its GPO line is a UDP port. Every datagram "tap" raises one GPO
+    edge and is answered once the tap path has written the tag, or after NFC_SIM_TAP_TIMEOUT_MS if it didn't:
+
+        tap    ->  "written <us from edge to record on the tag> <record bytes>"  or  "ignored"
+        read   ->  the NDEF record currently on the tag
+*/
+
+#define NFC_SIM_GPO_PORT 8054
+#define NFC_SIM_TAP_TIMEOUT_MS 500 // A write takes well under 100 ms, a tap not answered by then was debounced
+
+// Timing model of a record write: I2C at NFC_SIM_I2C_HZ, 9 bit times per byte, and one EEPROM programming
+// cycle per NFC_SIM_EEPROM_ROW_BYTES written
+#define NFC_SIM_I2C_HZ 100000
+#define NFC_SIM_EEPROM_ROW_BYTES 16
+#define NFC_SIM_EEPROM_WRITE_MS 5
+#define NFC_SIM_EEPROM_SIZE 512
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Start listening for GPO edges on NFC_SIM_GPO_PORT, after start_nfc_task()
+     * @param task Where the listener runs, below the GPO task so the tap path preempts it
+     */
+    void nfc_sim_start(const task_config_t *task);
+
+    /**
+     * @brief Raise one GPO edge and wait for the tag write it triggers
+     * @param timeout_ms Longest wait for the write
+     * @param latency_us Receives the time from the edge to the record being on the tag
+     * @return false if no write followed, because the tap came too soon after the last one or the tag isn't ready
+     */
+    bool nfc_sim_tap(uint32_t timeout_ms, uint32_t *latency_us);
+
+    /**
+     * @brief Copy the NDEF record currently on the tag
+     * @return Bytes copied, 0 before the first write
+     */
+    size_t nfc_sim_read_record(uint8_t *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
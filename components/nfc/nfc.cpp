@@ -1,121 +1,138 @@
 #include <vector>
 #include <system_error>
 #include <array>
+#include <cstring>
 
 #include "esp_log.h"
 #include "esp_err.h"
-#include "driver/i2c.h"
-#include "driver/gpio.h"
+#include "esp_timer.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/timers.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "nfc.h"
+#include "nfc_tag.h"
 #include "time_sync.h"
-#include "ndef.hpp"
+#include "system_ready.h"
+#include "fastlog.h"
+#include "metrics.h"
+#include "trace.h"
+#include "alloc_trace.h"
+#include "journal.h"
+#include "boot_timeline.h"
 
 static const char *TAG = "NFC";
 static const char *TAG2 = "NFC-GPO";
 
-static espp::St25dv *global_st25dv = nullptr;
+static bool tag_ready = false;
 static HMACTokenGenerator *global_hmac_generator = nullptr;
 static QueueHandle_t gpo_evt_queue = NULL;
-static std::vector<uint8_t> record = espp::Ndef::make_uri(
-                                         "webapp--rig-attendance-app.asia-east1.hosted.app", espp::Ndef::Uic::HTTPS)
-                                         .serialize();
-
-static void nfc_gpo_isr(void *arg)
-{
-    uint32_t gpio_num = (uint32_t)arg;
-    xQueueSendFromISR(gpo_evt_queue, &gpio_num, NULL);
-}
-
-esp_err_t nfc_gpio_init()
-{
-    gpio_config_t io_conf = {
-        .pin_bit_mask = 1ULL << NFC_GPO_GPIO,
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLUP_ENABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_POSEDGE, // Rising edge = field detected
-    };
-
-    gpio_config(&io_conf);
-
-    gpio_install_isr_service(0); // Default ISR service
-    gpio_isr_handler_add(gpio_num_t(NFC_GPO_GPIO), nfc_gpo_isr, (void *)NFC_GPO_GPIO);
-
-    return ESP_OK;
-}
-
-void configure_i2c_nfc(void)
+static TimerHandle_t nfc_timer = NULL;
+
+// The timer replaces the record while the GPO task may be writing it to the tag
+static StaticSemaphore_t record_mutex_buffer;
+static SemaphoreHandle_t record_mutex = NULL;
+// Full record write over I2C, the phone has to stay in the field for all of it
+static const int32_t write_latency_bounds_ms[] = {10, 25, 50, 100, 250, 500, 1000, 2000};
+// GPO edge to the start of the write: interrupt, wake-up and clock ramp, task switch and the record lock
+static const int32_t wake_latency_bounds_us[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000};
+static metric_t *taps_metric = NULL;
+static metric_t *write_latency_metric = NULL;
+static metric_t *wake_latency_metric = NULL;
+static metric_t *write_errors_metric = NULL;
+static metric_t *tokens_metric = NULL;
+
+// Record on the tag and the one being built, swapped on every refresh. Both keep their capacity, so refreshing
+// never allocates; a short record (SR) holds at most 255 payload bytes behind its 5 header bytes.
+#define NFC_RECORD_MAX_LEN (5 + 255)
+// URI identifier code for "https://" (NFC Forum RTD-URI)
+#define NDEF_URI_PREFIX_HTTPS 0x04
+static std::vector<uint8_t> spare_record;
+static std::vector<uint8_t> record;
+// Token in the record on the tag, journaled when a phone reads it
+static char record_token[HMAC_TOKEN_MAX_LEN];
+
+// Single short NDEF URI record (NFC Forum RTD-URI), the same bytes espp::Ndef::make_uri(uri, HTTPS).serialize() gives
+static bool build_uri_record(std::vector<uint8_t> &out, const char *uri)
 {
-    ESP_LOGI(TAG, "Configuring I2C for NFC...");
-
-    // Configure I2C with ESP-IDF directly
-    i2c_config_t i2c_config = {
-        .mode = I2C_MODE_MASTER,
-        .sda_io_num = NFC_SDA_GPIO,
-        .scl_io_num = NFC_SCL_GPIO,
-        .sda_pullup_en = GPIO_PULLUP_ENABLE,
-        .scl_pullup_en = GPIO_PULLUP_ENABLE,
-        .master = {
-            .clk_speed = 100000, // Two-wire I2C serial interface supports 1 MHz protocol (mentioned in datasheet)
-        }};
-
-    esp_err_t err = i2c_param_config(I2C_NUM_1, &i2c_config);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "i2c_param_config failed: %s", esp_err_to_name(err));
-        return;
-    }
-
-    err = i2c_driver_install(I2C_NUM_1, I2C_MODE_MASTER, 0, 0, 0);
-    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
-    {
-        ESP_LOGE(TAG, "i2c_driver_install failed: %s", esp_err_to_name(err));
-        return;
-    }
-
-    ESP_LOGI(TAG, "I2C configured successfully for NFC");
+    size_t uri_len = strlen(uri);
+    if (uri_len + 1 > 255)
+        return false;
+
+    out.clear();
+    out.push_back(0xD1); // MB | ME | SR, TNF well-known
+    out.push_back(1);    // Type length
+    out.push_back(static_cast<uint8_t>(uri_len + 1));
+    out.push_back('U');
+    out.push_back(NDEF_URI_PREFIX_HTTPS);
+    out.insert(out.end(), uri, uri + uri_len);
+    return true;
 }
 
 void generate_nfc_url(TimerHandle_t xTimer)
 {
-    // Ensure system time has been synchronized at least once and
-    // NFC and HMAC generator are initialized
-    if (!is_time_valid() || !global_st25dv || !global_hmac_generator)
+    // The timer only runs once the time is valid, so only the NFC and HMAC generator need checking
+    if (!tag_ready || !global_hmac_generator)
     {
         ESP_LOGW(TAG, "URL Generate skipped - not ready");
         return;
     }
 
-    std::error_code ec;
-    static char url_buffer[512];
+    static char url_buffer[256];
+
+    trace_span_begin("nfc_url");
+    ALLOC_TRACE_STEADY_BEGIN();
 
     // Generate fresh token for attendance
-    std::string token = global_hmac_generator->generateToken(1); // accessMethod = 1 for NFC
+    char token[HMAC_TOKEN_MAX_LEN];
+    global_hmac_generator->generateToken(token, sizeof(token), 1); // accessMethod = 1 for NFC
+    metrics_inc(tokens_metric);
 
     // Create URL with token
     snprintf(url_buffer, sizeof(url_buffer),
              "webapp--rig-attendance-app.asia-east1.hosted.app/scan?%s",
-             token.c_str());
+             token);
+
+    // Create NDEF records, built outside the lock and swapped in
+    if (build_uri_record(spare_record, url_buffer))
+    {
+        xSemaphoreTake(record_mutex, portMAX_DELAY);
+        record.swap(spare_record);
+        memcpy(record_token, token, sizeof(record_token));
+        xSemaphoreGive(record_mutex);
+    }
+    else
+        ESP_LOGE(TAG, "URL too long for a short NDEF record");
 
-    // Create NDEF records
-    record = espp::Ndef::make_uri(url_buffer, espp::Ndef::Uic::HTTPS).serialize();
+    ALLOC_TRACE_STEADY_END();
+    trace_span_end("nfc_url");
 }
 
 void gpo_event_task(void *pvParameters)
 {
-    uint32_t gpio_num;
-    ESP_LOGI(TAG2, "Task started - waiting for phone detection");
+    int64_t edge_us;
     static TickType_t last_event_tick = 0;
 
+    // Without a valid time there is no token to put on the tag, start refreshing the moment there is one
+    ESP_LOGI(TAG2, "Task started - waiting for valid time");
+    system_ready_wait(SYSTEM_READY_TIME_VALID, true, portMAX_DELAY);
+
+    generate_nfc_url(nfc_timer);
+    if (xTimerStart(nfc_timer, portMAX_DELAY) == pdPASS)
+        ESP_LOGI(TAG, "Periodic Update Timer Started (%ds Interval)", NFC_UPDATE_INTERVAL_MS / 1000);
+
+    // Taps seen while waiting would only write a stale record
+    xQueueReset(gpo_evt_queue);
+    system_ready_set(SYSTEM_READY_NFC);
+
+    ESP_LOGI(TAG2, "Waiting for phone detection");
+
     while (1)
     {
-        if (xQueueReceive(gpo_evt_queue, &gpio_num, portMAX_DELAY) == pdTRUE)
+        if (xQueueReceive(gpo_evt_queue, &edge_us, portMAX_DELAY) == pdTRUE)
         {
             TickType_t now = xTaskGetTickCount();
 
@@ -124,65 +141,70 @@ void gpo_event_task(void *pvParameters)
                 continue;
 
             last_event_tick = now;
+            ALLOC_TRACE_STEADY_BEGIN();
+            metrics_inc(taps_metric);
 
-            ESP_LOGI(TAG2, "Phone detected! Writing to EEPROM now...");
+            // The phone is in the field right now, the log line must not hold up the write
+            FASTLOG_I(TAG2, "Phone detected! Writing to EEPROM now...");
 
             std::error_code ec;
-            global_st25dv->set_record(record, ec);
+            xSemaphoreTake(record_mutex, portMAX_DELAY);
+            int64_t write_started_us = esp_timer_get_time();
+            metrics_observe(wake_latency_metric, (int32_t)(write_started_us - edge_us));
+            trace_span_begin("nfc_write");
+            // The driver builds the tag image in a vector of its own
+            ALLOC_TRACE_EXEMPT_BEGIN();
+            nfc_tag_write_record(record, ec);
+            ALLOC_TRACE_EXEMPT_END();
+            trace_span_end("nfc_write");
+            int write_ms = (int)((esp_timer_get_time() - write_started_us) / 1000);
+            if (!ec)
+            {
+                journal_record_token(1, record_token, write_ms);
+                boot_kpi_reached(BOOT_KPI_FIRST_TAP);
+            }
+            xSemaphoreGive(record_mutex);
+            metrics_observe(write_latency_metric, write_ms);
+            ALLOC_TRACE_STEADY_END();
+
             if (ec)
+            {
+                metrics_inc(write_errors_metric);
                 ESP_LOGE(TAG2, "Failed to write EEPROM record: %s", ec.message().c_str());
+            }
             else
-                ESP_LOGI(TAG2, "EEPROM record written successfully");
+                FASTLOG_I(TAG2, "EEPROM record written in %d ms", write_ms);
         }
     }
 }
 
 // Task to initialize NFC and start timers
-void start_nfc_task(HMACTokenGenerator *hmac_generator)
+void start_nfc_task(HMACTokenGenerator *hmac_generator, const task_config_t *task)
 {
     ESP_LOGI(TAG, "Starting NFC task...");
 
-    // Initialize I2C for NFC
-    configure_i2c_nfc();
-
-    // Create write/read functions for espp::St25dv using native ESP-IDF
-    auto write_fn = [](uint8_t device_address, const uint8_t *data, size_t length) -> bool
-    {
-        esp_err_t ret = i2c_master_write_to_device(I2C_NUM_1, device_address, data, length, pdMS_TO_TICKS(500));
-        if (ret != ESP_OK)
-        {
-            ESP_LOGW("NFC", "Write failed to 0x%02X: %s", device_address, esp_err_to_name(ret));
-            return false;
-        }
-        return true;
-    };
-
-    auto read_fn = [](uint8_t device_address, uint8_t *data, size_t length) -> bool
-    {
-        esp_err_t ret = i2c_master_read_from_device(I2C_NUM_1, device_address, data, length, pdMS_TO_TICKS(500));
-        if (ret != ESP_OK)
-        {
-            ESP_LOGW("NFC", "Read failed from 0x%02X: %s", device_address, esp_err_to_name(ret));
-            return false;
-        }
-        return true;
-    };
-
-    // Create St25dv configuration
-    espp::St25dv::Config st25dv_config;
-    st25dv_config.write = write_fn;
-    st25dv_config.read = read_fn;
-    st25dv_config.log_level = espp::Logger::Verbosity::INFO; // More verbose logging
-
-    // Initialize St25dv
-    static espp::St25dv st25dv(st25dv_config);
-    global_st25dv = &st25dv;
+    // I2C and the tag driver, or the in-memory tag of the simulation build
+    tag_ready = nfc_tag_init();
 
     // Initialize Global HMAC generator to passed parameter
     global_hmac_generator = hmac_generator;
 
+    record.reserve(NFC_RECORD_MAX_LEN);
+    spare_record.reserve(NFC_RECORD_MAX_LEN);
+    build_uri_record(record, "webapp--rig-attendance-app.asia-east1.hosted.app");
+
+    taps_metric = metrics_counter("nfc_taps_total", "Phone taps that triggered a tag write");
+    write_latency_metric = metrics_histogram("nfc_write_duration_ms", "Time to write the record to the tag",
+                                             write_latency_bounds_ms, sizeof(write_latency_bounds_ms) / sizeof(write_latency_bounds_ms[0]));
+    wake_latency_metric = metrics_histogram("nfc_gpo_to_write_us", "Time from the GPO edge to the start of the tag write",
+                                            wake_latency_bounds_us, sizeof(wake_latency_bounds_us) / sizeof(wake_latency_bounds_us[0]));
+    write_errors_metric = metrics_counter("nfc_write_errors_total", "Tag writes that failed");
+    tokens_metric = metrics_counter("nfc_tokens_total", "Tokens generated for the tag");
+
     // Create queue for GPO events (RF field detection)
-    gpo_evt_queue = xQueueCreate(10, sizeof(uint32_t));
+    static StaticQueue_t gpo_evt_queue_buffer;
+    static uint8_t gpo_evt_queue_storage[10 * sizeof(int64_t)];
+    gpo_evt_queue = xQueueCreateStatic(10, sizeof(int64_t), gpo_evt_queue_storage, &gpo_evt_queue_buffer);
     if (gpo_evt_queue == NULL)
     {
         ESP_LOGE(TAG, "Failed to create GPO event queue");
@@ -190,7 +212,7 @@ void start_nfc_task(HMACTokenGenerator *hmac_generator)
     }
 
     // Configure GPO interrupt for RF field detection
-    if (nfc_gpio_init() == ESP_OK)
+    if (nfc_tag_gpo_init(gpo_evt_queue) == ESP_OK)
         ESP_LOGI(TAG2, "GPO interrupt configured on GPIO %d", NFC_GPO_GPIO);
     else
     {
@@ -198,9 +220,27 @@ void start_nfc_task(HMACTokenGenerator *hmac_generator)
         return;
     }
 
+    record_mutex = xSemaphoreCreateMutexStatic(&record_mutex_buffer);
+
+    // Create timer for periodic updates every 5 seconds, started by the GPO task once the time is valid
+    static StaticTimer_t nfc_timer_buffer;
+    nfc_timer = xTimerCreateStatic(
+        "generate_nfc_url_timer",
+        pdMS_TO_TICKS(NFC_UPDATE_INTERVAL_MS), // 5 seconds
+        pdTRUE,                                // Auto-reload
+        (void *)0,                             // Timer ID
+        generate_nfc_url,                      // Callback function
+        &nfc_timer_buffer);
+
+    if (nfc_timer == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create NFC update timer");
+        return;
+    }
+
     // Create GPO event task for immediate RF field response
     TaskHandle_t gpo_task_handle = NULL;
-    BaseType_t task_created = xTaskCreate(gpo_event_task, "gpo_event_task", 4096, NULL, 5, &gpo_task_handle);
+    BaseType_t task_created = task_config_create(gpo_event_task, NULL, task, &gpo_task_handle);
 
     if (task_created == pdPASS)
         ESP_LOGI(TAG2, "GPO Event Task Created");
@@ -209,21 +249,4 @@ void start_nfc_task(HMACTokenGenerator *hmac_generator)
         ESP_LOGE(TAG2, "Failed to create GPO Event Task");
         return;
     }
-
-    // Create timer for periodic updates every 5 seconds
-    TimerHandle_t nfc_timer = xTimerCreate(
-        "generate_nfc_url_timer",
-        pdMS_TO_TICKS(NFC_UPDATE_INTERVAL_MS), // 5 seconds
-        pdTRUE,                                // Auto-reload
-        (void *)0,                             // Timer ID
-        generate_nfc_url                       // Callback function
-    );
-
-    if (nfc_timer != NULL)
-    {
-        xTimerStart(nfc_timer, 0);
-        ESP_LOGI(TAG, "Periodic Update Timer Started (%ds Interval)", NFC_UPDATE_INTERVAL_MS / 1000);
-    }
-    else
-        ESP_LOGE(TAG, "Failed to create NFC update timer");
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+/*
+    Everything nfc.cpp needs from the tag: one record write, and one queue entry per RF field the GPO line
+    reports. nfc_tag_st25dv.cpp drives the ST25DV over I2C, nfc_tag_linux.cpp is the in-memory model the
+    simulation build runs against.
+*/
+
+// Bring up the bus and the tag, false if the tag can't be used
+bool nfc_tag_init(void);
+
+// Replace the NDEF message on the tag, ec is set if the write failed
+void nfc_tag_write_record(const std::vector<uint8_t> &record, std::error_code &ec);
+
+// Post the time of every rising edge of the GPO line (esp_timer_get_time(), int64_t) to queue, i.e. every time a
+// phone enters the field; the line also wakes the chip from light sleep
+esp_err_t nfc_tag_gpo_init(QueueHandle_t queue);
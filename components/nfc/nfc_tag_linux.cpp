@@ -0,0 +1,152 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "nfc.h"
+#include "nfc_sim.h"
+#include "nfc_tag.h"
+
+static const char *TAG = "NFC-SIM";
+
+static QueueHandle_t gpo_queue = NULL;
+
+// EEPROM contents and when they last changed, the tap path writes them and the listener reads them
+static StaticSemaphore_t eeprom_mutex_buffer;
+static SemaphoreHandle_t eeprom_mutex = NULL;
+static uint8_t eeprom[NFC_SIM_EEPROM_SIZE];
+static size_t record_len = 0;
+static int64_t written_us = 0;
+
+// Given on every completed write, taken by the tap waiting for it
+static StaticSemaphore_t written_buffer;
+static SemaphoreHandle_t written = NULL;
+
+bool nfc_tag_init(void)
+{
+    eeprom_mutex = xSemaphoreCreateMutexStatic(&eeprom_mutex_buffer);
+    written = xSemaphoreCreateBinaryStatic(&written_buffer);
+    ESP_LOGI(TAG, "Simulated ST25DV, %d bytes of EEPROM", NFC_SIM_EEPROM_SIZE);
+    return true;
+}
+
+esp_err_t nfc_tag_gpo_init(QueueHandle_t queue)
+{
+    gpo_queue = queue;
+    return ESP_OK;
+}
+
+void nfc_tag_write_record(const std::vector<uint8_t> &record, std::error_code &ec)
+{
+    // The record goes out wrapped in its NDEF TLV: type and length in front, the terminator TLV behind
+    size_t image_len = 2 + record.size() + 1;
+    if (image_len > sizeof(eeprom))
+    {
+        ec = std::make_error_code(std::errc::no_buffer_space);
+        return;
+    }
+
+    // As long as the real tag would take, so the tap path is measured with the same critical section
+    uint32_t bus_ms = (uint32_t)(image_len * 9 * 1000 / NFC_SIM_I2C_HZ);
+    uint32_t program_ms = (uint32_t)((image_len + NFC_SIM_EEPROM_ROW_BYTES - 1) / NFC_SIM_EEPROM_ROW_BYTES) * NFC_SIM_EEPROM_WRITE_MS;
+    vTaskDelay(pdMS_TO_TICKS(bus_ms + program_ms));
+
+    xSemaphoreTake(eeprom_mutex, portMAX_DELAY);
+    memcpy(eeprom, record.data(), record.size());
+    record_len = record.size();
+    written_us = esp_timer_get_time();
+    xSemaphoreGive(eeprom_mutex);
+
+    xSemaphoreGive(written);
+}
+
+bool nfc_sim_tap(uint32_t timeout_ms, uint32_t *latency_us)
+{
+    if (gpo_queue == NULL)
+        return false;
+
+    // A write that finished after an earlier tap gave up waiting must not be taken for this one
+    xSemaphoreTake(written, 0);
+
+    int64_t edge_us = esp_timer_get_time();
+    if (xQueueSend(gpo_queue, &edge_us, 0) != pdTRUE)
+        return false;
+    if (xSemaphoreTake(written, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+        return false;
+
+    xSemaphoreTake(eeprom_mutex, portMAX_DELAY);
+    *latency_us = (uint32_t)(written_us - edge_us);
+    xSemaphoreGive(eeprom_mutex);
+    return true;
+}
+
+size_t nfc_sim_read_record(uint8_t *buffer, size_t size)
+{
+    xSemaphoreTake(eeprom_mutex, portMAX_DELAY);
+    size_t len = record_len < size ? record_len : size;
+    memcpy(buffer, eeprom, len);
+    xSemaphoreGive(eeprom_mutex);
+    return len;
+}
+
+// Stands in for the GPO wire: one datagram per field detected, answered once the tap path is done with it
+static void gpo_listener_task(void *pvParameters)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NFC_SIM_GPO_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ESP_LOGE(TAG, "Unable to bind the GPO port %d: errno %d", NFC_SIM_GPO_PORT, errno);
+        if (sock >= 0)
+            close(sock);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "GPO line on udp://127.0.0.1:%d", NFC_SIM_GPO_PORT);
+
+    while (1)
+    {
+        char request[16];
+        uint8_t reply[NFC_SIM_EEPROM_SIZE];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(sock, request, sizeof(request) - 1, 0, (struct sockaddr *)&from, &from_len);
+        if (len < 0)
+            continue;
+        request[len] = '\0';
+
+        int reply_len = 0;
+        if (strncmp(request, "tap", 3) == 0)
+        {
+            uint32_t latency_us;
+            if (nfc_sim_tap(NFC_SIM_TAP_TIMEOUT_MS, &latency_us))
+                reply_len = snprintf((char *)reply, sizeof(reply), "written %u %u",
+                                     (unsigned)latency_us, (unsigned)record_len);
+            else
+                reply_len = snprintf((char *)reply, sizeof(reply), "ignored");
+        }
+        else if (strncmp(request, "read", 4) == 0)
+            reply_len = (int)nfc_sim_read_record(reply, sizeof(reply));
+        else
+            continue;
+
+        sendto(sock, reply, reply_len, 0, (struct sockaddr *)&from, from_len);
+    }
+}
+
+void nfc_sim_start(const task_config_t *task)
+{
+    task_config_create(gpo_listener_task, NULL, task, NULL);
+}
@@ -0,0 +1,151 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "driver/i2c.h"
+#include "driver/gpio.h"
+
+#include "nfc.h"
+#include "nfc_tag.h"
+#include "st25dv.hpp"
+#include "power.h"
+
+static const char *TAG = "NFC";
+
+static espp::St25dv *st25dv = nullptr;
+static QueueHandle_t gpo_queue = NULL;
+// Armed for the rising level that means a field, otherwise waiting for the line to drop again
+static bool gpo_armed = false;
+
+/*
+    Only a level can wake the chip from light sleep, an edge can't, so the interrupt is level-triggered and
+    flipped on every change: a rising edge is reported when the high level fires, and the low level re-arms
+    it. The wake-up source follows the same setting.
+*/
+static void nfc_gpo_isr(void *arg)
+{
+    if (gpo_armed)
+    {
+        int64_t edge_us = esp_timer_get_time();
+        BaseType_t woken = pdFALSE;
+        xQueueSendFromISR(gpo_queue, &edge_us, &woken);
+        gpio_set_intr_type(gpio_num_t(NFC_GPO_GPIO), GPIO_INTR_LOW_LEVEL);
+        gpo_armed = false;
+        // Switch to the tap task now, with tickless idle the next tick may be a long way off
+        portYIELD_FROM_ISR(woken);
+    }
+    else
+    {
+        gpio_set_intr_type(gpio_num_t(NFC_GPO_GPIO), GPIO_INTR_HIGH_LEVEL);
+        gpo_armed = true;
+    }
+}
+
+esp_err_t nfc_tag_gpo_init(QueueHandle_t queue)
+{
+    gpo_queue = queue;
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << NFC_GPO_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+
+    gpio_config(&io_conf);
+
+    // Rising edge = field detected; a line that is already high has to drop first, as it would for an edge
+    gpo_armed = gpio_get_level(gpio_num_t(NFC_GPO_GPIO)) == 0;
+    gpio_int_type_t level = gpo_armed ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL;
+    gpio_set_intr_type(gpio_num_t(NFC_GPO_GPIO), level);
+#if CONFIG_PM_ENABLE
+    gpio_wakeup_enable(gpio_num_t(NFC_GPO_GPIO), level);
+    esp_sleep_enable_gpio_wakeup();
+#endif
+
+    gpio_install_isr_service(0); // Default ISR service
+    gpio_isr_handler_add(gpio_num_t(NFC_GPO_GPIO), nfc_gpo_isr, NULL);
+
+    return ESP_OK;
+}
+
+static bool configure_i2c_nfc(void)
+{
+    ESP_LOGI(TAG, "Configuring I2C for NFC...");
+
+    // Configure I2C with ESP-IDF directly
+    i2c_config_t i2c_config = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = NFC_SDA_GPIO,
+        .scl_io_num = NFC_SCL_GPIO,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master = {
+            .clk_speed = 100000, // Two-wire I2C serial interface supports 1 MHz protocol (mentioned in datasheet)
+        }};
+
+    esp_err_t err = i2c_param_config(I2C_NUM_1, &i2c_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "i2c_param_config failed: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    err = i2c_driver_install(I2C_NUM_1, I2C_MODE_MASTER, 0, 0, 0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+    {
+        ESP_LOGE(TAG, "i2c_driver_install failed: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "I2C configured successfully for NFC");
+    return true;
+}
+
+bool nfc_tag_init(void)
+{
+    // The driver is created regardless, like before; a bus that failed to come up shows in the write errors
+    configure_i2c_nfc();
+
+    // Create write/read functions for espp::St25dv using native ESP-IDF
+    auto write_fn = [](uint8_t device_address, const uint8_t *data, size_t length) -> bool
+    {
+        esp_err_t ret = i2c_master_write_to_device(I2C_NUM_1, device_address, data, length, pdMS_TO_TICKS(500));
+        if (ret != ESP_OK)
+        {
+            ESP_LOGW("NFC", "Write failed to 0x%02X: %s", device_address, esp_err_to_name(ret));
+            return false;
+        }
+        return true;
+    };
+
+    auto read_fn = [](uint8_t device_address, uint8_t *data, size_t length) -> bool
+    {
+        esp_err_t ret = i2c_master_read_from_device(I2C_NUM_1, device_address, data, length, pdMS_TO_TICKS(500));
+        if (ret != ESP_OK)
+        {
+            ESP_LOGW("NFC", "Read failed from 0x%02X: %s", device_address, esp_err_to_name(ret));
+            return false;
+        }
+        return true;
+    };
+
+    // Create St25dv configuration
+    espp::St25dv::Config st25dv_config;
+    st25dv_config.write = write_fn;
+    st25dv_config.read = read_fn;
+    st25dv_config.log_level = espp::Logger::Verbosity::INFO; // More verbose logging
+
+    // Initialize St25dv
+    static espp::St25dv tag(st25dv_config);
+    st25dv = &tag;
+    return true;
+}
+
+void nfc_tag_write_record(const std::vector<uint8_t> &record, std::error_code &ec)
+{
+    // The phone is in the field for the whole burst, run it at full clock
+    power_hold(POWER_LOCK_I2C);
+    st25dv->set_record(record, ec);
+    power_release(POWER_LOCK_I2C);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+
+// Dynamic frequency scaling range: the CPU idles at the bottom and is raised to the top only while a lock is held
+#define POWER_MAX_FREQ_MHZ 160
+// XTAL, only reached before WiFi starts: with the SoftAP up the WiFi driver holds the APB clock at its maximum, so
+// the CPU idles at 80 MHz
+#define POWER_MIN_FREQ_MHZ 40
+// Light sleep whenever no task is due for a while, needs CONFIG_FREERTOS_USE_TICKLESS_IDLE. Off: the SoftAP runs for
+// as long as the device does, and while it's up the WiFi driver keeps the radio awake and never lets the chip sleep.
+// Only for a build without the SoftAP.
+#define POWER_LIGHT_SLEEP 0
+
+/*
+    Power management: with CONFIG_PM_ENABLE the clock is scaled down between bursts of work, as far as
+    the SoftAP lets it, and the few places that need the full clock hold it with power_hold()/power_release(). How long
+    each lock was held is counted on /metrics on every target; the time spent in each power state comes
+    from esp_pm's own profiling (CONFIG_PM_PROFILING) and is served on GET /power.
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        POWER_LOCK_HMAC, // Token HMAC
+        POWER_LOCK_I2C,  // Record write to the tag, the phone waits for it
+        POWER_LOCK_HTTP, // Portal page send
+        POWER_LOCK_MAX,
+    } power_lock_t;
+
+    /**
+     * @brief Create the locks and configure frequency scaling and light sleep, before any power_hold()
+     */
+    void power_init(void);
+
+    /**
+     * @brief Hold the CPU at POWER_MAX_FREQ_MHZ and out of light sleep until the matching power_release()
+     *
+     * Holds nest and may come from any task, cheap enough for the tap and page paths. Not from an ISR.
+     */
+    void power_hold(power_lock_t lock);
+
+    /**
+     * @brief Drop a hold taken with power_hold()
+     */
+    void power_release(power_lock_t lock);
+
+    /**
+     * @brief Write the lock hold times followed by esp_pm's lock and power state statistics, if profiling is on
+     * @return Length written, without the terminator; the text is cut short if it does not fit
+     */
+    size_t power_format(char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
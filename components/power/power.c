@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+#include "power.h"
+#include "metrics.h"
+
+// esp_pm refuses light sleep without tickless idle, the clock is still scaled then
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+#define LIGHT_SLEEP POWER_LIGHT_SLEEP
+#else
+#define LIGHT_SLEEP 0
+#endif
+
+static const char *TAG = "power";
+
+typedef struct
+{
+    int holders;        // Holds across all tasks, timed from the first hold to the last release
+    int64_t since_us;
+    uint64_t held_us;
+    uint32_t carry_us;  // Held time below 1 ms not added to the counter yet
+    metric_t *held_metric;
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t pm_lock;
+#endif
+} power_lock_state_t;
+
+// Names in the esp_pm dump and on GET /power
+static const char *const lock_names[POWER_LOCK_MAX] = {"hmac", "i2c", "http"};
+static const char *const lock_metric_names[POWER_LOCK_MAX] = {
+    "power_hmac_held_ms_total",
+    "power_i2c_held_ms_total",
+    "power_http_held_ms_total",
+};
+
+static power_lock_state_t locks[POWER_LOCK_MAX];
+static portMUX_TYPE locks_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void power_init(void)
+{
+    for (int i = 0; i < POWER_LOCK_MAX; i++)
+        locks[i].held_metric = metrics_counter(lock_metric_names[i], "Time the CPU was held at full clock for this work");
+
+#if CONFIG_PM_ENABLE
+    for (int i = 0; i < POWER_LOCK_MAX; i++)
+    {
+        esp_err_t err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, lock_names[i], &locks[i].pm_lock);
+        if (err != ESP_OK)
+            ESP_LOGE(TAG, "Failed to create the %s lock: %s", lock_names[i], esp_err_to_name(err));
+    }
+
+    esp_pm_config_t config = {
+        .max_freq_mhz = POWER_MAX_FREQ_MHZ,
+        .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+        .light_sleep_enable = LIGHT_SLEEP,
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Power management not configured, running at full clock: %s", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "CPU at %d-%d MHz, light sleep %s", POWER_MIN_FREQ_MHZ, POWER_MAX_FREQ_MHZ, LIGHT_SLEEP ? "on" : "off");
+#else
+    ESP_LOGI(TAG, "CONFIG_PM_ENABLE is off, running at full clock");
+#endif
+}
+
+void power_hold(power_lock_t lock)
+{
+    power_lock_state_t *state = &locks[lock];
+
+#if CONFIG_PM_ENABLE
+    // Returns with the clock raised, a NULL lock (power_init() not run yet) is refused and the clock stays as it is
+    esp_pm_lock_acquire(state->pm_lock);
+#endif
+
+    int64_t now_us = esp_timer_get_time();
+    taskENTER_CRITICAL(&locks_lock);
+    if (state->holders++ == 0)
+        state->since_us = now_us;
+    taskEXIT_CRITICAL(&locks_lock);
+}
+
+void power_release(power_lock_t lock)
+{
+    power_lock_state_t *state = &locks[lock];
+    uint32_t held_ms = 0;
+
+    int64_t now_us = esp_timer_get_time();
+    taskENTER_CRITICAL(&locks_lock);
+    if (state->holders > 0 && --state->holders == 0)
+    {
+        uint32_t held_us = (uint32_t)(now_us - state->since_us);
+        state->held_us += held_us;
+        state->carry_us += held_us;
+        held_ms = state->carry_us / 1000;
+        state->carry_us %= 1000;
+    }
+    taskEXIT_CRITICAL(&locks_lock);
+
+    if (held_ms > 0)
+        metrics_add(state->held_metric, held_ms);
+
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(state->pm_lock);
+#endif
+}
+
+size_t power_format(char *buf, size_t size)
+{
+    size_t used = 0;
+
+#define APPEND(...)                                                       \
+    do                                                                    \
+    {                                                                     \
+        int len = snprintf(buf + used, size - used, __VA_ARGS__);         \
+        if (len < 0 || (size_t)len >= size - used)                        \
+            return used;                                                  \
+        used += len;                                                      \
+    } while (0)
+
+    if (size == 0)
+        return 0;
+    buf[0] = '\0';
+
+    uint64_t held_us[POWER_LOCK_MAX];
+    taskENTER_CRITICAL(&locks_lock);
+    for (int i = 0; i < POWER_LOCK_MAX; i++)
+        held_us[i] = locks[i].held_us;
+    taskEXIT_CRITICAL(&locks_lock);
+
+    APPEND("# lock held_us\n");
+    for (int i = 0; i < POWER_LOCK_MAX; i++)
+        APPEND("%s %" PRIu64 "\n", lock_names[i], held_us[i]);
+    APPEND("# uptime_us %" PRId64 "\n", esp_timer_get_time());
+
+#undef APPEND
+
+#if CONFIG_PM_PROFILING
+    // esp_pm only prints its statistics to a stream: per lock the times taken and held, per power mode the time spent in it
+    FILE *out = fmemopen(buf + used, size - used, "w");
+    if (out != NULL)
+    {
+        esp_pm_dump_locks(out);
+        fflush(out);
+        long len = ftell(out);
+        fclose(out);
+        if (len > 0)
+            used += (size_t)len < size - used ? (size_t)len : size - used - 1;
+        buf[used] = '\0';
+    }
+#endif
+    return used;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of SoftAP clients tracked at once, least recently seen is evicted
+#define RATE_LIMITER_MAX_CLIENTS 16
+
+// Token bucket settings, shared by the DNS and HTTP paths
+#define RATE_LIMITER_BURST 20           // Requests a client may fire back-to-back
+#define RATE_LIMITER_REFILL_PER_SEC 5   // Sustained requests per second per client
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Per-client request counters
+     */
+    typedef struct rate_limiter_client_stats
+    {
+        uint32_t ip;      /**<! Client IPv4 address (network byte order) */
+        uint32_t served;  /**<! Requests admitted since the client was first seen */
+        uint32_t dropped; /**<! Requests rejected since the client was first seen */
+    } rate_limiter_client_stats_t;
+
+    /**
+     * @brief Take one token from the client's bucket
+     *
+     * @note SoftAP clients get exactly one DHCP lease per MAC, so the IPv4 address is used as the client key.
+     * This is cheap enough to call before any parsing or token generation.
+     *
+     * @param ip Client IPv4 address (network byte order)
+     * @return true if the request should be served, false if it should be dropped
+     */
+    bool rate_limiter_allow(uint32_t ip);
+
+    /**
+     * @brief Check whether a client is currently throttled, without taking a token
+     * @param ip Client IPv4 address (network byte order)
+     * @return true if the client's bucket is empty
+     */
+    bool rate_limiter_is_limited(uint32_t ip);
+
+    /**
+     * @brief Copy the counters of all tracked clients
+     * @param stats Output array
+     * @param max_entries Capacity of the output array
+     * @return Number of entries written
+     */
+    size_t rate_limiter_get_stats(rate_limiter_client_stats_t *stats, size_t max_entries);
+
+    /**
+     * @brief Log the served/dropped counters of all tracked clients
+     */
+    void rate_limiter_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
\ No newline at end of file
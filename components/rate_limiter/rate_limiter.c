@@ -0,0 +1,164 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif_ip_addr.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "rate_limiter.h"
+
+// Tokens are kept in thousandths so that the refill never rounds down to zero
+#define TOKEN_SCALE 1000
+#define BUCKET_CAPACITY (RATE_LIMITER_BURST * TOKEN_SCALE)
+
+static const char *TAG = "RateLimiter";
+
+typedef struct
+{
+    uint32_t ip;
+    int32_t tokens;
+    int64_t last_refill_us;
+    bool limited;
+    uint32_t served;
+    uint32_t dropped;
+} client_bucket_t;
+
+static client_bucket_t buckets[RATE_LIMITER_MAX_CLIENTS];
+static portMUX_TYPE buckets_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Find the client's bucket or recycle the least recently refilled one. Must hold buckets_lock.
+static client_bucket_t *get_bucket(uint32_t ip, int64_t now_us)
+{
+    client_bucket_t *oldest = &buckets[0];
+
+    for (int i = 0; i < RATE_LIMITER_MAX_CLIENTS; i++)
+    {
+        if (buckets[i].ip == ip && buckets[i].last_refill_us != 0)
+            return &buckets[i];
+
+        if (buckets[i].last_refill_us < oldest->last_refill_us)
+            oldest = &buckets[i];
+    }
+
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->ip = ip;
+    oldest->tokens = BUCKET_CAPACITY;
+    oldest->last_refill_us = now_us;
+    return oldest;
+}
+
+// Top up the bucket for the time elapsed since the last refill. Must hold buckets_lock.
+static void refill(client_bucket_t *bucket, int64_t now_us)
+{
+    int64_t added = (now_us - bucket->last_refill_us) * RATE_LIMITER_REFILL_PER_SEC * TOKEN_SCALE / 1000000;
+    if (added <= 0)
+        return;
+
+    int64_t tokens = bucket->tokens + added;
+    if (tokens >= BUCKET_CAPACITY)
+    {
+        bucket->tokens = BUCKET_CAPACITY;
+        bucket->last_refill_us = now_us;
+    }
+    else
+    {
+        // Only advance by the time actually converted, so back-to-back calls don't lose the remainder
+        bucket->tokens = (int32_t)tokens;
+        bucket->last_refill_us += added * 1000000 / (RATE_LIMITER_REFILL_PER_SEC * TOKEN_SCALE);
+    }
+}
+
+bool rate_limiter_allow(uint32_t ip)
+{
+    int64_t now_us = esp_timer_get_time();
+    bool allowed;
+    bool became_limited = false;
+    uint32_t served, dropped;
+
+    taskENTER_CRITICAL(&buckets_lock);
+    client_bucket_t *bucket = get_bucket(ip, now_us);
+    refill(bucket, now_us);
+
+    allowed = bucket->tokens >= TOKEN_SCALE;
+    if (allowed)
+    {
+        bucket->tokens -= TOKEN_SCALE;
+        bucket->served++;
+        bucket->limited = false;
+    }
+    else
+    {
+        bucket->dropped++;
+        became_limited = !bucket->limited;
+        bucket->limited = true;
+    }
+    served = bucket->served;
+    dropped = bucket->dropped;
+    taskEXIT_CRITICAL(&buckets_lock);
+
+    // Only log the start of a throttling episode, not every dropped packet
+    if (became_limited)
+    {
+        esp_ip4_addr_t addr = {.addr = ip};
+        ESP_LOGW(TAG, "Throttling client " IPSTR " (served: %" PRIu32 ", dropped: %" PRIu32 ")",
+                 IP2STR(&addr), served, dropped);
+    }
+
+    return allowed;
+}
+
+bool rate_limiter_is_limited(uint32_t ip)
+{
+    int64_t now_us = esp_timer_get_time();
+    bool limited = false;
+
+    taskENTER_CRITICAL(&buckets_lock);
+    for (int i = 0; i < RATE_LIMITER_MAX_CLIENTS; i++)
+    {
+        if (buckets[i].ip == ip && buckets[i].last_refill_us != 0)
+        {
+            refill(&buckets[i], now_us);
+            limited = buckets[i].tokens < TOKEN_SCALE;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&buckets_lock);
+
+    return limited;
+}
+
+size_t rate_limiter_get_stats(rate_limiter_client_stats_t *stats, size_t max_entries)
+{
+    size_t count = 0;
+
+    taskENTER_CRITICAL(&buckets_lock);
+    for (int i = 0; i < RATE_LIMITER_MAX_CLIENTS && count < max_entries; i++)
+    {
+        if (buckets[i].last_refill_us == 0)
+            continue;
+
+        stats[count].ip = buckets[i].ip;
+        stats[count].served = buckets[i].served;
+        stats[count].dropped = buckets[i].dropped;
+        count++;
+    }
+    taskEXIT_CRITICAL(&buckets_lock);
+
+    return count;
+}
+
+void rate_limiter_log_stats(void)
+{
+    rate_limiter_client_stats_t stats[RATE_LIMITER_MAX_CLIENTS];
+    size_t count = rate_limiter_get_stats(stats, RATE_LIMITER_MAX_CLIENTS);
+
+    ESP_LOGI(TAG, "%d client(s) tracked", (int)count);
+    for (size_t i = 0; i < count; i++)
+    {
+        esp_ip4_addr_t addr = {.addr = stats[i].ip};
+        ESP_LOGI(TAG, "  " IPSTR " | served: %" PRIu32 " | dropped: %" PRIu32,
+                 IP2STR(&addr), stats[i].served, stats[i].dropped);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+// Readiness bits, each one is set by the component that owns it and cleared when it goes away again
+#define SYSTEM_READY_STA_CONNECTED (1 << 0) // STA associated with the sync network
+#define SYSTEM_READY_STA_GOT_IP (1 << 1)    // STA has an address, the internet may be reachable
+#define SYSTEM_READY_TIME_VALID (1 << 2)    // Clock holds a usable time, provisional or synced
+#define SYSTEM_READY_TIME_SYNCED (1 << 3)   // Clock confirmed by SNTP since boot
+#define SYSTEM_READY_NFC (1 << 4)           // Tag is initialized and carries a tokenized link
+#define SYSTEM_READY_PORTAL (1 << 5)        // Captive portal is serving requests
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Create the shared event group, must be called before any other component starts
+     */
+    void system_ready_init(void);
+
+    /**
+     * @brief Publish readiness bits, waking every task waiting on them
+     */
+    void system_ready_set(EventBits_t bits);
+
+    /**
+     * @brief Withdraw readiness bits
+     */
+    void system_ready_clear(EventBits_t bits);
+
+    /**
+     * @brief Check readiness without blocking
+     * @return true if all of the given bits are set
+     */
+    bool system_ready_is_set(EventBits_t bits);
+
+    /**
+     * @brief Block until the given bits are set
+     * @param bits Bits to wait for
+     * @param wait_all Wait for all of them instead of any one
+     * @param timeout Longest wait, portMAX_DELAY to wait forever
+     * @return true if the condition was met before the timeout
+     */
+    bool system_ready_wait(EventBits_t bits, bool wait_all, TickType_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
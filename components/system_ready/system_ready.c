@@ -0,0 +1,32 @@
+#include "system_ready.h"
+
+// Statically allocated, so creating it can never fail
+static StaticEventGroup_t ready_group_buffer;
+static EventGroupHandle_t ready_group = NULL;
+
+void system_ready_init(void)
+{
+    if (ready_group == NULL)
+        ready_group = xEventGroupCreateStatic(&ready_group_buffer);
+}
+
+void system_ready_set(EventBits_t bits)
+{
+    xEventGroupSetBits(ready_group, bits);
+}
+
+void system_ready_clear(EventBits_t bits)
+{
+    xEventGroupClearBits(ready_group, bits);
+}
+
+bool system_ready_is_set(EventBits_t bits)
+{
+    return (xEventGroupGetBits(ready_group) & bits) == bits;
+}
+
+bool system_ready_wait(EventBits_t bits, bool wait_all, TickType_t timeout)
+{
+    EventBits_t set = xEventGroupWaitBits(ready_group, bits, pdFALSE, wait_all ? pdTRUE : pdFALSE, timeout);
+    return wait_all ? (set & bits) == bits : (set & bits) != 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Cores on the ESP32, WiFi and lwIP run on the PRO CPU
+#define TASK_CORE_PRO 0
+#define TASK_CORE_APP 1
+
+// Stack sizing build: every task gets TASK_CONFIG_PROFILE_STACK and the high-water marks are logged periodically
+#define TASK_CONFIG_PROFILE 0
+#define TASK_CONFIG_PROFILE_STACK 8192
+#define TASK_CONFIG_PROFILE_INTERVAL_MS 60000
+// Tasks the profiling build can report on
+#define TASK_CONFIG_MAX 12
+
+// Simulation build (IDF_TARGET linux): every task is a host thread, whose stack also holds glibc's frames
+#define TASK_CONFIG_LINUX_STACK 16384
+
+// Stack actually reserved for a task, the profiling build gives all of them the same
+#if TASK_CONFIG_PROFILE
+#define TASK_CONFIG_STACK_BYTES(stack_size) TASK_CONFIG_PROFILE_STACK
+#elif CONFIG_IDF_TARGET_LINUX
+#define TASK_CONFIG_STACK_BYTES(stack_size) ((stack_size) > TASK_CONFIG_LINUX_STACK ? (stack_size) : TASK_CONFIG_LINUX_STACK)
+#else
+#define TASK_CONFIG_STACK_BYTES(stack_size) (stack_size)
+#endif
+
+/*
+    Define a task_config_t together with a statically allocated stack and TCB, so creating the task never
+    touches the heap. Only for tasks created once, or never running twice at the same time.
+*/
+#define TASK_CONFIG_DEFINE(var, task_name, size, prio, cpu)       \
+    static StackType_t var##_stack[TASK_CONFIG_STACK_BYTES(size)];  \
+    static StaticTask_t var##_tcb;                                  \
+    static const task_config_t var = {                              \
+        .name = (task_name),                                        \
+        .stack_size = (size),                                       \
+        .priority = (prio),                                         \
+        .core = (cpu),                                              \
+        .stack = var##_stack,                                       \
+        .tcb = &var##_tcb,                                          \
+    }
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Where and how a task runs, the values for all tasks live in one table in main
+     */
+    typedef struct task_config
+    {
+        const char *name;    /**<! Task name, also used to find the task in profiling reports */
+        uint32_t stack_size; /**<! Stack in bytes, from the profiling build's high-water marks */
+        UBaseType_t priority;
+        BaseType_t core;     /**<! TASK_CORE_PRO, TASK_CORE_APP or tskNO_AFFINITY */
+        StackType_t *stack;  /**<! Static stack of TASK_CONFIG_STACK_BYTES(stack_size), NULL to allocate it */
+        StaticTask_t *tcb;   /**<! Static TCB, required with stack */
+    } task_config_t;
+
+    /**
+     * @brief Create a task pinned as configured, in the static buffers if the config has them
+     * @return pdPASS on success
+     */
+    BaseType_t task_config_create(TaskFunction_t function, void *arg, const task_config_t *config, TaskHandle_t *handle);
+
+    /**
+     * @brief Stack size to give a task created elsewhere, e.g. by httpd, and include it in profiling reports
+     */
+    uint32_t task_config_stack_size(const task_config_t *config);
+
+    /**
+     * @brief Core to give a task created elsewhere, folded onto the only core on single-core chips and the linux target
+     */
+    BaseType_t task_config_core(const task_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,101 @@
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "freertos/timers.h"
+
+#include "task_config.h"
+
+static const char *TAG = "TaskConfig";
+
+#if TASK_CONFIG_PROFILE
+static const task_config_t *profiled[TASK_CONFIG_MAX];
+static size_t num_profiled = 0;
+static portMUX_TYPE profiled_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskStatus_t task_status[TASK_CONFIG_MAX * 2];
+
+// Suggests the measured use plus a quarter and 512 bytes for paths the profiling run did not hit
+static void profile_report_cb(TimerHandle_t timer)
+{
+    UBaseType_t num_tasks = uxTaskGetSystemState(task_status, sizeof(task_status) / sizeof(task_status[0]), NULL);
+
+    for (size_t i = 0; i < num_profiled; i++)
+    {
+        for (UBaseType_t t = 0; t < num_tasks; t++)
+        {
+            if (strcmp(task_status[t].pcTaskName, profiled[i]->name) != 0)
+                continue;
+
+            uint32_t used = TASK_CONFIG_PROFILE_STACK - task_status[t].usStackHighWaterMark;
+            uint32_t suggested = (used + used / 4 + 512 + 255) & ~255u;
+            ESP_LOGI(TAG, "%s: %" PRIu32 " bytes of stack used, configured %" PRIu32 ", suggest %" PRIu32,
+                     profiled[i]->name, used, profiled[i]->stack_size, suggested);
+        }
+    }
+}
+
+static void profile_register(const task_config_t *config)
+{
+    static bool report_timer_claimed = false;
+
+    // The boot stages create tasks in parallel, whoever registers first creates the timer, outside the lock
+    taskENTER_CRITICAL(&profiled_lock);
+    if (num_profiled < TASK_CONFIG_MAX)
+        profiled[num_profiled++] = config;
+    bool create_timer = !report_timer_claimed;
+    report_timer_claimed = true;
+    taskEXIT_CRITICAL(&profiled_lock);
+
+    if (create_timer)
+    {
+        static StaticTimer_t report_timer_buffer;
+        TimerHandle_t report_timer = xTimerCreateStatic("task_profile", pdMS_TO_TICKS(TASK_CONFIG_PROFILE_INTERVAL_MS),
+                                                        pdTRUE, NULL, profile_report_cb, &report_timer_buffer);
+        if (report_timer != NULL)
+            xTimerStart(report_timer, 0);
+        ESP_LOGW(TAG, "Stack profiling build, all tasks get %d bytes", TASK_CONFIG_PROFILE_STACK);
+    }
+}
+#endif
+
+uint32_t task_config_stack_size(const task_config_t *config)
+{
+#if TASK_CONFIG_PROFILE
+    profile_register(config);
+    return TASK_CONFIG_PROFILE_STACK;
+#else
+    return TASK_CONFIG_STACK_BYTES(config->stack_size);
+#endif
+}
+
+BaseType_t task_config_core(const task_config_t *config)
+{
+#if CONFIG_FREERTOS_UNICORE || CONFIG_IDF_TARGET_LINUX
+    return config->core == tskNO_AFFINITY ? tskNO_AFFINITY : 0;
+#else
+    return config->core;
+#endif
+}
+
+BaseType_t task_config_create(TaskFunction_t function, void *arg, const task_config_t *config, TaskHandle_t *handle)
+{
+    BaseType_t created;
+    if (config->stack != NULL)
+    {
+        TaskHandle_t task = xTaskCreateStaticPinnedToCore(function, config->name, task_config_stack_size(config), arg,
+                                                          config->priority, config->stack, config->tcb,
+                                                          task_config_core(config));
+        if (handle != NULL)
+            *handle = task;
+        created = task != NULL ? pdPASS : pdFAIL;
+    }
+    else
+        created = xTaskCreatePinnedToCore(function, config->name, task_config_stack_size(config), arg,
+                                          config->priority, handle, task_config_core(config));
+
+    if (created != pdPASS)
+        ESP_LOGE(TAG, "Failed to create %s", config->name);
+    return created;
+}
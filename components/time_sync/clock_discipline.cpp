@@ -0,0 +1,184 @@
+#include <sys/time.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "clock_discipline.h"
+
+static const char *TAG = "ClockDiscipline";
+
+// Offsets above this mean the clock was stepped (first sync, long outage), not drift
+#define STEP_THRESHOLD_US (1000000LL)
+// Syncs closer together than this give too noisy a drift estimate
+#define MIN_DRIFT_BASELINE_S (60.0f)
+// Weight of a new measurement once a drift estimate exists
+#define DRIFT_GAIN (0.5f)
+#define WANDER_GAIN (0.25f)
+// Floor for the drift uncertainty, keeps the interval finite when two syncs agree perfectly
+#define MIN_WANDER_PPM (0.5f)
+
+static SemaphoreHandle_t discipline_mutex = NULL;
+
+static struct
+{
+    bool has_reference;     // At least one sync happened
+    bool has_drift;         // Drift has been measured across two syncs
+    int64_t last_sync_us;   // esp_timer time of the last sync
+    int64_t last_slew_us;   // esp_timer time the last correction covered up to
+    float drift_ppm;        // Correction rate, positive means the local clock runs slow
+    float wander_ppm;       // How far off the drift estimate has recently been
+    uint32_t sync_error_us; // Uncertainty right after the last sync
+    int64_t last_offset_us;
+    uint32_t sync_count;
+} state;
+
+void clock_discipline_init(void)
+{
+    static StaticSemaphore_t discipline_mutex_buffer;
+    if (discipline_mutex == NULL)
+        discipline_mutex = xSemaphoreCreateMutexStatic(&discipline_mutex_buffer);
+}
+
+void clock_discipline_on_sync(int64_t offset_us, uint32_t sync_error_us)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    xSemaphoreTake(discipline_mutex, portMAX_DELAY);
+
+    float elapsed_s = (now_us - state.last_sync_us) / 1e6f;
+
+    if (llabs(offset_us) > STEP_THRESHOLD_US || !state.has_reference)
+    {
+        ESP_LOGI(TAG, "Clock stepped by %" PRId64 " ms, drift estimate kept", offset_us / 1000);
+    }
+    else if (elapsed_s >= MIN_DRIFT_BASELINE_S)
+    {
+        // Whatever offset built up despite the correction tells how wrong the correction was
+        float residual_ppm = offset_us / elapsed_s;
+
+        if (!state.has_drift)
+        {
+            state.drift_ppm = residual_ppm;
+            state.wander_ppm = fabsf(residual_ppm);
+            state.has_drift = true;
+        }
+        else
+        {
+            state.drift_ppm += DRIFT_GAIN * residual_ppm;
+            state.wander_ppm += WANDER_GAIN * (fabsf(residual_ppm) - state.wander_ppm);
+        }
+
+        ESP_LOGI(TAG, "Offset %" PRId64 " us over %.0f s, drift %.2f ppm (+/- %.2f ppm)",
+                 offset_us, elapsed_s, state.drift_ppm, state.wander_ppm);
+    }
+    else
+    {
+        // Too close to the previous sync to learn anything, keep the older baseline
+        state.last_offset_us = offset_us;
+        state.sync_error_us = sync_error_us;
+        state.sync_count++;
+        xSemaphoreGive(discipline_mutex);
+        return;
+    }
+
+    state.has_reference = true;
+    state.last_sync_us = now_us;
+    state.last_slew_us = now_us;
+    state.last_offset_us = offset_us;
+    state.sync_error_us = sync_error_us;
+    state.sync_count++;
+
+    xSemaphoreGive(discipline_mutex);
+}
+
+void clock_discipline_tick(void)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    xSemaphoreTake(discipline_mutex, portMAX_DELAY);
+
+    if (!state.has_drift)
+    {
+        xSemaphoreGive(discipline_mutex);
+        return;
+    }
+
+    float elapsed_s = (now_us - state.last_slew_us) / 1e6f;
+    int64_t correction_us = (int64_t)(state.drift_ppm * elapsed_s);
+    state.last_slew_us = now_us;
+
+    xSemaphoreGive(discipline_mutex);
+
+    if (correction_us == 0)
+        return;
+
+    // adjtime slews gradually instead of stepping, so timestamps never jump backwards
+    struct timeval delta = {
+        .tv_sec = (time_t)(correction_us / 1000000),
+        .tv_usec = (suseconds_t)(correction_us % 1000000),
+    };
+    if (adjtime(&delta, NULL) != 0)
+        ESP_LOGW(TAG, "adjtime(%" PRId64 " us) rejected", correction_us);
+}
+
+// Estimated error now, must hold discipline_mutex
+static float estimated_error_us(int64_t now_us)
+{
+    if (!state.has_reference)
+        return INFINITY;
+
+    float rate_ppm = state.has_drift ? fmaxf(state.wander_ppm, MIN_WANDER_PPM) : TIME_SYNC_DEFAULT_DRIFT_PPM;
+    return state.sync_error_us + rate_ppm * ((now_us - state.last_sync_us) / 1e6f);
+}
+
+uint32_t clock_discipline_next_interval_ms(void)
+{
+    const uint32_t min_ms = TIME_SYNC_INTERVAL_MINUTES * 60 * 1000;
+    const uint32_t max_ms = TIME_SYNC_MAX_INTERVAL_MINUTES * 60 * 1000;
+
+    xSemaphoreTake(discipline_mutex, portMAX_DELAY);
+
+    // Until the drift is known, keep syncing at the base rate to measure it
+    if (!state.has_drift)
+    {
+        xSemaphoreGive(discipline_mutex);
+        return min_ms;
+    }
+
+    float budget_us = TIME_SYNC_MAX_ERROR_MS * 1000.0f - state.sync_error_us;
+    float rate_ppm = fmaxf(state.wander_ppm, MIN_WANDER_PPM);
+
+    xSemaphoreGive(discipline_mutex);
+
+    // ppm is microseconds of error per second, so budget / rate is the interval in seconds
+    float interval_ms = (budget_us / rate_ppm) * 1000.0f;
+    if (interval_ms < min_ms)
+        return min_ms;
+    if (interval_ms > max_ms)
+        return max_ms;
+    return (uint32_t)interval_ms;
+}
+
+void clock_discipline_get_status(time_sync_status_t *status)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    xSemaphoreTake(discipline_mutex, portMAX_DELAY);
+
+    float error_us = estimated_error_us(now_us);
+    status->synced = state.has_reference;
+    status->drift_known = state.has_drift;
+    status->drift_ppm = state.drift_ppm;
+    status->drift_uncertainty_ppm = state.wander_ppm;
+    status->est_error_ms = isinf(error_us) ? UINT32_MAX : (uint32_t)(error_us / 1000.0f);
+    status->last_offset_ms = (int32_t)(state.last_offset_us / 1000);
+    status->sync_count = state.sync_count;
+
+    xSemaphoreGive(discipline_mutex);
+}
\ No newline at end of file
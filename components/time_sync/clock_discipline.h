@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "time_sync.h"
+
+/**
+ * @brief Create the discipline state, must be called before anything else in this file
+ */
+void clock_discipline_init(void);
+
+/**
+ * @brief Feed the result of a successful sync, right after the system clock was set to server time
+ * @param offset_us Server time minus local time just before the clock was set
+ * @param sync_error_us Uncertainty of the server time itself (e.g. half the round trip)
+ */
+void clock_discipline_on_sync(int64_t offset_us, uint32_t sync_error_us);
+
+/**
+ * @brief Slew the clock by the drift accumulated since the last call, called every TIME_SYNC_SLEW_INTERVAL_SECONDS
+ */
+void clock_discipline_tick(void);
+
+/**
+ * @brief Time until the estimated error reaches TIME_SYNC_MAX_ERROR_MS, clamped to the configured interval range
+ * @return Delay until the next sync in milliseconds
+ */
+uint32_t clock_discipline_next_interval_ms(void);
+
+/**
+ * @brief Fill the drift and error fields of a status snapshot
+ */
+void clock_discipline_get_status(time_sync_status_t *status);
\ No newline at end of file
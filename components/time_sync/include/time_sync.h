@@ -3,12 +3,28 @@
 #include "esp_err.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
+#include "task_config.h"
+
 // Time sync settings
 #define TIME_SYNC_INTERVAL_MINUTES 10
 #define WIFI_CONNECT_TIMEOUT_SECONDS 30
-#define TIME_SYNC_TIMEOUT_SECONDS 30
+
+// SNTP client settings
+#define SNTP_QUERY_TIMEOUT_MS 3000  // Longest wait for the first server to answer
+#define SNTP_RETRY_MIN_SECONDS 15   // First retry after a failed sync, doubles up to TIME_SYNC_INTERVAL_MINUTES
+#define SNTP_FILTER_SAMPLES 8       // Samples kept per server for its best round trip statistic
+
+// Clock discipline settings
+#define TIME_SYNC_MAX_ERROR_MS 500          // Error bound for token timestamps, drives the adaptive sync interval
+#define TIME_SYNC_MAX_INTERVAL_MINUTES 360  // Upper limit of the adaptive sync interval
+#define TIME_SYNC_SLEW_INTERVAL_SECONDS 60  // How often the measured drift is slewed out with adjtime
+#define TIME_SYNC_DEFAULT_DRIFT_PPM 50      // Assumed drift until it has been measured
+
+// Clock checkpoint settings (RTC slow memory is refreshed every slew interval)
+#define TIME_CHECKPOINT_FLASH_INTERVAL_MINUTES 30 // How often the NVS copy is refreshed, only logged after a power loss
 
 // SNTP servers
 #define SNTP_SERVER_1 "pool.ntp.org"
@@ -20,24 +36,86 @@ extern "C"
 {
 #endif
 
+    /**
+     * @brief How far the system clock can be trusted
+     */
+    typedef enum
+    {
+        TIME_SYNC_STATE_INVALID,     /**<! Never set, still near 1970 */
+        TIME_SYNC_STATE_PROVISIONAL, /**<! Kept or restored from RTC memory through a reset, not yet confirmed by SNTP */
+        TIME_SYNC_STATE_SYNCED,      /**<! Confirmed by SNTP since boot */
+    } time_sync_state_t;
+
+    /**
+     * @brief Snapshot of the clock discipline state
+     */
+    typedef struct time_sync_status
+    {
+        time_sync_state_t state;     /**<! Trust level of the clock */
+        bool synced;                 /**<! At least one sync succeeded */
+        bool drift_known;            /**<! Drift has been measured across two syncs and is being corrected */
+        float drift_ppm;             /**<! Applied frequency correction, positive means the local clock runs slow */
+        float drift_uncertainty_ppm; /**<! Recent error of the drift estimate */
+        uint32_t est_error_ms;       /**<! Estimated current clock error, UINT32_MAX if unknown */
+        int32_t last_offset_ms;      /**<! Offset corrected by the last sync */
+        uint32_t next_sync_s;        /**<! Adaptive interval until the next sync */
+        uint32_t sync_count;         /**<! Successful syncs since boot */
+    } time_sync_status_t;
+
+    /**
+     * @brief Counters of one SNTP server
+     */
+    typedef struct time_sync_server_stats
+    {
+        const char *host;       /**<! Configured server name */
+        uint32_t requests;      /**<! Requests sent */
+        uint32_t responses;     /**<! Valid answers received */
+        int32_t last_rtt_ms;    /**<! Round trip of the last answer, -1 if never answered */
+        int32_t last_offset_ms; /**<! Offset measured by the last answer */
+        int32_t best_rtt_ms;    /**<! Lowest round trip of the kept samples in the last hour, -1 if none */
+    } time_sync_server_stats_t;
+
     /**
      * @brief Initialize and start time synchronization task
+     * @param task Where the periodic sync task runs
+     */
+    void time_sync_init(const task_config_t *task);
+
+    /**
+     * @brief Get the trust level of the system clock
+     * @return TIME_SYNC_STATE_PROVISIONAL right after a reset that kept or restored the clock, TIME_SYNC_STATE_SYNCED
+     * once SNTP confirms it; a power loss starts over from TIME_SYNC_STATE_INVALID
      */
-    void time_sync_init(void);
+    time_sync_state_t time_sync_get_state(void);
 
     /**
      * @brief Check if time is valid (after 2025, not default 1970 time)
+     * @note A provisional clock restored from RTC memory counts as valid, so tokens can be issued right after a reset
      * @return true if time appears valid, false otherwise
      */
     bool is_time_valid(void);
 
     /**
      * @brief Trigger asynchronous time synchronization (non-blocking)
-     * Creates a task to perform time sync without blocking the caller
-     * @return ESP_OK if task created successfully, ESP_FAIL otherwise
+     * Wakes the time sync task so it syncs right away instead of at the end of its current wait
+     * @return ESP_OK if the task was woken, ESP_FAIL if time sync isn't running
      */
     esp_err_t trigger_async_time_sync(void);
 
+    /**
+     * @brief Get the estimated drift, clock error and sync interval
+     * @param status Receives the snapshot
+     */
+    void time_sync_get_status(time_sync_status_t *status);
+
+    /**
+     * @brief Get the per-server SNTP counters
+     * @param stats Array receiving one entry per server
+     * @param max_entries Capacity of the array
+     * @return Number of entries written
+     */
+    size_t time_sync_get_server_stats(time_sync_server_stats_t *stats, size_t max_entries);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,397 @@
+#include <sys/time.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "sntp_client.h"
+
+static const char *TAG = "SntpClient";
+
+#define NTP_PORT "123"
+#define NTP_PACKET_LEN (48)
+#define NTP_UNIX_EPOCH_OFFSET (2208988800ULL) // Seconds from 1900 to 1970
+
+// First byte: leap indicator, version and mode
+#define NTP_LI_VN_MODE_CLIENT (0x23) // No warning, version 4, client
+#define NTP_LI_MASK (0xC0)
+#define NTP_LI_UNSYNCHRONIZED (0xC0)
+#define NTP_MODE_MASK (0x07)
+#define NTP_MODE_SERVER (4)
+#define NTP_MAX_STRATUM (15)
+
+// Field offsets in the packet
+#define NTP_STRATUM_OFFSET (1)
+#define NTP_ORIGINATE_OFFSET (24)
+#define NTP_RECEIVE_OFFSET (32)
+#define NTP_TRANSMIT_OFFSET (40)
+
+// Low bits of the request timestamp are random, so only a real answer echoes it back (about 15 us worth)
+#define NTP_NONCE_MASK (0xFFFFULL)
+
+// Window of the per-server best round trip statistic
+#define SAMPLE_MAX_AGE_US (60LL * 60 * 1000000)
+// Wait at least this long for the slower servers after the first answer
+#define MIN_STRAGGLER_WAIT_US (10 * 1000)
+// Pool names rotate through addresses, look a server up again after this many unanswered rounds
+#define RERESOLVE_AFTER_MISSES (3)
+
+typedef struct
+{
+    int64_t offset_us;
+    int64_t delay_us;
+    int64_t taken_us; // esp_timer time, 0 for an empty slot
+} filter_sample_t;
+
+typedef struct
+{
+    const char *host;
+    struct sockaddr_in addr;
+    bool resolved;
+    bool pending;        // Request of the current round not answered yet
+    uint64_t sent_stamp; // Transmit timestamp of the request, the answer must echo it as originate
+    int64_t sent_us;     // Local wall time the request went out
+    uint32_t misses;     // Consecutive unanswered rounds
+    filter_sample_t filter[SNTP_FILTER_SAMPLES];
+    uint32_t next_slot;
+    uint32_t requests;
+    uint32_t responses;
+    int64_t last_delay_us;
+    int64_t last_offset_us;
+} server_t;
+
+static server_t servers[] = {
+    {.host = SNTP_SERVER_1},
+    {.host = SNTP_SERVER_2},
+    {.host = SNTP_SERVER_3},
+};
+#define NUM_SERVERS (sizeof(servers) / sizeof(servers[0]))
+
+static SemaphoreHandle_t client_mutex = NULL;
+static int sock = -1;
+
+static int64_t wall_time_us(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+static uint64_t to_ntp_stamp(int64_t unix_us)
+{
+    uint64_t seconds = (uint64_t)(unix_us / 1000000) + NTP_UNIX_EPOCH_OFFSET;
+    uint64_t fraction = ((uint64_t)(unix_us % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
+
+static int64_t from_ntp_stamp(uint64_t stamp)
+{
+    uint64_t seconds = stamp >> 32;
+
+    // Era 1 starts in 2036, small values mean the counter has wrapped
+    if (seconds < 0x80000000ULL)
+        seconds += 0x100000000ULL;
+
+    int64_t fraction_us = (int64_t)(((stamp & 0xFFFFFFFFULL) * 1000000) >> 32);
+    return (int64_t)(seconds - NTP_UNIX_EPOCH_OFFSET) * 1000000LL + fraction_us;
+}
+
+static uint64_t read_stamp(const uint8_t *p)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+static void write_stamp(uint8_t *p, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        p[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+static int32_t to_ms_clamped(int64_t us)
+{
+    int64_t ms = us / 1000;
+    if (ms > INT32_MAX)
+        return INT32_MAX;
+    if (ms < INT32_MIN)
+        return INT32_MIN;
+    return (int32_t)ms;
+}
+
+static bool resolve_server(server_t *server)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(server->host, NTP_PORT, &hints, &res) != 0 || res == NULL)
+    {
+        ESP_LOGW(TAG, "Failed to resolve %s", server->host);
+        return false;
+    }
+
+    memcpy(&server->addr, res->ai_addr, sizeof(server->addr));
+    freeaddrinfo(res);
+
+    server->resolved = true;
+    server->misses = 0;
+    return true;
+}
+
+static bool send_request(server_t *server)
+{
+    uint8_t packet[NTP_PACKET_LEN] = {};
+    packet[0] = NTP_LI_VN_MODE_CLIENT;
+
+    server->sent_us = wall_time_us();
+    server->sent_stamp = to_ntp_stamp(server->sent_us) ^ (esp_random() & NTP_NONCE_MASK);
+    write_stamp(packet + NTP_TRANSMIT_OFFSET, server->sent_stamp);
+
+    if (sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)&server->addr, sizeof(server->addr)) < 0)
+    {
+        ESP_LOGD(TAG, "Request to %s failed: errno %d", server->host, errno);
+        return false;
+    }
+
+    server->requests++;
+    server->pending = true;
+    return true;
+}
+
+/*
+    Check an answer against the outstanding requests and record it in the filter of its server
+    returns the round trip of the accepted sample, or -1 if the packet was rejected
+*/
+static int64_t handle_response(const uint8_t *packet, size_t len, const struct sockaddr_in *from, int64_t received_us)
+{
+    if (len < NTP_PACKET_LEN || (packet[0] & NTP_MODE_MASK) != NTP_MODE_SERVER ||
+        (packet[0] & NTP_LI_MASK) == NTP_LI_UNSYNCHRONIZED || packet[NTP_STRATUM_OFFSET] == 0 ||
+        packet[NTP_STRATUM_OFFSET] > NTP_MAX_STRATUM)
+    {
+        return -1;
+    }
+
+    server_t *server = NULL;
+    for (size_t i = 0; i < NUM_SERVERS; i++)
+    {
+        if (servers[i].pending && servers[i].addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+            servers[i].addr.sin_port == from->sin_port)
+        {
+            server = &servers[i];
+            break;
+        }
+    }
+
+    // Late answers to an earlier round and spoofed packets don't carry the current nonce
+    if (server == NULL || read_stamp(packet + NTP_ORIGINATE_OFFSET) != server->sent_stamp)
+        return -1;
+
+    uint64_t transmit_stamp = read_stamp(packet + NTP_TRANSMIT_OFFSET);
+    if (transmit_stamp == 0)
+        return -1;
+
+    int64_t t1 = server->sent_us;
+    int64_t t2 = from_ntp_stamp(read_stamp(packet + NTP_RECEIVE_OFFSET));
+    int64_t t3 = from_ntp_stamp(transmit_stamp);
+    int64_t t4 = received_us;
+
+    int64_t offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+    int64_t delay_us = (t4 - t1) - (t3 - t2);
+    if (delay_us < 0)
+        delay_us = 0;
+
+    filter_sample_t *slot = &server->filter[server->next_slot];
+    server->next_slot = (server->next_slot + 1) % SNTP_FILTER_SAMPLES;
+    slot->offset_us = offset_us;
+    slot->delay_us = delay_us;
+    slot->taken_us = esp_timer_get_time();
+
+    server->pending = false;
+    server->misses = 0;
+    server->responses++;
+    server->last_delay_us = delay_us;
+    server->last_offset_us = offset_us;
+
+    ESP_LOGD(TAG, "%s: offset %" PRId64 " us, delay %" PRId64 " us", server->host, offset_us, delay_us);
+    return delay_us;
+}
+
+// Lowest-delay sample taken since since_us, the one least disturbed by queueing on the path
+static const filter_sample_t *best_sample(const server_t *server, int64_t since_us)
+{
+    const filter_sample_t *best = NULL;
+    for (int i = 0; i < SNTP_FILTER_SAMPLES; i++)
+    {
+        const filter_sample_t *sample = &server->filter[i];
+        if (sample->taken_us == 0 || sample->taken_us < since_us)
+            continue;
+        if (best == NULL || sample->delay_us < best->delay_us)
+            best = sample;
+    }
+    return best;
+}
+
+static esp_err_t query_round(uint32_t timeout_ms, sntp_sample_t *sample)
+{
+    if (sock < 0)
+    {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (sock < 0)
+        {
+            ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+            return ESP_FAIL;
+        }
+    }
+
+    int64_t round_start_us = esp_timer_get_time();
+    int sent = 0;
+    for (size_t i = 0; i < NUM_SERVERS; i++)
+    {
+        servers[i].pending = false;
+        if ((servers[i].resolved || resolve_server(&servers[i])) && send_request(&servers[i]))
+            sent++;
+    }
+
+    if (sent == 0)
+        return ESP_FAIL;
+
+    int answered = 0;
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+
+    while (answered < sent)
+    {
+        int64_t remaining_us = deadline_us - esp_timer_get_time();
+        if (remaining_us <= 0)
+            break;
+
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(sock, &read_fds);
+        struct timeval tv = {
+            .tv_sec = (time_t)(remaining_us / 1000000),
+            .tv_usec = (suseconds_t)(remaining_us % 1000000),
+        };
+        if (select(sock + 1, &read_fds, NULL, NULL, &tv) <= 0)
+            break;
+
+        uint8_t packet[NTP_PACKET_LEN];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&from, &from_len);
+        int64_t received_us = wall_time_us();
+        if (len < 0)
+            break;
+
+        int64_t delay_us = handle_response(packet, len, &from, received_us);
+        if (delay_us < 0)
+            continue;
+
+        // The first answer sets the pace, the others get one more of its round trips to arrive
+        if (answered++ == 0)
+        {
+            int64_t wait_us = delay_us > MIN_STRAGGLER_WAIT_US ? delay_us : MIN_STRAGGLER_WAIT_US;
+            int64_t straggler_deadline_us = esp_timer_get_time() + wait_us;
+            if (straggler_deadline_us < deadline_us)
+                deadline_us = straggler_deadline_us;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_SERVERS; i++)
+    {
+        if (servers[i].pending && ++servers[i].misses >= RERESOLVE_AFTER_MISSES)
+            servers[i].resolved = false;
+        servers[i].pending = false;
+    }
+
+    if (answered == 0)
+        return ESP_ERR_TIMEOUT;
+
+    // Only this round's answers are compared: older offsets predate the drift slewed out since and the sync that
+    // used them, selecting one would undo that sync and freeze the drift estimate
+    const filter_sample_t *best = NULL;
+    for (size_t i = 0; i < NUM_SERVERS; i++)
+    {
+        const filter_sample_t *candidate = best_sample(&servers[i], round_start_us);
+        if (candidate != NULL && (best == NULL || candidate->delay_us < best->delay_us))
+        {
+            best = candidate;
+            sample->host = servers[i].host;
+        }
+    }
+
+    sample->offset_us = best->offset_us;
+    sample->delay_us = best->delay_us;
+
+    ESP_LOGI(TAG, "%d/%d servers answered, using %s: offset %" PRId64 " ms, delay %" PRId64 " ms", answered, sent, sample->host,
+             sample->offset_us / 1000, sample->delay_us / 1000);
+    return ESP_OK;
+}
+
+void sntp_client_init(void)
+{
+    static StaticSemaphore_t client_mutex_buffer;
+    if (client_mutex == NULL)
+        client_mutex = xSemaphoreCreateMutexStatic(&client_mutex_buffer);
+}
+
+esp_err_t sntp_client_query(uint32_t timeout_ms, sntp_sample_t *sample)
+{
+    xSemaphoreTake(client_mutex, portMAX_DELAY);
+    esp_err_t err = query_round(timeout_ms, sample);
+    xSemaphoreGive(client_mutex);
+    return err;
+}
+
+void sntp_client_clock_stepped(int64_t step_us)
+{
+    xSemaphoreTake(client_mutex, portMAX_DELAY);
+
+    for (size_t i = 0; i < NUM_SERVERS; i++)
+    {
+        for (int j = 0; j < SNTP_FILTER_SAMPLES; j++)
+            servers[i].filter[j].offset_us -= step_us;
+    }
+
+    xSemaphoreGive(client_mutex);
+}
+
+size_t sntp_client_get_stats(time_sync_server_stats_t *stats, size_t max_entries)
+{
+    int64_t now_us = esp_timer_get_time();
+    size_t count = 0;
+
+    xSemaphoreTake(client_mutex, portMAX_DELAY);
+
+    for (size_t i = 0; i < NUM_SERVERS && count < max_entries; i++)
+    {
+        const server_t *server = &servers[i];
+        const filter_sample_t *best = best_sample(server, now_us - SAMPLE_MAX_AGE_US);
+
+        stats[count].host = server->host;
+        stats[count].requests = server->requests;
+        stats[count].responses = server->responses;
+        stats[count].last_rtt_ms = server->responses ? to_ms_clamped(server->last_delay_us) : -1;
+        stats[count].last_offset_ms = to_ms_clamped(server->last_offset_us);
+        stats[count].best_rtt_ms = best ? to_ms_clamped(best->delay_us) : -1;
+        count++;
+    }
+
+    xSemaphoreGive(client_mutex);
+    return count;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "time_sync.h"
+
+/**
+ * @brief Best measurement of one query round
+ */
+typedef struct
+{
+    const char *host;  // Server the sample came from
+    int64_t offset_us; // Server time minus local time
+    int64_t delay_us;  // Round trip, less the server's own processing time
+} sntp_sample_t;
+
+/**
+ * @brief Create the client state, must be called before anything else in this file
+ */
+void sntp_client_init(void);
+
+/**
+ * @brief Query all SNTP servers at once and pick the best sample
+ *
+ * Returns as soon as every server answered, or shortly after the first answer once the slower ones had another round
+ * trip to catch up. Only answers of this round are used, the one with the lowest delay across servers wins; each server
+ * also keeps its last SNTP_FILTER_SAMPLES samples for the round trip statistics.
+ *
+ * @param timeout_ms Longest wait for the first answer
+ * @param[out] sample Receives the selected offset and delay
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if no server answered, ESP_FAIL if no request could be sent
+ */
+esp_err_t sntp_client_query(uint32_t timeout_ms, sntp_sample_t *sample);
+
+/**
+ * @brief Tell the client the system clock was stepped, so stored offsets stay relative to the current clock
+ * @param step_us Amount added to the system clock
+ */
+void sntp_client_clock_stepped(int64_t step_us);
+
+/**
+ * @brief Copy the per-server counters
+ * @return Number of entries written
+ */
+size_t sntp_client_get_stats(time_sync_server_stats_t *stats, size_t max_entries);
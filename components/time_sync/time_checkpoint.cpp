@@ -0,0 +1,143 @@
+#include <sys/time.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "nvs.h"
+
+#include "time_checkpoint.h"
+#include "time_sync.h"
+
+static const char *TAG = "TimeCheckpoint";
+
+#define CHECKPOINT_MAGIC (0x54494D45) // "TIME"
+#define NVS_NAMESPACE "time_sync"
+#define NVS_KEY "checkpoint"
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t error_ms;
+    int64_t wall_us;
+    uint32_t checksum;
+} checkpoint_t;
+
+// Survives software, panic and watchdog resets, but not power loss
+RTC_NOINIT_ATTR static checkpoint_t rtc_checkpoint;
+
+static uint32_t checkpoint_checksum(const checkpoint_t *checkpoint)
+{
+    uint32_t sum = checkpoint->magic ^ checkpoint->error_ms;
+    sum ^= (uint32_t)checkpoint->wall_us ^ (uint32_t)(checkpoint->wall_us >> 32);
+    return ~sum;
+}
+
+static bool checkpoint_is_valid(const checkpoint_t *checkpoint)
+{
+    return checkpoint->magic == CHECKPOINT_MAGIC && checkpoint->checksum == checkpoint_checksum(checkpoint);
+}
+
+static bool read_flash_checkpoint(checkpoint_t *checkpoint)
+{
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return false;
+
+    size_t len = sizeof(*checkpoint);
+    esp_err_t err = nvs_get_blob(handle, NVS_KEY, checkpoint, &len);
+    nvs_close(handle);
+
+    return err == ESP_OK && len == sizeof(*checkpoint) && checkpoint_is_valid(checkpoint);
+}
+
+void time_checkpoint_save(uint32_t error_ms, bool to_flash)
+{
+    if (!is_time_valid())
+        return;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    checkpoint_t checkpoint = {
+        .magic = CHECKPOINT_MAGIC,
+        .error_ms = error_ms,
+        .wall_us = (int64_t)now.tv_sec * 1000000LL + now.tv_usec,
+        .checksum = 0,
+    };
+    checkpoint.checksum = checkpoint_checksum(&checkpoint);
+    rtc_checkpoint = checkpoint;
+
+    if (!to_flash)
+        return;
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(handle, NVS_KEY, &checkpoint, sizeof(checkpoint));
+        if (err == ESP_OK)
+            err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to write time checkpoint to NVS: %s", esp_err_to_name(err));
+}
+
+bool time_checkpoint_restore(uint32_t *error_ms)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t now_us = (int64_t)now.tv_sec * 1000000LL + now.tv_usec;
+
+    // The RTC timer kept counting through the reset, only the confidence in the clock is gone
+    if (is_time_valid())
+    {
+        *error_ms = UINT32_MAX;
+        if (checkpoint_is_valid(&rtc_checkpoint) && now_us >= rtc_checkpoint.wall_us)
+        {
+            int64_t elapsed_s = (now_us - rtc_checkpoint.wall_us) / 1000000;
+            *error_ms = rtc_checkpoint.error_ms + (uint32_t)(elapsed_s * TIME_SYNC_DEFAULT_DRIFT_PPM / 1000);
+        }
+        ESP_LOGI(TAG, "Clock kept running through reset, provisional (error ~%" PRIu32 " ms)", *error_ms);
+        return true;
+    }
+
+    checkpoint_t checkpoint;
+    const char *source;
+    if (checkpoint_is_valid(&rtc_checkpoint))
+    {
+        checkpoint = rtc_checkpoint;
+        // Rewritten every slew interval, so the RTC copy may be up to one interval old, plus the drift over it
+        source = "RTC memory";
+        *error_ms = checkpoint.error_ms + TIME_SYNC_SLEW_INTERVAL_SECONDS * 1000 +
+                    TIME_SYNC_SLEW_INTERVAL_SECONDS * TIME_SYNC_DEFAULT_DRIFT_PPM / 1000;
+    }
+    else if (read_flash_checkpoint(&checkpoint))
+    {
+        // Only a power loss gets here, and nothing bounds how long the power was off, so the NVS copy is a lower
+        // bound at best: restoring it would stamp tokens hours or days behind. Leave the clock to SNTP.
+        time_t last = (time_t)(checkpoint.wall_us / 1000000);
+        struct tm last_tm;
+        char last_str[32];
+        localtime_r(&last, &last_tm);
+        strftime(last_str, sizeof(last_str), "%Y-%m-%d %H:%M:%S", &last_tm);
+        ESP_LOGI(TAG, "Power was lost after %s (NVS checkpoint), waiting for SNTP", last_str);
+        return false;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "No time checkpoint to restore");
+        return false;
+    }
+
+    struct timeval restored = {
+        .tv_sec = (time_t)(checkpoint.wall_us / 1000000),
+        .tv_usec = (suseconds_t)(checkpoint.wall_us % 1000000),
+    };
+    settimeofday(&restored, NULL);
+
+    ESP_LOGI(TAG, "Clock restored from %s, provisional (error ~%" PRIu32 " ms plus time powered off)", source, *error_ms);
+    return true;
+}
\ No newline at end of file
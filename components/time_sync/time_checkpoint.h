@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Record the current wall clock in RTC slow memory and, optionally, NVS
+ * @param error_ms Estimated error of the clock right now
+ * @param to_flash Also write the NVS copy, which survives power loss but wears the flash
+ */
+void time_checkpoint_save(uint32_t error_ms, bool to_flash);
+
+/**
+ * @brief Bring the clock back after a reboot
+ *
+ * If the RTC kept the clock running through the reset it is left untouched, otherwise the clock is set from the
+ * RTC slow memory checkpoint. After a power loss only the NVS copy is left, and since the time spent powered off
+ * can't be measured it is logged but not restored.
+ *
+ * @param[out] error_ms Estimated error of the restored clock
+ * @return true if the clock now holds a provisional time, false if it has to wait for SNTP
+ */
+bool time_checkpoint_restore(uint32_t *error_ms);
\ No newline at end of file
@@ -1,34 +1,66 @@
 #include <sys/time.h>
+#include <sys/param.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include "esp_log.h"
-#include "esp_sntp.h"
-#include "esp_wifi.h"
-#include "esp_event.h"
+#include "esp_random.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
+#include "freertos/timers.h"
 
 #include "time_sync.h"
-#include "wifi_ap_sta.h"
+#include "clock_discipline.h"
+#include "time_checkpoint.h"
+#include "sntp_client.h"
+#include "system_ready.h"
+#include "metrics.h"
+#include "trace.h"
 
 static const char *TAG = "TimeSync";
 
-// Time sync interval (configurable)
-#define TIME_SYNC_INTERVAL_MS (TIME_SYNC_INTERVAL_MINUTES * 60 * 1000)
-
-// Event group bits
-#define TIME_SYNC_DONE_BIT BIT0
-
-static EventGroupHandle_t time_sync_event_group;
 static TaskHandle_t periodic_time_sync_task_handle = NULL;
 static TickType_t last_sync_attempt = 0;
+static uint32_t provisional_error_ms = UINT32_MAX;
+static TickType_t provisional_since = 0;
+
+static metric_t *offset_metric = NULL;
+static metric_t *delay_metric = NULL;
+static metric_t *syncs_metric = NULL;
+static metric_t *failures_metric = NULL;
+static metric_t *error_metric = NULL;
+
+static TickType_t last_flash_checkpoint = 0;
+
+// Runs in the timer daemon task, so only the RTC copy is written here, the NVS commit is left to the sync task
+static void slew_timer_cb(TimerHandle_t xTimer)
+{
+    clock_discipline_tick();
+
+    time_sync_status_t status;
+    time_sync_get_status(&status);
+    time_checkpoint_save(status.est_error_ms, false);
+    metrics_set(error_metric, (int32_t)status.est_error_ms);
+}
 
-static void time_sync_notification_cb(struct timeval *tv)
+// Ticks until the NVS checkpoint is due again
+static TickType_t flash_checkpoint_wait(void)
 {
-    ESP_LOGI(TAG, "Time synchronized via SNTP");
-    xEventGroupSetBits(time_sync_event_group, TIME_SYNC_DONE_BIT);
+    const TickType_t interval = pdMS_TO_TICKS(TIME_CHECKPOINT_FLASH_INTERVAL_MINUTES * 60 * 1000);
+    TickType_t since = xTaskGetTickCount() - last_flash_checkpoint;
+    return since < interval ? interval - since : 0;
+}
+
+static void flash_checkpoint_if_due(void)
+{
+    if (flash_checkpoint_wait() > 0)
+        return;
+
+    time_sync_status_t status;
+    time_sync_get_status(&status);
+    time_checkpoint_save(status.est_error_ms, true);
+    last_flash_checkpoint = xTaskGetTickCount();
 }
 
 void get_current_time_string(char *buffer, size_t buffer_size)
@@ -53,7 +85,7 @@ bool is_time_valid(void)
 
 esp_err_t sync_time_from_sntp(void)
 {
-    if (!is_sta_connected())
+    if (!system_ready_is_set(SYSTEM_READY_STA_GOT_IP))
     {
         ESP_LOGW(TAG, "WiFi STA not connected, cannot sync time");
         return ESP_FAIL;
@@ -64,47 +96,78 @@ esp_err_t sync_time_from_sntp(void)
     // Update last sync attempt time
     last_sync_attempt = xTaskGetTickCount();
 
-    // Clear event bits
-    xEventGroupClearBits(time_sync_event_group, TIME_SYNC_DONE_BIT);
-
-    // Initialize SNTP
-    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    esp_sntp_setservername(0, SNTP_SERVER_1);
-    esp_sntp_setservername(1, SNTP_SERVER_2);
-    esp_sntp_setservername(2, SNTP_SERVER_3);
-
-    // Set callback for time sync notification
-    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+    sntp_sample_t sample;
+    trace_span_begin("sntp_query");
+    esp_err_t err = sntp_client_query(SNTP_QUERY_TIMEOUT_MS, &sample);
+    trace_span_end("sntp_query");
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Time synchronization failed: %s", esp_err_to_name(err));
+        metrics_inc(failures_metric);
+        return err;
+    }
 
-    esp_sntp_init();
+    // Step to server time, the offset is measured against the clock as it was, so read it again right before
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t now_us = (int64_t)now.tv_sec * 1000000LL + now.tv_usec + sample.offset_us;
+    struct timeval synced = {
+        .tv_sec = (time_t)(now_us / 1000000),
+        .tv_usec = (suseconds_t)(now_us % 1000000),
+    };
+    settimeofday(&synced, NULL);
+    sntp_client_clock_stepped(sample.offset_us);
+
+    // Half the round trip bounds how far the server time can be off by the time it arrived
+    uint32_t sync_error_us = (uint32_t)(sample.delay_us / 2);
+    clock_discipline_on_sync(sample.offset_us, sync_error_us);
+    system_ready_set(SYSTEM_READY_TIME_VALID | SYSTEM_READY_TIME_SYNCED);
+
+    // Offsets beyond the int32 range only happen on the very first sync, clamp rather than wrap
+    int64_t offset_ms = sample.offset_us / 1000;
+    metrics_set(offset_metric, offset_ms > INT32_MAX ? INT32_MAX : offset_ms < INT32_MIN ? INT32_MIN : (int32_t)offset_ms);
+    metrics_set(delay_metric, (int32_t)(sample.delay_us / 1000));
+    metrics_inc(syncs_metric);
+
+    ESP_LOGI(TAG, "Time synchronized via %s", sample.host);
+    time_checkpoint_save(sync_error_us / 1000, true);
+    last_flash_checkpoint = xTaskGetTickCount();
+    return ESP_OK;
+}
 
-    // Wait for time sync (with timeout)
-    EventBits_t bits = xEventGroupWaitBits(time_sync_event_group,
-                                           TIME_SYNC_DONE_BIT,
-                                           pdTRUE,
-                                           pdFALSE,
-                                           pdMS_TO_TICKS(TIME_SYNC_TIMEOUT_SECONDS * 1000));
+// Doubles from SNTP_RETRY_MIN_SECONDS up to the base interval, +/- 50% jitter so devices don't retry in lockstep
+static uint32_t retry_delay_ms(uint32_t failures)
+{
+    const uint32_t max_ms = TIME_SYNC_INTERVAL_MINUTES * 60 * 1000;
 
-    esp_sntp_stop();
+    uint32_t delay_ms = SNTP_RETRY_MIN_SECONDS * 1000;
+    for (uint32_t i = 1; i < failures && delay_ms < max_ms; i++)
+        delay_ms *= 2;
+    if (delay_ms > max_ms)
+        delay_ms = max_ms;
 
-    if (bits & TIME_SYNC_DONE_BIT)
-    {
-        ESP_LOGI(TAG, "Time synchronization successful");
-        return ESP_OK;
-    }
-    else
-    {
-        ESP_LOGW(TAG, "Time synchronization failed or timed out");
-        return ESP_FAIL;
-    }
+    return delay_ms / 2 + esp_random() % delay_ms;
 }
 
 static void periodic_time_sync_task(void *pvParameters)
 {
     ESP_LOGI(TAG, "Time sync task started - Will sync every %d minutes", TIME_SYNC_INTERVAL_MINUTES);
 
+    uint32_t failures = 0;
+
     while (1)
     {
+        // Nothing to sync against until the uplink has an address
+        if (!system_ready_is_set(SYSTEM_READY_STA_GOT_IP))
+        {
+            ESP_LOGI(TAG, "Waiting for WiFi STA to get an IP address");
+            while (!system_ready_wait(SYSTEM_READY_STA_GOT_IP, true, flash_checkpoint_wait()))
+                flash_checkpoint_if_due();
+        }
+
+        // The sync below serves any wake-up requested meanwhile
+        ulTaskNotifyTake(pdTRUE, 0);
+
         ESP_LOGI(TAG, "Starting periodic time synchronization");
 
         // Check current time status
@@ -119,41 +182,80 @@ static void periodic_time_sync_task(void *pvParameters)
             ESP_LOGI(TAG, "System time is invalid, Attempting first sync");
         }
 
-        // Check if WiFi STA is connected
-        if (is_sta_connected())
+        // Wait for next sync interval, stretched as far as the measured drift allows, failed syncs retry sooner
+        uint32_t interval_ms;
+        if (sync_time_from_sntp() == ESP_OK)
         {
-            // Perform time sync
-            if (sync_time_from_sntp() == ESP_OK)
-            {
-                char time_str[64];
-                get_current_time_string(time_str, sizeof(time_str));
-                ESP_LOGI(TAG, "Time after sync: %s", time_str);
-            }
+            char time_str[64];
+            get_current_time_string(time_str, sizeof(time_str));
+            ESP_LOGI(TAG, "Time after sync: %s", time_str);
+            failures = 0;
+            interval_ms = clock_discipline_next_interval_ms();
         }
         else
+            interval_ms = retry_delay_ms(++failures);
+
+        // trigger_async_time_sync() cuts the wait short, e.g. when the uplink comes back; the NVS checkpoint is
+        // written from here on the way, flash writes stall both CPUs and don't belong in the timer daemon
+        ESP_LOGI(TAG, "Next time sync in %" PRIu32 " s", interval_ms / 1000);
+        TickType_t wait_start = xTaskGetTickCount();
+        TickType_t wait = pdMS_TO_TICKS(interval_ms);
+        while (xTaskGetTickCount() - wait_start < wait)
         {
-            ESP_LOGW(TAG, "WiFi STA not connected, skipping time sync");
+            TickType_t remaining = wait - (xTaskGetTickCount() - wait_start);
+            if (ulTaskNotifyTake(pdTRUE, MIN(remaining, flash_checkpoint_wait())) > 0)
+                break;
+            flash_checkpoint_if_due();
         }
-
-        // Wait for next sync interval
-        ESP_LOGI(TAG, "Next time sync in %d minutes", TIME_SYNC_INTERVAL_MINUTES);
-        vTaskDelay(pdMS_TO_TICKS(TIME_SYNC_INTERVAL_MS));
     }
 }
 
-void time_sync_init(void)
+void time_sync_init(const task_config_t *task)
 {
     // Set timezone to IST (UTC+5:30) according to POSIX format
     setenv("TZ", "IST-5:30", 1);
     tzset();
 
-    // Create event group
-    time_sync_event_group = xEventGroupCreate();
+    sntp_client_init();
+
+    offset_metric = metrics_gauge("sntp_offset_ms", "Clock offset corrected by the last sync");
+    delay_metric = metrics_gauge("sntp_delay_ms", "Round trip of the sample used by the last sync");
+    syncs_metric = metrics_counter("sntp_syncs_total", "Successful time syncs");
+    failures_metric = metrics_counter("sntp_failures_total", "Time syncs that got no usable answer");
+    error_metric = metrics_gauge("time_est_error_ms", "Estimated error of the clock, -1 if unknown");
+
+#if CONFIG_IDF_TARGET_LINUX
+    // Simulation build: the host disciplines its own clock and the process may not set it
+    if (is_time_valid())
+        system_ready_set(SYSTEM_READY_TIME_VALID | SYSTEM_READY_TIME_SYNCED);
+    ESP_LOGI(TAG, "Using the host clock, SNTP is off");
+    return;
+#endif
+
+    // Bring back the last known good time after a reset, so tokens can be issued before the first sync
+    if (time_checkpoint_restore(&provisional_error_ms))
+    {
+        provisional_since = xTaskGetTickCount();
+        last_flash_checkpoint = provisional_since;
+        system_ready_set(SYSTEM_READY_TIME_VALID);
+    }
+
+    // Slew out the measured drift between syncs
+    clock_discipline_init();
+    static StaticTimer_t slew_timer_buffer;
+    TimerHandle_t slew_timer = xTimerCreateStatic("clock_slew_timer",
+                                                  pdMS_TO_TICKS(TIME_SYNC_SLEW_INTERVAL_SECONDS * 1000),
+                                                  pdTRUE,
+                                                  NULL,
+                                                  slew_timer_cb,
+                                                  &slew_timer_buffer);
+    if (slew_timer == NULL || xTimerStart(slew_timer, 0) != pdPASS)
+        ESP_LOGE(TAG, "Failed to start clock slew timer");
 
     ESP_LOGI(TAG, "Time sync initialization complete");
 
     if (periodic_time_sync_task_handle == NULL)
-        xTaskCreate(periodic_time_sync_task, "periodic_time_sync_task", 4096, NULL, 5, &periodic_time_sync_task_handle);
+        task_config_create(periodic_time_sync_task, NULL, task, &periodic_time_sync_task_handle);
 }
 
 esp_err_t trigger_manual_time_sync(void)
@@ -162,8 +264,8 @@ esp_err_t trigger_manual_time_sync(void)
 
     esp_err_t ret = ESP_FAIL;
 
-    // Check if WiFi STA is connected
-    if (is_sta_connected())
+    // Check if WiFi STA has an address
+    if (system_ready_is_set(SYSTEM_READY_STA_GOT_IP))
     {
         // Perform time sync
         ret = sync_time_from_sntp();
@@ -182,27 +284,42 @@ esp_err_t trigger_manual_time_sync(void)
     return ret;
 }
 
-static void async_time_sync_task(void *pvParameters)
+esp_err_t trigger_async_time_sync(void)
 {
-    if (trigger_manual_time_sync() == ESP_OK)
-        ESP_LOGI(TAG, "Async time sync completed successfully");
-    else
-        ESP_LOGW(TAG, "Async time sync failed");
+    if (periodic_time_sync_task_handle == NULL)
+    {
+        ESP_LOGE(TAG, "Time sync task not running");
+        return ESP_FAIL;
+    }
 
-    // Delete this task
-    vTaskDelete(NULL);
+    xTaskNotifyGive(periodic_time_sync_task_handle);
+    return ESP_OK;
 }
 
-esp_err_t trigger_async_time_sync(void)
+time_sync_state_t time_sync_get_state(void)
 {
-    // Create a task to perform time sync asynchronously
-    BaseType_t result = xTaskCreate(async_time_sync_task, "async_time_sync", 4096, NULL, 5, NULL);
+    if (system_ready_is_set(SYSTEM_READY_TIME_SYNCED))
+        return TIME_SYNC_STATE_SYNCED;
+    if (system_ready_is_set(SYSTEM_READY_TIME_VALID))
+        return TIME_SYNC_STATE_PROVISIONAL;
+    return TIME_SYNC_STATE_INVALID;
+}
 
-    if (result == pdPASS)
-        return ESP_OK;
-    else
+void time_sync_get_status(time_sync_status_t *status)
+{
+    clock_discipline_get_status(status);
+    status->state = time_sync_get_state();
+    status->next_sync_s = clock_discipline_next_interval_ms() / 1000;
+
+    // Until SNTP confirms, the error is what the checkpoint carried plus the drift since boot
+    if (status->state == TIME_SYNC_STATE_PROVISIONAL && provisional_error_ms != UINT32_MAX)
     {
-        ESP_LOGE(TAG, "Failed to create async time sync task");
-        return ESP_FAIL;
+        uint32_t elapsed_s = pdTICKS_TO_MS(xTaskGetTickCount() - provisional_since) / 1000;
+        status->est_error_ms = provisional_error_ms + elapsed_s * TIME_SYNC_DEFAULT_DRIFT_PPM / 1000;
     }
-}
\ No newline at end of file
+}
+
+size_t time_sync_get_server_stats(time_sync_server_stats_t *stats, size_t max_entries)
+{
+    return sntp_client_get_stats(stats, max_entries);
+}
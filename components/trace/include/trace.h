@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+// Events kept in RAM, 16 bytes each, the oldest are overwritten. Must be a power of two.
+#define TRACE_RING_SIZE 1024
+// Tasks whose names can be resolved in a dump
+#define TRACE_MAX_TASKS 24
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Write callback for trace_dump(), called with each full buffer and once with the rest
+     * @return ESP_OK to continue, anything else aborts the dump
+     */
+    typedef esp_err_t (*trace_flush_fn)(const char *data, size_t len, void *ctx);
+
+    /**
+     * @brief Start recording context switches and spans, it keeps running as a flight recorder
+     */
+    void trace_start(void);
+
+    /**
+     * @brief Stop recording, the ring keeps its content until the next start
+     */
+    void trace_stop(void);
+
+    /**
+     * @brief Mark the start of a span in the current task
+     * @param name String literal without spaces, only the pointer is recorded
+     */
+    void trace_span_begin(const char *name);
+
+    /**
+     * @brief Mark the end of the span started with the same name
+     */
+    void trace_span_end(const char *name);
+
+    /**
+     * @brief Dump the ring as text, one event per line, oldest first
+     *
+     * Recording is paused for the duration of the dump and resumed afterwards if it was running.
+     * tools/trace_to_chrome.py turns the text into Chrome trace JSON for Perfetto.
+     *
+     * @param buf Scratch buffer, every line must fit
+     * @param size Size of the scratch buffer
+     * @param flush Receives the text piece by piece
+     * @return ESP_OK, ESP_ERR_INVALID_STATE if a dump is already running, or the first error returned by flush
+     */
+    esp_err_t trace_dump(char *buf, size_t size, trace_flush_fn flush, void *ctx);
+
+    /**
+     * @brief Dump the ring to the console, for devices without a reachable portal
+     */
+    void trace_dump_uart(void);
+
+#ifdef __cplusplus
+}
+#endif
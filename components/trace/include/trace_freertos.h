@@ -0,0 +1,7 @@
+#pragma once
+
+// Force-included into the FreeRTOS kernel sources only, keep it free of any other include
+
+void trace_task_switched_in(void);
+
+#define traceTASK_SWITCHED_IN() trace_task_switched_in()
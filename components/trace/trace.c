@@ -0,0 +1,196 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "trace.h"
+#include "trace_freertos.h"
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+
+typedef enum
+{
+    TRACE_EVENT_SWITCH,
+    TRACE_EVENT_BEGIN,
+    TRACE_EVENT_END,
+} trace_event_type_t;
+
+typedef struct
+{
+    uint32_t timestamp_us; // Low half of esp_timer_get_time(), widened again at dump time
+    uint8_t type;
+    uint8_t core;
+    const char *name;   // Span name, NULL for switches
+    TaskHandle_t task;  // Task switched in, or the task the span runs in
+} trace_event_t;
+
+// Writers claim a slot with one atomic add and overwrite the oldest event, the reader only runs while recording is off
+static trace_event_t ring[TRACE_RING_SIZE];
+static atomic_uint_fast32_t ring_head;
+static atomic_bool recording;
+static atomic_flag dump_busy = ATOMIC_FLAG_INIT;
+static TaskStatus_t task_status[TRACE_MAX_TASKS];
+
+static IRAM_ATTR void record(trace_event_type_t type, const char *name, TaskHandle_t task)
+{
+    uint32_t index = atomic_fetch_add_explicit(&ring_head, 1, memory_order_relaxed) & (TRACE_RING_SIZE - 1);
+    trace_event_t *event = &ring[index];
+    event->timestamp_us = (uint32_t)esp_timer_get_time();
+    event->type = type;
+    event->core = xPortGetCoreID();
+    event->name = name;
+    event->task = task;
+}
+
+// Runs inside the scheduler on every context switch, with interrupts disabled
+IRAM_ATTR void trace_task_switched_in(void)
+{
+    if (atomic_load_explicit(&recording, memory_order_relaxed))
+        record(TRACE_EVENT_SWITCH, NULL, xTaskGetCurrentTaskHandle());
+}
+
+void trace_start(void)
+{
+    atomic_store(&recording, true);
+}
+
+void trace_stop(void)
+{
+    atomic_store(&recording, false);
+}
+
+void trace_span_begin(const char *name)
+{
+    if (atomic_load_explicit(&recording, memory_order_relaxed))
+        record(TRACE_EVENT_BEGIN, name, xTaskGetCurrentTaskHandle());
+}
+
+void trace_span_end(const char *name)
+{
+    if (atomic_load_explicit(&recording, memory_order_relaxed))
+        record(TRACE_EVENT_END, name, xTaskGetCurrentTaskHandle());
+}
+
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t used;
+    trace_flush_fn flush;
+    void *ctx;
+    esp_err_t err;
+} dump_state_t;
+
+// Appends one line, handing the buffer to flush first when the line would not fit
+static void emit(dump_state_t *state, const char *format, ...)
+{
+    if (state->err != ESP_OK)
+        return;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(state->buf + state->used, state->size - state->used, format, args);
+        va_end(args);
+
+        if (len >= 0 && (size_t)len < state->size - state->used)
+        {
+            state->used += len;
+            return;
+        }
+        if (state->used == 0)
+            break;
+
+        state->err = state->flush(state->buf, state->used, state->ctx);
+        state->used = 0;
+        if (state->err != ESP_OK)
+            return;
+    }
+}
+
+// Tasks that were deleted since their events were recorded show up by handle
+static const char *task_name(TaskHandle_t task, UBaseType_t num_tasks, char *fallback, size_t fallback_size)
+{
+    for (UBaseType_t i = 0; i < num_tasks; i++)
+        if (task_status[i].xHandle == task)
+            return task_status[i].pcTaskName;
+
+    snprintf(fallback, fallback_size, "task_%08" PRIx32, (uint32_t)(uintptr_t)task);
+    return fallback;
+}
+
+esp_err_t trace_dump(char *buf, size_t size, trace_flush_fn flush, void *ctx)
+{
+    if (atomic_flag_test_and_set(&dump_busy))
+        return ESP_ERR_INVALID_STATE;
+
+    bool was_recording = atomic_exchange(&recording, false);
+    // Let a writer that already claimed its slot finish filling it
+    vTaskDelay(1);
+
+    dump_state_t state = {
+        .buf = buf,
+        .size = size,
+        .used = 0,
+        .flush = flush,
+        .ctx = ctx,
+        .err = ESP_OK,
+    };
+
+    UBaseType_t num_tasks = uxTaskGetSystemState(task_status, TRACE_MAX_TASKS, NULL);
+    uint32_t head = atomic_load(&ring_head);
+    uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+
+    // Timestamps are widened against the current time, exact as long as the ring spans less than 71 minutes
+    int64_t now_us = esp_timer_get_time();
+
+    emit(&state, "# trace v1 cores=%d events=%" PRIu32 " overwritten=%" PRIu32 "\n",
+         portNUM_PROCESSORS, count, head - count);
+
+    for (uint32_t i = head - count; i != head; i++)
+    {
+        const trace_event_t *event = &ring[i & (TRACE_RING_SIZE - 1)];
+        int64_t timestamp_us = now_us - (uint32_t)((uint32_t)now_us - event->timestamp_us);
+        char fallback[16];
+        const char *task = task_name(event->task, num_tasks, fallback, sizeof(fallback));
+
+        // The task name goes last, it may contain spaces
+        if (event->type == TRACE_EVENT_SWITCH)
+            emit(&state, "%" PRId64 " %d S %s\n", timestamp_us, event->core, task);
+        else
+            emit(&state, "%" PRId64 " %d %c %s %s\n", timestamp_us, event->core,
+                 event->type == TRACE_EVENT_BEGIN ? 'B' : 'E', event->name, task);
+    }
+
+    if (state.err == ESP_OK && state.used > 0)
+        state.err = flush(buf, state.used, ctx);
+
+    if (was_recording)
+    {
+        atomic_store(&ring_head, 0);
+        atomic_store(&recording, true);
+    }
+    atomic_flag_clear(&dump_busy);
+    return state.err;
+}
+
+static esp_err_t uart_flush(const char *data, size_t len, void *ctx)
+{
+    fwrite(data, 1, len, stdout);
+    return ESP_OK;
+}
+
+void trace_dump_uart(void)
+{
+    char buf[256];
+    trace_dump(buf, sizeof(buf), uart_flush, NULL);
+    fflush(stdout);
+}
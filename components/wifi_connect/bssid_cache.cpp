@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "nvs.h"
+
+#include "bssid_cache.h"
+
+static const char *TAG = "BSSID_CACHE";
+
+#define NVS_NAMESPACE "wifi_sta"
+#define NVS_KEY "last_ap"
+#define SSID_MAX_LEN (32)
+
+typedef struct
+{
+    char ssid[SSID_MAX_LEN + 1];
+    uint8_t bssid[6];
+    uint8_t channel;
+} cached_ap_t;
+
+// Copy of what's in NVS, so unchanged entries don't cost a flash write
+static cached_ap_t cached;
+static bool cached_loaded = false;
+
+static bool read_cache(void)
+{
+    if (cached_loaded)
+        return cached.channel != 0;
+
+    cached_loaded = true;
+
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return false;
+
+    size_t len = sizeof(cached);
+    esp_err_t err = nvs_get_blob(handle, NVS_KEY, &cached, &len);
+    nvs_close(handle);
+
+    if (err != ESP_OK || len != sizeof(cached))
+    {
+        memset(&cached, 0, sizeof(cached));
+        return false;
+    }
+
+    cached.ssid[SSID_MAX_LEN] = '\0';
+    return cached.channel != 0;
+}
+
+bool bssid_cache_load(char ssid[33], uint8_t bssid[6], uint8_t *channel)
+{
+    if (!read_cache())
+        return false;
+
+    memcpy(ssid, cached.ssid, sizeof(cached.ssid));
+    memcpy(bssid, cached.bssid, sizeof(cached.bssid));
+    *channel = cached.channel;
+    return true;
+}
+
+void bssid_cache_save(const char *ssid, const uint8_t bssid[6], uint8_t channel)
+{
+    read_cache();
+
+    if (strncmp(cached.ssid, ssid, SSID_MAX_LEN) == 0 && memcmp(cached.bssid, bssid, sizeof(cached.bssid)) == 0 &&
+        cached.channel == channel)
+        return;
+
+    memset(&cached, 0, sizeof(cached));
+    strncpy(cached.ssid, ssid, SSID_MAX_LEN);
+    memcpy(cached.bssid, bssid, sizeof(cached.bssid));
+    cached.channel = channel;
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(handle, NVS_KEY, &cached, sizeof(cached));
+        if (err == ESP_OK)
+            err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to persist last AP: %s", esp_err_to_name(err));
+    else
+        ESP_LOGI(TAG, "Cached AP " MACSTR " on channel %d for '%s'", MAC2STR(bssid), channel, ssid);
+}
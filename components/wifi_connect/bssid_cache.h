@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Look up where the last connection was made
+ * @param[out] ssid Network that was joined
+ * @param[out] bssid Access point that accepted the connection
+ * @param[out] channel Primary channel of that access point
+ * @return true if a cached entry exists
+ */
+bool bssid_cache_load(char ssid[33], uint8_t bssid[6], uint8_t *channel);
+
+/**
+ * @brief Remember the access point a connection succeeded on, NVS is only written when it changed
+ */
+void bssid_cache_save(const char *ssid, const uint8_t bssid[6], uint8_t channel);
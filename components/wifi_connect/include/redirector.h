@@ -1,9 +1,29 @@
 #pragma once
 
+#include "sdkconfig.h"
 #include "hmac_token_generator.h"
+#include "task_config.h"
+#include "net_reactor.h"
+
+// Diagnostics build: /metrics, /trace, /boot and /power are served, only to clients off the SoftAP's subnet, i.e.
+// reaching the device over the STA uplink. The SoftAP is open, so they are left out by default on the device.
+#if CONFIG_IDF_TARGET_LINUX
+#define PORTAL_DIAGNOSTICS 1
+#else
+#define PORTAL_DIAGNOSTICS 0
+#endif
 
 /**
  * Start HTTP Server for redirecting requests
  * @param hmac_generator HMAC token generator instance
+ * @param task Where the httpd task runs
+ */
+void start_webserver(HMACTokenGenerator *hmac_generator, const task_config_t *task);
+
+/**
+ * Serve the captive portal from a net_reactor task instead of httpd, together with a UDP socket such as the DNS server's
+ * @param hmac_generator HMAC token generator instance
+ * @param udp Socket the reactor also waits on, NULL for none
+ * @param task Where the reactor task runs
  */
-void start_webserver(HMACTokenGenerator *hmac_generator);
\ No newline at end of file
+void start_portal_reactor(HMACTokenGenerator *hmac_generator, const net_reactor_udp_t *udp, const task_config_t *task);
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "task_config.h"
+
 // WiFi credentials for time synchronization
 #define WIFI_SSID_FOR_SYNC "Thareesh’s iPhone 14 Pro"
 #define WIFI_PASS_FOR_SYNC "getConnected"
@@ -8,24 +13,89 @@
 #define WIFI_AP_SSID "RIG-Attendance"
 #define WIFI_AP_PASS ""
 #define WIFI_AP_CHANNEL 1
-#define WIFI_AP_MAX_CONNECTIONS 4
+#define WIFI_AP_MAX_CONNECTIONS 10  // Bounded by CONFIG_LWIP_DHCPS_MAX_STATION_NUM and the portal socket budget
+#define WIFI_AP_INACTIVE_TIME_S 30  // Stations silent for this long are disassociated by the driver
+#define WIFI_AP_LINK_GRACE_MS 20000 // Time a station keeps after its link was served, to open or copy it
+#define WIFI_AP_EVICT_CHECK_MS 2000 // How often served stations are checked for eviction
 
 // WiFi scan configuration
-#define WIFI_SCAN_INTERVAL_MS 60000       // Scan every 60 seconds
-#define WIFI_CONNECT_RETRY_DELAY_MS 15000 // Retry connection every 15 seconds
+#define WIFI_CONNECT_RETRY_DELAY_MS 15000 // First retry when the network wasn't found, doubles on every miss
+#define WIFI_SCAN_MAX_BACKOFF_MS 300000   // Longest wait between scans while the network is absent
+#define WIFI_STA_CONNECT_TIMEOUT_MS 10000 // Give up on a single connection attempt after 10 seconds
+#define WIFI_SCAN_DWELL_MS 120            // Passive dwell per channel, just over one beacon interval
+#define WIFI_SCAN_QUIET_MS 5000           // Portal counts as busy for this long after a station joins or a request
+#define WIFI_SCAN_MAX_DEFER_MS 60000      // Longest a scan waits for the portal to go quiet
+#define WIFI_SCAN_BUSY_HOME_DWELL_MS 200  // Time back on the SoftAP channel between scanned channels while busy, at most 255
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+    // Ways the STA gets back onto the sync network, cheapest first
+    typedef enum
+    {
+        WIFI_RECONNECT_DIRECTED,     // Connect straight to the cached BSSID and channel
+        WIFI_RECONNECT_CHANNEL_SCAN, // Scan only the cached channel
+        WIFI_RECONNECT_FULL_SCAN,    // Scan every channel
+        WIFI_RECONNECT_STRATEGY_MAX,
+    } wifi_reconnect_strategy_t;
+
+    // Counters of one reconnect strategy
+    typedef struct
+    {
+        uint32_t attempts;
+        uint32_t successes;
+        uint32_t last_connect_ms;  // Time to connect of the last success, scan included
+        uint32_t total_connect_ms; // Divide by successes for the average
+        uint32_t off_channel_ms;   // Time the radio spent away from the SoftAP channel
+    } wifi_reconnect_stats_t;
+
+    // SoftAP client churn, to size WIFI_AP_MAX_CONNECTIONS
+    typedef struct
+    {
+        uint32_t joins;
+        uint32_t left;            // Divide total_dwell_ms by this for the average stay
+        uint32_t evictions;       // Disassociated after their link was served
+        uint32_t links_served;    // Portal pages with a link, all clients together
+        uint32_t clients_served;  // Clients that left with at least one link
+        uint32_t total_dwell_ms;  // Association time of the clients that left
+        uint32_t max_dwell_ms;
+        uint8_t current_clients;
+        uint8_t peak_clients;
+    } wifi_ap_client_stats_t;
+
+    // Counters of the STA scan scheduler
+    typedef struct
+    {
+        uint32_t scans;
+        uint32_t scans_deferred;  // Held back until the portal went quiet
+        uint32_t scans_shortened; // Ran while the portal was busy, with SoftAP time between channels
+        uint32_t off_channel_ms;  // All strategies together
+    } wifi_scan_stats_t;
+
     // Function declarations
-    // Initializes the ESP32 in Wi-Fi AP+STA mode
-    void wifi_init_softap(void);
+    // Brings up lwIP, the default event loop and the AP and STA interfaces, enough for servers to bind
+    void wifi_netif_init(void);
+
+    // Starts the WiFi driver in AP+STA mode after wifi_netif_init(), the STA scan task runs as configured in scan_task
+    void wifi_init_softap(const task_config_t *scan_task);
 
     // Check if STA is connected to external WiFi network
     bool is_sta_connected(void);
 
+    // Mark the portal as in use, scans are deferred or shortened for a while
+    void wifi_note_portal_activity(void);
+
+    // Copy the SoftAP client counters
+    void wifi_ap_get_client_stats(wifi_ap_client_stats_t *stats);
+
+    // Copy the scan scheduler counters
+    void wifi_get_scan_stats(wifi_scan_stats_t *stats);
+
+    // Copy the per-strategy reconnect counters
+    void wifi_get_reconnect_stats(wifi_reconnect_stats_t stats[WIFI_RECONNECT_STRATEGY_MAX]);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Credential store configuration
+#define WIFI_CREDENTIALS_MAX 8            // Networks kept in NVS
+#define WIFI_CREDENTIAL_DEFAULT_PRIORITY 1 // Priority of the compiled-in network seeded on first boot
+#define WIFI_SCORE_DB_PER_PRIORITY 10      // One priority level is worth this much signal strength
+#define WIFI_MIN_RSSI (-85)                // Weaker APs are not considered
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // One network usable for time sync, a higher priority is preferred
+    typedef struct
+    {
+        char ssid[33];
+        char password[65];
+        uint8_t priority;
+    } wifi_credential_t;
+
+    // Load the store from NVS, seeding it with WIFI_SSID_FOR_SYNC if it's empty
+    void wifi_credentials_init(void);
+
+    // Add a network, or update the password and priority of a known one
+    esp_err_t wifi_credentials_add(const char *ssid, const char *password, uint8_t priority);
+
+    // Forget a network, ESP_ERR_NOT_FOUND if it isn't stored
+    esp_err_t wifi_credentials_remove(const char *ssid);
+
+    // Copy the stored networks, returns how many were written
+    size_t wifi_credentials_list(wifi_credential_t *credentials, size_t max_entries);
+
+    // Look up the credentials of one network
+    bool wifi_credentials_find(const char *ssid, wifi_credential_t *credential);
+
+    // Rank a scanned AP, higher is better, INT32_MIN if it isn't one of the stored networks or too weak
+    int32_t wifi_credentials_score(const char *ssid, int8_t rssi);
+
+#ifdef __cplusplus
+}
+#endif
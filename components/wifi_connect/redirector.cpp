@@ -1,116 +1,424 @@
 #include "esp_log.h"
 #include "esp_http_server.h"
+#include "redirector.h"
 #include "hmac_token_generator.h"
-#include "lwip/inet.h"
-#include "lwip/sockets.h"
-#include "lwip/netdb.h"
+#include "rate_limiter.h"
+#include "wifi_ap_sta.h"
+#include "softap_clients.h"
+#include "system_ready.h"
+#include "fastlog.h"
+#include "metrics.h"
+#include "trace.h"
+#include "alloc_trace.h"
+#include "journal.h"
+#include "boot_timeline.h"
+#include "net_reactor.h"
+#include "power.h"
+#include "esp_timer.h"
+#include "esp_netif_ip_addr.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_netif.h"
+#endif
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <string.h>
-#include <stdlib.h>
 
 static const char *TAG = "CaptivePortal";
 
+// One session per SoftAP station, httpd adds 3 internal sockets, and DNS, SNTP and the journal's esp_http_client
+// upload need one each
+#define PORTAL_MAX_OPEN_SOCKETS WIFI_AP_MAX_CONNECTIONS
+#if !CONFIG_IDF_TARGET_LINUX && PORTAL_MAX_OPEN_SOCKETS + 3 + 3 > CONFIG_LWIP_MAX_SOCKETS
+#error "CONFIG_LWIP_MAX_SOCKETS too small for the portal sessions"
+#endif
+
+// The simulation build serves on the host, where port 80 needs root
+#if CONFIG_IDF_TARGET_LINUX
+#define PORTAL_PORT 8000
+#else
+#define PORTAL_PORT 80
+#endif
+
+// Root page render time, token generation included
+static const int32_t root_latency_bounds_ms[] = {5, 10, 25, 50, 100, 250, 500, 1000};
+static metric_t *root_latency_metric = NULL;
+static metric_t *portal_tokens_metric = NULL;
+static metric_t *redirects_metric = NULL;
+static metric_t *alloc_violations_metric = NULL;
+static metric_t *alloc_exempt_metric = NULL;
+
 extern const char root_start[] asm("_binary_root_html_start");
 extern const char root_end[] asm("_binary_root_html_end");
 
-// Handler to serve the Main Captive Portal Page
-static esp_err_t root_get_handler(httpd_req_t *req)
+// Where the tokenized link goes in the page, located once at start-up
+#define ROOT_PLACEHOLDER "{{DYNAMIC_LINK}}"
+static const char *root_placeholder = NULL;
+
+// Returns the IPv4 address of the peer on the socket, or 0 if it can't be determined
+static uint32_t get_client_ip(int sockfd)
 {
-    // Get the HMAC generator from user context
-    HMACTokenGenerator *hmac_generator = (HMACTokenGenerator *)req->user_ctx;
+    struct sockaddr_in6 addr;
+    socklen_t addr_len = sizeof(addr);
 
-    if (hmac_generator == nullptr)
+    if (getpeername(sockfd, (struct sockaddr *)&addr, &addr_len) < 0)
+        return 0;
+
+    // httpd listens on a dual-stack socket, so IPv4 clients show up as IPv4-mapped IPv6 addresses
+    if (addr.sin6_family == AF_INET6)
     {
-        ESP_LOGE(TAG, "HMAC generator not found in user context");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+        uint32_t ip;
+        memcpy(&ip, &addr.sin6_addr.s6_addr[12], sizeof(ip));
+        return ip;
     }
+    if (addr.sin6_family == AF_INET)
+        return ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+    return 0;
+}
 
-    uint32_t content_length = root_end - root_start;
+// Refuse new sessions from clients that are already throttled, so they can't hold one of the few sockets
+static bool portal_accepts(uint32_t ip)
+{
+    return ip == 0 || !rate_limiter_is_limited(ip);
+}
 
-    // Create a mutable copy of the HTML
-    char *html_content = (char *)malloc(content_length + 300); // Extra space for longer URLs
-    if (html_content == NULL)
-    {
-        ESP_LOGE(TAG, "Failed to allocate memory for HTML content");
-        httpd_resp_send_500(req);
+// Charge a request to its client, rate_limiter_allow() for requests that aren't portal activity
+static bool portal_admit(uint32_t ip)
+{
+    wifi_note_portal_activity();
+    return ip == 0 || rate_limiter_allow(ip);
+}
+
+/*
+    What a page needs from the transport, so httpd and the reactor serve the same pages. begin() sets the
+    status and headers, send() adds to the body and the transport ends the response once the page returns.
+    A page returning ESP_FAIL has the connection closed, which is the only signal left once a body is partly out.
+*/
+typedef struct
+{
+    uint32_t client_ip; // 0 if unknown
+    esp_err_t (*begin)(void *ctx, const char *status, const char *type, const char *location);
+    metrics_flush_fn send;
+    void *ctx;
+} portal_response_t;
+
+// Main Captive Portal Page
+static esp_err_t serve_root(const portal_response_t *resp, HMACTokenGenerator *hmac_generator)
+{
+    if (!portal_admit(resp->client_ip))
         return ESP_FAIL;
-    }
 
-    memcpy(html_content, root_start, content_length);
-    html_content[content_length] = '\0';
+    int64_t started_us = esp_timer_get_time();
+    trace_span_begin("http_root");
+    ALLOC_TRACE_STEADY_BEGIN();
+
+    if (hmac_generator == nullptr)
+    {
+        ESP_LOGE(TAG, "HMAC generator not found in user context");
+        esp_err_t err = resp->begin(resp->ctx, "500 Internal Server Error", "text/plain", NULL);
+        if (err == ESP_OK)
+            err = resp->send("Internal Server Error", strlen("Internal Server Error"), resp->ctx);
+        ALLOC_TRACE_STEADY_END();
+        trace_span_end("http_root");
+        return err;
+    }
 
-    // Generate dynamic link with token
-    char dynamic_link[256];
     // Generate a token for current timestamp
-    std::string token = hmac_generator->generateToken(0);
+    char token[HMAC_TOKEN_MAX_LEN];
+    hmac_generator->generateToken(token, sizeof(token), 0);
+    metrics_inc(portal_tokens_metric);
 
     // Create the dynamic link
-    snprintf(dynamic_link, sizeof(dynamic_link),
-             "https://webapp--rig-attendance-app.asia-east1.hosted.app/scan?%s",
-             token.c_str());
+    char dynamic_link[256];
+    int link_len = snprintf(dynamic_link, sizeof(dynamic_link),
+                            "https://webapp--rig-attendance-app.asia-east1.hosted.app/scan?%s", token);
+
+    ESP_LOGD(TAG, "Generated link : %s", dynamic_link);
+
+    // The page is sent straight from flash around the link, no copy of it is made
+    const char *after = root_placeholder ? root_placeholder + strlen(ROOT_PLACEHOLDER) : root_end;
+    size_t before_len = (root_placeholder ? root_placeholder : root_end) - root_start;
+    size_t after_len = root_end - after;
 
-    ESP_LOGI(TAG, "Generated link : %s", dynamic_link);
+    power_hold(POWER_LOCK_HTTP);
+    ALLOC_TRACE_EXEMPT_BEGIN();
+    esp_err_t err = resp->begin(resp->ctx, "200 OK", "text/html", NULL);
+    if (err == ESP_OK)
+        err = resp->send(root_start, before_len, resp->ctx);
+    if (err == ESP_OK && root_placeholder)
+        err = resp->send(dynamic_link, link_len, resp->ctx);
+    if (err == ESP_OK && after_len > 0)
+        err = resp->send(after, after_len, resp->ctx);
+    ALLOC_TRACE_EXEMPT_END();
+    power_release(POWER_LOCK_HTTP);
 
-    // Replace template placeholder with dynamic link
-    char *placeholder = strstr(html_content, "{{DYNAMIC_LINK}}");
-    if (placeholder != NULL)
+    if (err == ESP_OK)
     {
-        // Calculate positions and lengths
-        size_t before_len = placeholder - html_content;
-        size_t placeholder_len = strlen("{{DYNAMIC_LINK}}");
-        size_t after_len = strlen(placeholder + placeholder_len);
-        size_t dynamic_link_len = strlen(dynamic_link);
-
-        // Check if we have enough space
-        size_t new_total_len = before_len + dynamic_link_len + after_len;
-        if (new_total_len < content_length + 300)
-        {
-            // Shift content to make room for new link
-            memmove(placeholder + dynamic_link_len,
-                    placeholder + placeholder_len,
-                    after_len + 1); // +1 for null terminator
-
-            // Insert new link
-            memcpy(placeholder, dynamic_link, dynamic_link_len);
-
-            content_length = new_total_len;
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Not enough space to replace placeholder");
-        }
+        esp_ip4_addr_t client = {.addr = resp->client_ip};
+        FASTLOG_I(TAG, "Served root (%d bytes) to " IPSTR, (int)(before_len + link_len + after_len), IP2STR(&client));
+        softap_clients_link_served(client.addr);
     }
-    else
+    int32_t latency_ms = (int32_t)((esp_timer_get_time() - started_us) / 1000);
+    if (err == ESP_OK)
     {
-        ESP_LOGW(TAG, "Template placeholder not found in HTML");
+        journal_record_token(0, token, latency_ms);
+        boot_kpi_reached(BOOT_KPI_FIRST_PAGE);
     }
+    metrics_observe(root_latency_metric, latency_ms);
+    ALLOC_TRACE_STEADY_END();
+    trace_span_end("http_root");
 
-    ESP_LOGI(TAG, "Serve Root");
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, html_content, content_length);
+    return err;
+}
 
-    free(html_content);
+// Redirects any other request to the root page
+static esp_err_t serve_redirect(const portal_response_t *resp)
+{
+    if (!portal_admit(resp->client_ip))
+        return ESP_FAIL;
+
+    metrics_inc(redirects_metric);
+
+    esp_err_t err = resp->begin(resp->ctx, "302 Temporary Redirect", "text/html", "/");
+    // iOS requires content in the response to detect a captive portal, simply redirecting is not sufficient.
+    if (err == ESP_OK)
+        err = resp->send("Redirect", strlen("Redirect"), resp->ctx);
+    return err;
+}
+
+#if PORTAL_DIAGNOSTICS
+// Diagnostics are for whoever looks after the device over the uplink; anyone on the open SoftAP just gets the portal
+static bool diagnostics_allowed(uint32_t ip)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return true;
+#else
+    esp_netif_ip_info_t ap;
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    if (ip == 0 || netif == NULL || esp_netif_get_ip_info(netif, &ap) != ESP_OK)
+        return false;
+    return (ip & ap.netmask.addr) != (ap.ip.addr & ap.netmask.addr);
+#endif
+}
+
+// Prometheus scrape target, charged to the rate limiter like the portal pages
+static esp_err_t serve_metrics(const portal_response_t *resp)
+{
+    if (!diagnostics_allowed(resp->client_ip))
+        return serve_redirect(resp);
+    if (resp->client_ip != 0 && !rate_limiter_allow(resp->client_ip))
+        return ESP_FAIL;
+
+    // The soak test fails on any steady-state allocation, collected here so a scrape sees the current count
+    alloc_trace_stats_t alloc_stats;
+    alloc_trace_get_stats(&alloc_stats);
+    metrics_set(alloc_violations_metric, alloc_stats.violations);
+    metrics_set(alloc_exempt_metric, alloc_stats.exempt);
+
+    char buf[512];
+    esp_err_t err = resp->begin(resp->ctx, "200 OK", "text/plain; version=0.0.4", NULL);
+    if (err == ESP_OK)
+        err = metrics_render(buf, sizeof(buf), resp->send, resp->ctx);
+    return err;
+}
+
+// Dumps the scheduler trace, tools/trace_to_chrome.py turns it into something Perfetto can open
+static esp_err_t serve_trace(const portal_response_t *resp)
+{
+    if (!diagnostics_allowed(resp->client_ip))
+        return serve_redirect(resp);
+    if (resp->client_ip != 0 && !rate_limiter_allow(resp->client_ip))
+        return ESP_FAIL;
+
+    char buf[512];
+    esp_err_t err = resp->begin(resp->ctx, "200 OK", "text/plain", NULL);
+    if (err == ESP_OK)
+        err = trace_dump(buf, sizeof(buf), resp->send, resp->ctx);
+    return err;
+}
+
+// Boot stages and the time to the first tap and page, small enough to go in one piece
+static esp_err_t serve_boot(const portal_response_t *resp)
+{
+    if (!diagnostics_allowed(resp->client_ip))
+        return serve_redirect(resp);
+    if (resp->client_ip != 0 && !rate_limiter_allow(resp->client_ip))
+        return ESP_FAIL;
+
+    char buf[512];
+    size_t len = boot_timeline_format(buf, sizeof(buf));
+    esp_err_t err = resp->begin(resp->ctx, "200 OK", "text/plain", NULL);
+    if (err == ESP_OK)
+        err = resp->send(buf, len, resp->ctx);
+    return err;
+}
+
+// Lock hold times and the time spent in each power state, see power.h
+static esp_err_t serve_power(const portal_response_t *resp)
+{
+    if (!diagnostics_allowed(resp->client_ip))
+        return serve_redirect(resp);
+    if (resp->client_ip != 0 && !rate_limiter_allow(resp->client_ip))
+        return ESP_FAIL;
+
+    // esp_pm's dump goes through stdio, whose formatting is deep already; only one request is served at a time
+    static char buf[1024];
+    size_t len = power_format(buf, sizeof(buf));
+    esp_err_t err = resp->begin(resp->ctx, "200 OK", "text/plain", NULL);
+    if (err == ESP_OK)
+        err = resp->send(buf, len, resp->ctx);
+    return err;
+}
+#endif
+
+// httpd transport: chunked responses, httpd closes the session when a handler returns ESP_FAIL
+
+static esp_err_t portal_session_open(httpd_handle_t hd, int sockfd)
+{
+    return portal_accepts(get_client_ip(sockfd)) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t httpd_begin(void *ctx, const char *status, const char *type, const char *location)
+{
+    httpd_req_t *req = (httpd_req_t *)ctx;
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, type);
+    if (location)
+        httpd_resp_set_hdr(req, "Location", location);
     return ESP_OK;
 }
 
-// This handler redirects any other request to the root page.
+static esp_err_t send_chunk(const char *data, size_t len, void *ctx)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len);
+}
+
+static portal_response_t httpd_response(httpd_req_t *req)
+{
+    return {get_client_ip(httpd_req_to_sockfd(req)), httpd_begin, send_chunk, req};
+}
+
+// Terminate the chunked body of a page that went out whole
+static esp_err_t httpd_finish(httpd_req_t *req, esp_err_t err)
+{
+    return err == ESP_OK ? httpd_resp_send_chunk(req, NULL, 0) : ESP_FAIL;
+}
+
+static esp_err_t root_get_handler(httpd_req_t *req)
+{
+    portal_response_t resp = httpd_response(req);
+    return httpd_finish(req, serve_root(&resp, (HMACTokenGenerator *)req->user_ctx));
+}
+
 esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err)
 {
-    // Set status
-    httpd_resp_set_status(req, "302 Temporary Redirect");
-    // Redirect to the "/" root directory
-    httpd_resp_set_hdr(req, "Location", "/");
-    // iOS requires content in the response to detect a captive portal, simply redirecting is not sufficient.
-    httpd_resp_send(req, "Redirect", HTTPD_RESP_USE_STRLEN);
+    portal_response_t resp = httpd_response(req);
+    return httpd_finish(req, serve_redirect(&resp));
+}
 
-    return ESP_OK;
+#if PORTAL_DIAGNOSTICS
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    portal_response_t resp = httpd_response(req);
+    return httpd_finish(req, serve_metrics(&resp));
+}
+
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
+    portal_response_t resp = httpd_response(req);
+    return httpd_finish(req, serve_trace(&resp));
+}
+
+static esp_err_t boot_get_handler(httpd_req_t *req)
+{
+    portal_response_t resp = httpd_response(req);
+    return httpd_finish(req, serve_boot(&resp));
+}
+
+static esp_err_t power_get_handler(httpd_req_t *req)
+{
+    portal_response_t resp = httpd_response(req);
+    return httpd_finish(req, serve_power(&resp));
+}
+#endif
+
+// Reactor transport: close-delimited responses, the reactor closes the connection once a page returns
+
+static bool reactor_accepts(uint32_t ip, void *ctx)
+{
+    return portal_accepts(ip);
+}
+
+static esp_err_t reactor_begin(void *ctx, const char *status, const char *type, const char *location)
+{
+    return net_reactor_send_head((net_reactor_conn_t *)ctx, status, type, location);
+}
+
+// The same routes as registered with httpd, anything else is redirected
+static void reactor_request(net_reactor_conn_t *conn, const char *method, const char *uri, void *ctx)
+{
+    portal_response_t resp = {net_reactor_client_ip(conn), reactor_begin, net_reactor_send, conn};
+    bool get = strcmp(method, "GET") == 0;
+
+    if (get && strcmp(uri, "/") == 0)
+        serve_root(&resp, (HMACTokenGenerator *)ctx);
+#if PORTAL_DIAGNOSTICS
+    else if (get && strcmp(uri, "/metrics") == 0)
+        serve_metrics(&resp);
+    else if (get && strcmp(uri, "/trace") == 0)
+        serve_trace(&resp);
+    else if (get && strcmp(uri, "/boot") == 0)
+        serve_boot(&resp);
+    else if (get && strcmp(uri, "/power") == 0)
+        serve_power(&resp);
+#endif
+    else
+        serve_redirect(&resp);
+}
+
+// Metrics and the page template, shared by both transports
+static void portal_init(void)
+{
+    root_latency_metric = metrics_histogram("portal_root_duration_ms", "Time to render and send the portal page",
+                                            root_latency_bounds_ms, sizeof(root_latency_bounds_ms) / sizeof(root_latency_bounds_ms[0]));
+    root_placeholder = (const char *)memmem(root_start, root_end - root_start, ROOT_PLACEHOLDER, strlen(ROOT_PLACEHOLDER));
+    if (root_placeholder == NULL)
+        ESP_LOGW(TAG, "Template placeholder not found in HTML");
+
+    portal_tokens_metric = metrics_counter("portal_tokens_total", "Tokens generated for the portal page");
+    redirects_metric = metrics_counter("portal_redirects_total", "Requests redirected to the portal page");
+    alloc_violations_metric = metrics_gauge("alloc_steady_violations", "Heap allocations in steady-state paths after boot");
+    alloc_exempt_metric = metrics_gauge("alloc_steady_exempt", "Heap allocations inside third-party calls on steady-state paths");
+}
+
+void start_portal_reactor(HMACTokenGenerator *hmac_generator, const net_reactor_udp_t *udp, const task_config_t *task)
+{
+    portal_init();
+
+    net_reactor_config_t config = {
+        .http_port = PORTAL_PORT,
+        .max_clients = PORTAL_MAX_OPEN_SOCKETS,
+        .admit = reactor_accepts,
+        .handler = reactor_request,
+        .ctx = hmac_generator,
+        .udp = udp,
+        .task = task,
+    };
+    if (net_reactor_start(&config) == ESP_OK)
+        system_ready_set(SYSTEM_READY_PORTAL);
 }
 
-httpd_handle_t start_webserver(HMACTokenGenerator *hmac_generator)
+void start_webserver(HMACTokenGenerator *hmac_generator, const task_config_t *task)
 {
+    portal_init();
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.lru_purge_enable = true;
-    config.max_open_sockets = 3;
+    config.max_open_sockets = PORTAL_MAX_OPEN_SOCKETS;
+    config.open_fn = portal_session_open;
+    config.server_port = PORTAL_PORT;
+    config.stack_size = task_config_stack_size(task);
+    config.task_priority = task->priority;
+    config.core_id = task_config_core(task);
     httpd_handle_t server = NULL;
 
     ESP_LOGI(TAG, "Starting Server on Port: '%d'", config.server_port);
@@ -125,11 +433,46 @@ httpd_handle_t start_webserver(HMACTokenGenerator *hmac_generator)
             .user_ctx = hmac_generator,
         };
 
+#if PORTAL_DIAGNOSTICS
+        httpd_uri_t metrics = {
+            .uri = "/metrics",
+            .method = HTTP_GET,
+            .handler = metrics_get_handler,
+            .user_ctx = NULL,
+        };
+
+        httpd_uri_t trace = {
+            .uri = "/trace",
+            .method = HTTP_GET,
+            .handler = trace_get_handler,
+            .user_ctx = NULL,
+        };
+
+        httpd_uri_t boot = {
+            .uri = "/boot",
+            .method = HTTP_GET,
+            .handler = boot_get_handler,
+            .user_ctx = NULL,
+        };
+
+        httpd_uri_t power = {
+            .uri = "/power",
+            .method = HTTP_GET,
+            .handler = power_get_handler,
+            .user_ctx = NULL,
+        };
+#endif
+
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
         httpd_register_uri_handler(server, &root);
+#if PORTAL_DIAGNOSTICS
+        httpd_register_uri_handler(server, &metrics);
+        httpd_register_uri_handler(server, &trace);
+        httpd_register_uri_handler(server, &boot);
+        httpd_register_uri_handler(server, &power);
+#endif
         httpd_register_err_handler(server, HTTPD_404_NOT_FOUND, http_404_error_handler);
+        system_ready_set(SYSTEM_READY_PORTAL);
     }
-
-    return server;
 }
\ No newline at end of file
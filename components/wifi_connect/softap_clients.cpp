@@ -0,0 +1,207 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+
+#include "softap_clients.h"
+#include "wifi_ap_sta.h"
+
+static const char *TAG = "WIFI_AP";
+
+typedef struct
+{
+    bool in_use;
+    bool link_served;
+    bool evicted;
+    uint8_t mac[6];
+    TickType_t joined;
+    TickType_t link_served_at; // First time the link was served
+    uint16_t links_served;
+} client_t;
+
+static client_t clients[WIFI_AP_MAX_CONNECTIONS];
+static wifi_ap_client_stats_t client_stats;
+static portMUX_TYPE clients_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Must hold clients_lock
+static client_t *find_client(const uint8_t mac[6])
+{
+    for (int i = 0; i < WIFI_AP_MAX_CONNECTIONS; i++)
+    {
+        if (clients[i].in_use && memcmp(clients[i].mac, mac, 6) == 0)
+            return &clients[i];
+    }
+    return NULL;
+}
+
+// Disassociate clients that got their link, freeing the slot for the next student in line
+static void evict_timer_cb(TimerHandle_t xTimer)
+{
+    uint8_t macs[WIFI_AP_MAX_CONNECTIONS][6];
+    int count = 0;
+    TickType_t now = xTaskGetTickCount();
+
+    taskENTER_CRITICAL(&clients_lock);
+    for (int i = 0; i < WIFI_AP_MAX_CONNECTIONS; i++)
+    {
+        client_t *client = &clients[i];
+        if (client->in_use && client->link_served && !client->evicted &&
+            now - client->link_served_at >= pdMS_TO_TICKS(WIFI_AP_LINK_GRACE_MS))
+        {
+            client->evicted = true;
+            memcpy(macs[count++], client->mac, 6);
+        }
+    }
+    taskEXIT_CRITICAL(&clients_lock);
+
+    // The driver calls can't run inside the critical section
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t aid;
+        esp_err_t err = esp_wifi_ap_get_sta_aid(macs[i], &aid);
+        if (err == ESP_OK)
+            err = esp_wifi_deauth_sta(aid);
+        if (err == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Station " MACSTR " evicted, link already served", MAC2STR(macs[i]));
+            continue;
+        }
+
+        // Still holding the slot, try again on the next check
+        ESP_LOGW(TAG, "Failed to evict station " MACSTR ": %s", MAC2STR(macs[i]), esp_err_to_name(err));
+        taskENTER_CRITICAL(&clients_lock);
+        client_t *client = find_client(macs[i]);
+        if (client != NULL)
+            client->evicted = false;
+        taskEXIT_CRITICAL(&clients_lock);
+    }
+}
+
+void softap_clients_init(void)
+{
+    static StaticTimer_t evict_timer_buffer;
+    TimerHandle_t evict_timer = xTimerCreateStatic("ap_evict_timer",
+                                                   pdMS_TO_TICKS(WIFI_AP_EVICT_CHECK_MS),
+                                                   pdTRUE,
+                                                   NULL,
+                                                   evict_timer_cb,
+                                                   &evict_timer_buffer);
+    if (evict_timer == NULL || xTimerStart(evict_timer, 0) != pdPASS)
+        ESP_LOGE(TAG, "Failed to start SoftAP eviction timer");
+}
+
+void softap_clients_on_join(const uint8_t mac[6])
+{
+    taskENTER_CRITICAL(&clients_lock);
+
+    client_t *client = find_client(mac);
+    for (int i = 0; client == NULL && i < WIFI_AP_MAX_CONNECTIONS; i++)
+    {
+        if (!clients[i].in_use)
+            client = &clients[i];
+    }
+
+    if (client != NULL)
+    {
+        memset(client, 0, sizeof(*client));
+        client->in_use = true;
+        memcpy(client->mac, mac, 6);
+        client->joined = xTaskGetTickCount();
+
+        client_stats.joins++;
+        client_stats.current_clients++;
+        if (client_stats.current_clients > client_stats.peak_clients)
+            client_stats.peak_clients = client_stats.current_clients;
+    }
+
+    taskEXIT_CRITICAL(&clients_lock);
+}
+
+void softap_clients_on_leave(const uint8_t mac[6])
+{
+    uint32_t dwell_ms = 0;
+    uint16_t links_served = 0;
+
+    taskENTER_CRITICAL(&clients_lock);
+
+    client_t *client = find_client(mac);
+    if (client != NULL)
+    {
+        client->in_use = false;
+        dwell_ms = pdTICKS_TO_MS(xTaskGetTickCount() - client->joined);
+        links_served = client->links_served;
+
+        client_stats.left++;
+        client_stats.current_clients--;
+        client_stats.total_dwell_ms += dwell_ms;
+        if (dwell_ms > client_stats.max_dwell_ms)
+            client_stats.max_dwell_ms = dwell_ms;
+        if (client->link_served)
+            client_stats.clients_served++;
+        if (client->evicted)
+            client_stats.evictions++;
+    }
+
+    taskEXIT_CRITICAL(&clients_lock);
+
+    if (client != NULL)
+        ESP_LOGI(TAG, "Station " MACSTR " stayed %" PRIu32 " s, %u links served", MAC2STR(mac), dwell_ms / 1000,
+                 links_served);
+}
+
+void softap_clients_link_served(uint32_t ip)
+{
+    // The portal only knows the IP, the DHCP server maps station MACs to their leases
+    esp_netif_pair_mac_ip_t pairs[WIFI_AP_MAX_CONNECTIONS];
+    int count = 0;
+
+    taskENTER_CRITICAL(&clients_lock);
+    for (int i = 0; i < WIFI_AP_MAX_CONNECTIONS; i++)
+    {
+        if (clients[i].in_use)
+        {
+            memcpy(pairs[count].mac, clients[i].mac, 6);
+            pairs[count].ip.addr = 0;
+            count++;
+        }
+    }
+    taskEXIT_CRITICAL(&clients_lock);
+
+    esp_netif_t *ap_netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    if (count == 0 || esp_netif_dhcps_get_clients_by_mac(ap_netif, count, pairs) != ESP_OK)
+        return;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (pairs[i].ip.addr != ip)
+            continue;
+
+        taskENTER_CRITICAL(&clients_lock);
+        client_stats.links_served++;
+        client_t *client = find_client(pairs[i].mac);
+        if (client != NULL)
+        {
+            client->links_served++;
+            if (!client->link_served)
+            {
+                client->link_served = true;
+                client->link_served_at = xTaskGetTickCount();
+            }
+        }
+        taskEXIT_CRITICAL(&clients_lock);
+        return;
+    }
+}
+
+void wifi_ap_get_client_stats(wifi_ap_client_stats_t *stats)
+{
+    taskENTER_CRITICAL(&clients_lock);
+    *stats = client_stats;
+    taskEXIT_CRITICAL(&clients_lock);
+}
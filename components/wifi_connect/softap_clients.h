@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Start the eviction timer, called once the SoftAP is up
+ */
+void softap_clients_init(void);
+
+/**
+ * @brief Track a station that joined the SoftAP
+ */
+void softap_clients_on_join(const uint8_t mac[6]);
+
+/**
+ * @brief Stop tracking a station and fold its dwell time into the stats
+ */
+void softap_clients_on_leave(const uint8_t mac[6]);
+
+/**
+ * @brief Note that a client received its attendance link, it is disassociated WIFI_AP_LINK_GRACE_MS later
+ * @param ip Client address in network byte order
+ */
+void softap_clients_link_served(uint32_t ip);
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <inttypes.h>
 
 #include "esp_mac.h"
 #include "esp_wifi.h"
@@ -12,13 +13,45 @@
 
 #include "wifi_ap_sta.h"
 #include "time_sync.h"
+#include "rate_limiter.h"
+#include "bssid_cache.h"
+#include "wifi_credentials.h"
+#include "softap_clients.h"
+#include "system_ready.h"
+#include "metrics.h"
+#include "trace.h"
+
+// Every station needs a DHCP lease, and the driver has a hard limit of its own
+#if WIFI_AP_MAX_CONNECTIONS > CONFIG_LWIP_DHCPS_MAX_STATION_NUM || WIFI_AP_MAX_CONNECTIONS > ESP_WIFI_MAX_CONN_NUM
+#error "WIFI_AP_MAX_CONNECTIONS exceeds the DHCP server or driver station limit"
+#endif
 
 static const char *TAG = "WIFI_AP";
 static const char *TAG2 = "WIFI_STA";
 
+// Event group bits, outcome of the pending STA connection attempt and whether one is needed at all
+#define STA_CONNECTED_BIT BIT0
+#define STA_FAILED_BIT BIT1
+#define STA_RECONNECT_BIT BIT2
+
 static EventGroupHandle_t wifi_event_group;
 static TaskHandle_t wifi_scan_task_handle = NULL;
-static bool sta_connected = false;
+
+static const char *const strategy_names[WIFI_RECONNECT_STRATEGY_MAX] = {"directed", "channel scan", "full scan"};
+static wifi_reconnect_stats_t reconnect_stats[WIFI_RECONNECT_STRATEGY_MAX];
+static wifi_scan_stats_t scan_stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Last time a station joined or the portal served a request
+static volatile TickType_t last_portal_activity = 0;
+
+// Time the successful reconnect strategy took, its scan included
+static const int32_t reconnect_bounds_ms[] = {500, 1000, 2000, 5000, 10000, 30000, 60000, 300000};
+static metric_t *ap_stations_metric = NULL;
+static metric_t *sta_disconnects_metric = NULL;
+static metric_t *sta_reconnect_metric = NULL;
+static metric_t *sta_rssi_metric = NULL;
+static int32_t ap_stations = 0; // Only touched by the event handler
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
@@ -27,33 +60,46 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
     {
         wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
         ESP_LOGI(TAG, "Station " MACSTR " Connected", MAC2STR(event->mac));
+        softap_clients_on_join(event->mac);
+        wifi_note_portal_activity();
+        metrics_set(ap_stations_metric, ++ap_stations);
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED)
     {
         wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
         ESP_LOGI(TAG, "Station " MACSTR " Disconnected", MAC2STR(event->mac));
+        softap_clients_on_leave(event->mac);
+        rate_limiter_log_stats();
+        if (ap_stations > 0)
+            metrics_set(ap_stations_metric, --ap_stations);
     }
     // Handle STA events
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
         ESP_LOGI(TAG2, "WiFi started, beginning scan for target network");
+        xEventGroupSetBits(wifi_event_group, STA_RECONNECT_BIT);
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
     {
         wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
         ESP_LOGI(TAG2, "Connected to WiFi network: %s", event->ssid);
-        sta_connected = true;
+        system_ready_set(SYSTEM_READY_STA_CONNECTED);
+        xEventGroupClearBits(wifi_event_group, STA_RECONNECT_BIT);
+        xEventGroupSetBits(wifi_event_group, STA_CONNECTED_BIT);
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
         wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
         ESP_LOGI(TAG2, "Disconnected from WiFi network (reason: %d)", event->reason);
-        sta_connected = false;
+        system_ready_clear(SYSTEM_READY_STA_CONNECTED | SYSTEM_READY_STA_GOT_IP);
+        xEventGroupSetBits(wifi_event_group, STA_FAILED_BIT | STA_RECONNECT_BIT);
+        metrics_inc(sta_disconnects_metric);
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
         ESP_LOGI(TAG2, "Got IP address: " IPSTR, IP2STR(&event->ip_info.ip));
+        system_ready_set(SYSTEM_READY_STA_GOT_IP);
 
         // Trigger immediate manual time synchronization when connected
         ESP_LOGI(TAG2, "Triggering immediate time synchronization");
@@ -61,95 +107,313 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
         if (trigger_async_time_sync() != ESP_OK)
             ESP_LOGW(TAG2, "Failed immediate time synchronization");
     }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP)
+    {
+        ESP_LOGI(TAG2, "Lost IP address");
+        system_ready_clear(SYSTEM_READY_STA_GOT_IP);
+    }
+}
+
+static void record_attempt(wifi_reconnect_strategy_t strategy)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    reconnect_stats[strategy].attempts++;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+static void record_off_channel(wifi_reconnect_strategy_t strategy, uint32_t duration_ms)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    reconnect_stats[strategy].off_channel_ms += duration_ms;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+static bool portal_busy(void)
+{
+    return last_portal_activity != 0 && xTaskGetTickCount() - last_portal_activity < pdMS_TO_TICKS(WIFI_SCAN_QUIET_MS);
+}
+
+/*
+    Hold the scan back while students are using the portal, up to WIFI_SCAN_MAX_DEFER_MS
+    returns true if the portal is still busy, in which case the scan has to be kept short
+*/
+static bool wait_for_quiet_portal(void)
+{
+    if (!portal_busy())
+        return false;
+
+    taskENTER_CRITICAL(&stats_lock);
+    scan_stats.scans_deferred++;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(WIFI_SCAN_MAX_DEFER_MS);
+    while (portal_busy())
+    {
+        if ((int32_t)(xTaskGetTickCount() - deadline) >= 0)
+            return true;
+        vTaskDelay(pdMS_TO_TICKS(WIFI_SCAN_QUIET_MS / 2));
+    }
+    return false;
+}
+
+/*
+    Blocking passive scan on one channel or all of them (channel 0), every stored network in a single pass
+    while the portal is busy the radio returns to the SoftAP channel between every scanned channel
+*/
+static bool scan_for_network(wifi_reconnect_strategy_t strategy, uint8_t channel, bool busy, wifi_ap_record_t *best)
+{
+    // Passive scans listen for beacons instead of probing, so a dwell just over one beacon interval finds every AP
+    wifi_scan_config_t scan_config = {
+        .ssid = NULL,
+        .bssid = NULL,
+        .channel = channel,
+        .show_hidden = false,
+        .scan_type = WIFI_SCAN_TYPE_PASSIVE,
+        .scan_time = {
+            .passive = WIFI_SCAN_DWELL_MS,
+        },
+        .home_chan_dwell_time = (uint8_t)(busy ? WIFI_SCAN_BUSY_HOME_DWELL_MS : 0)};
+
+    // Channels the radio leaves the SoftAP for, the SoftAP's own channel costs nothing
+    uint32_t off_channels = 1;
+    if (channel == 0)
+    {
+        wifi_country_t country;
+        off_channels = (esp_wifi_get_country(&country) == ESP_OK) ? country.nchan - 1 : 12;
+    }
+    else if (channel == WIFI_AP_CHANNEL)
+        off_channels = 0;
+
+    taskENTER_CRITICAL(&stats_lock);
+    scan_stats.scans++;
+    if (busy)
+        scan_stats.scans_shortened++;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    uint32_t start_time = esp_log_timestamp();
+    trace_span_begin("wifi_scan");
+    esp_err_t scan_result = esp_wifi_scan_start(&scan_config, true);
+    trace_span_end("wifi_scan");
+    uint32_t duration_ms = esp_log_timestamp() - start_time;
+
+    // Home channel dwell is part of the duration, so take whichever is smaller
+    uint32_t estimate_ms = off_channels * WIFI_SCAN_DWELL_MS;
+    record_off_channel(strategy, duration_ms < estimate_ms ? duration_ms : estimate_ms);
+
+    if (scan_result != ESP_OK)
+    {
+        ESP_LOGW(TAG2, "WiFi scan failed: %s", esp_err_to_name(scan_result));
+        return false;
+    }
+
+    // Rank every AP of every stored network by priority and signal, one record at a time to keep the stack small
+    int32_t best_score = INT32_MIN;
+    int candidates = 0;
+    wifi_ap_record_t record;
+    while (esp_wifi_scan_get_ap_record(&record) == ESP_OK)
+    {
+        int32_t score = wifi_credentials_score((const char *)record.ssid, record.rssi);
+        if (score == INT32_MIN)
+            continue;
+
+        candidates++;
+        if (score > best_score)
+        {
+            best_score = score;
+            *best = record;
+        }
+    }
+    esp_wifi_clear_ap_list();
+
+    if (candidates > 0)
+        ESP_LOGI(TAG2, "%d candidate APs, best '%s' (%d dBm)", candidates, (const char *)best->ssid, best->rssi);
+    return candidates > 0;
+}
+
+/*
+    Connect to one AP and wait for the outcome
+    started_ms is when this strategy began, so its scan counts towards the time to connect
+*/
+static bool connect_and_wait(wifi_reconnect_strategy_t strategy, const wifi_credential_t *credential,
+                             const uint8_t *bssid, uint8_t channel, uint32_t started_ms)
+{
+    // Configure WiFi STA settings
+    wifi_config_t wifi_config = {
+        .sta = {
+            .threshold = {
+                .authmode = credential->password[0] ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN,
+            },
+            .pmf_cfg = {
+                .capable = true,
+                .required = false,
+            }}};
+
+    strncpy((char *)wifi_config.sta.ssid, credential->ssid, sizeof(wifi_config.sta.ssid));
+    strncpy((char *)wifi_config.sta.password, credential->password, sizeof(wifi_config.sta.password));
+
+    // Pinning BSSID and channel lets the driver skip its own all-channel probe
+    memcpy(wifi_config.sta.bssid, bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = channel;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+
+    xEventGroupClearBits(wifi_event_group, STA_CONNECTED_BIT | STA_FAILED_BIT);
+
+    uint32_t connect_start = esp_log_timestamp();
+    esp_err_t connect_result = esp_wifi_connect();
+    if (connect_result != ESP_OK)
+    {
+        ESP_LOGW(TAG2, "Failed to initiate WiFi connection: %s", esp_err_to_name(connect_result));
+        return false;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
+                                           STA_CONNECTED_BIT | STA_FAILED_BIT,
+                                           pdFALSE,
+                                           pdFALSE,
+                                           pdMS_TO_TICKS(WIFI_STA_CONNECT_TIMEOUT_MS));
+
+    uint32_t now = esp_log_timestamp();
+    if (channel != WIFI_AP_CHANNEL)
+        record_off_channel(strategy, now - connect_start);
+
+    if (!(bits & STA_CONNECTED_BIT))
+    {
+        if (bits == 0)
+        {
+            // Abort the attempt and let its disconnect event pass, so it can't fail the next one
+            esp_wifi_disconnect();
+            xEventGroupWaitBits(wifi_event_group, STA_FAILED_BIT, pdTRUE, pdFALSE, pdMS_TO_TICKS(1000));
+        }
+        ESP_LOGI(TAG2, "Connection via %s did not succeed", strategy_names[strategy]);
+        return false;
+    }
+
+    uint32_t connect_ms = now - started_ms;
+    metrics_observe(sta_reconnect_metric, (int32_t)connect_ms);
+    taskENTER_CRITICAL(&stats_lock);
+    reconnect_stats[strategy].successes++;
+    reconnect_stats[strategy].last_connect_ms = connect_ms;
+    reconnect_stats[strategy].total_connect_ms += connect_ms;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    ESP_LOGI(TAG2, "Connected to '%s' via %s in %" PRIu32 " ms (off-channel %" PRIu32 " ms so far)",
+             credential->ssid, strategy_names[strategy], connect_ms, reconnect_stats[strategy].off_channel_ms);
+
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
+    {
+        bssid_cache_save(credential->ssid, ap_info.bssid, ap_info.primary);
+        metrics_set(sta_rssi_metric, ap_info.rssi);
+    }
+
+    return true;
+}
+
+/*
+    Cheapest first: the AP that worked last time, then a scan of its channel only,
+    and the all-channel sweep only if both fail. While the portal is busy the sweep
+    waits for a later round whenever there is a cached channel to fall back on.
+*/
+static bool reconnect_sync_network(bool busy)
+{
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    bool cached = bssid_cache_load(ssid, bssid, &channel);
+    wifi_credential_t credential;
+    wifi_ap_record_t ap;
+    uint32_t start_time;
+
+    if (cached)
+    {
+        // The network may have been removed from the store since
+        if (wifi_credentials_find(ssid, &credential))
+        {
+            ESP_LOGI(TAG2, "Connecting directly to '%s' at " MACSTR " on channel %d", ssid, MAC2STR(bssid), channel);
+            record_attempt(WIFI_RECONNECT_DIRECTED);
+            if (connect_and_wait(WIFI_RECONNECT_DIRECTED, &credential, bssid, channel, esp_log_timestamp()))
+                return true;
+        }
+
+        // The AP may have been replaced or rebooted with a new BSSID, look on the same channel first
+        start_time = esp_log_timestamp();
+        record_attempt(WIFI_RECONNECT_CHANNEL_SCAN);
+        if (scan_for_network(WIFI_RECONNECT_CHANNEL_SCAN, channel, busy, &ap) &&
+            wifi_credentials_find((const char *)ap.ssid, &credential) &&
+            connect_and_wait(WIFI_RECONNECT_CHANNEL_SCAN, &credential, ap.bssid, ap.primary, start_time))
+            return true;
+
+        if (busy)
+        {
+            ESP_LOGI(TAG2, "Portal busy, full scan postponed");
+            return false;
+        }
+    }
+
+    ESP_LOGI(TAG2, "Scanning for stored WiFi networks");
+
+    start_time = esp_log_timestamp();
+    record_attempt(WIFI_RECONNECT_FULL_SCAN);
+    if (!scan_for_network(WIFI_RECONNECT_FULL_SCAN, 0, busy, &ap) ||
+        !wifi_credentials_find((const char *)ap.ssid, &credential))
+    {
+        ESP_LOGD(TAG2, "No stored WiFi network found in scan results");
+        return false;
+    }
+
+    ESP_LOGI(TAG2, "Target WiFi network found! Attempting to connect...");
+    return connect_and_wait(WIFI_RECONNECT_FULL_SCAN, &credential, ap.bssid, ap.primary, start_time);
 }
 
 static void wifi_scan_and_connect_task(void *pvParameters)
 {
     ESP_LOGI(TAG2, "WiFi scan task started");
 
+    uint32_t backoff_ms = WIFI_CONNECT_RETRY_DELAY_MS;
+
     while (1)
     {
-        if (sta_connected)
-        {
-            ESP_LOGI(TAG2, "STA already connected, next scan in %d seconds", WIFI_SCAN_INTERVAL_MS / 1000);
-            vTaskDelay(pdMS_TO_TICKS(WIFI_SCAN_INTERVAL_MS));
-        }
-        else
+        // Nothing to do while connected, the disconnect event wakes the task up again
+        xEventGroupWaitBits(wifi_event_group, STA_RECONNECT_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+
+        bool busy = wait_for_quiet_portal();
+        if (reconnect_sync_network(busy))
         {
-            // This takes considerably long time, so measure duration for accurate delay
-            uint32_t start_time = esp_log_timestamp();
-
-            ESP_LOGI(TAG2, "Scanning for WiFi network: %s", WIFI_SSID_FOR_SYNC);
-
-            // Start WiFi scan
-            wifi_scan_config_t scan_config = {
-                .ssid = (uint8_t *)WIFI_SSID_FOR_SYNC,
-                .bssid = NULL,
-                .channel = 0,
-                .show_hidden = false,
-                .scan_type = WIFI_SCAN_TYPE_ACTIVE,
-                .scan_time = {
-                    .active = {
-                        .min = 100,
-                        .max = 300,
-                    },
-                }};
-
-            esp_err_t scan_result = esp_wifi_scan_start(&scan_config, true);
-            if (scan_result == ESP_OK)
-            {
-                uint16_t ap_count = 0;
-                esp_wifi_scan_get_ap_num(&ap_count);
-
-                if (ap_count > 0)
-                {
-                    ESP_LOGI(TAG2, "Target WiFi network found! Attempting to connect...");
-
-                    // Configure WiFi STA settings
-                    wifi_config_t wifi_config = {
-                        .sta = {
-                            .ssid = WIFI_SSID_FOR_SYNC,
-                            .password = WIFI_PASS_FOR_SYNC,
-                            .threshold = {
-                                .authmode = WIFI_AUTH_WPA2_PSK,
-                            },
-                            .pmf_cfg = {
-                                .capable = true,
-                                .required = false,
-                            }}};
-
-                    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
-
-                    // Try to connect
-                    esp_err_t connect_result = esp_wifi_connect();
-                    if (connect_result == ESP_OK)
-                        ESP_LOGI(TAG2, "WiFi connection initiated");
-                    else
-                        ESP_LOGW(TAG2, "Failed to initiate WiFi connection: %s", esp_err_to_name(connect_result));
-                }
-                else
-                    ESP_LOGD(TAG2, "Target WiFi network not found in scan results");
-            }
-            else
-                ESP_LOGW(TAG2, "WiFi scan failed: %s", esp_err_to_name(scan_result));
-
-            uint32_t scan_duration = esp_log_timestamp() - start_time;
-
-            // If scan took less than retry delay, wait the remaining time, otherwise retry immediately
-            uint32_t delay_time = (scan_duration < WIFI_CONNECT_RETRY_DELAY_MS) ? (WIFI_CONNECT_RETRY_DELAY_MS - scan_duration) : 0;
-
-            vTaskDelay(pdMS_TO_TICKS(delay_time));
+            backoff_ms = WIFI_CONNECT_RETRY_DELAY_MS;
+            continue;
         }
+
+        // The network is likely absent, scan less and less often until it shows up
+        ESP_LOGI(TAG2, "Next scan in %" PRIu32 " seconds", backoff_ms / 1000);
+        vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+        backoff_ms = (backoff_ms < WIFI_SCAN_MAX_BACKOFF_MS / 2) ? backoff_ms * 2 : WIFI_SCAN_MAX_BACKOFF_MS;
     }
 }
 
-bool is_sta_connected(void) { return sta_connected; }
+bool is_sta_connected(void) { return system_ready_is_set(SYSTEM_READY_STA_CONNECTED); }
+
+void wifi_note_portal_activity(void) { last_portal_activity = xTaskGetTickCount(); }
 
-void wifi_init_softap(void)
+void wifi_get_scan_stats(wifi_scan_stats_t *stats)
 {
-    // Create event group
-    wifi_event_group = xEventGroupCreate();
+    taskENTER_CRITICAL(&stats_lock);
+    *stats = scan_stats;
+    stats->off_channel_ms = 0;
+    for (int i = 0; i < WIFI_RECONNECT_STRATEGY_MAX; i++)
+        stats->off_channel_ms += reconnect_stats[i].off_channel_ms;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+void wifi_get_reconnect_stats(wifi_reconnect_stats_t stats[WIFI_RECONNECT_STRATEGY_MAX])
+{
+    taskENTER_CRITICAL(&stats_lock);
+    memcpy(stats, reconnect_stats, sizeof(reconnect_stats));
+    taskEXIT_CRITICAL(&stats_lock);
+}
 
+void wifi_netif_init(void)
+{
     // Initialize network interface and event loop
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -157,6 +421,19 @@ void wifi_init_softap(void)
     // Create default WiFi AP and STA interfaces
     esp_netif_create_default_wifi_ap();
     esp_netif_create_default_wifi_sta();
+}
+
+void wifi_init_softap(const task_config_t *scan_task)
+{
+    // Create event group
+    static StaticEventGroup_t wifi_event_group_buffer;
+    wifi_event_group = xEventGroupCreateStatic(&wifi_event_group_buffer);
+
+    ap_stations_metric = metrics_gauge("wifi_ap_stations", "Stations associated with the SoftAP");
+    sta_disconnects_metric = metrics_counter("wifi_sta_disconnects_total", "Disconnects from the sync network");
+    sta_reconnect_metric = metrics_histogram("wifi_sta_reconnect_duration_ms", "Time the successful reconnect strategy took",
+                                             reconnect_bounds_ms, sizeof(reconnect_bounds_ms) / sizeof(reconnect_bounds_ms[0]));
+    sta_rssi_metric = metrics_gauge("wifi_sta_rssi_dbm", "Signal strength of the sync network at the last connect");
 
     // Initialize WiFi with default configuration
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -175,6 +452,12 @@ void wifi_init_softap(void)
                                                         NULL,
                                                         NULL));
 
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                                                        IP_EVENT_STA_LOST_IP,
+                                                        &wifi_event_handler,
+                                                        NULL,
+                                                        NULL));
+
     // Configure WiFi AP settings
     wifi_config_t ap_config = {
         .ap = {
@@ -192,6 +475,10 @@ void wifi_init_softap(void)
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &ap_config));
     ESP_ERROR_CHECK(esp_wifi_start());
 
+    // Drop stations that went quiet sooner than the 300 s default, so their slot goes to someone waiting
+    ESP_ERROR_CHECK(esp_wifi_set_inactive_time(WIFI_IF_AP, WIFI_AP_INACTIVE_TIME_S));
+    softap_clients_init();
+
     // Get and display AP IP address
     esp_netif_ip_info_t ip_info;
     esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_AP_DEF"), &ip_info);
@@ -199,11 +486,13 @@ void wifi_init_softap(void)
     char ip_addr[16];
     inet_ntoa_r(ip_info.ip.addr, ip_addr, 16);
     ESP_LOGI(TAG, "WiFi initialized in AP+STA mode. AP SSID: '%s'", WIFI_AP_SSID);
-    ESP_LOGI(TAG2, "Will scan for STA network: '%s'", WIFI_SSID_FOR_SYNC);
+
+    // Networks for the STA to choose from, must be loaded before the scan task starts
+    wifi_credentials_init();
 
     // Start the WiFi scan task (will be suspended when connected)
     if (wifi_scan_task_handle == NULL)
     {
-        xTaskCreate(wifi_scan_and_connect_task, "wifi_scan_task", 4096, NULL, 5, &wifi_scan_task_handle);
+        task_config_create(wifi_scan_and_connect_task, NULL, scan_task, &wifi_scan_task_handle);
     }
 }
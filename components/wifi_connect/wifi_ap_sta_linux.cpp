@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "wifi_ap_sta.h"
+#include "softap_clients.h"
+#include "system_ready.h"
+
+/*
+    Simulation build (IDF_TARGET linux): there is no radio, both interfaces are loopback stand-ins. The
+    "SoftAP" answers at 127.0.0.1, so the DNS server hands out the host's loopback address, and the "STA"
+    is up from the start, the host's own network is the uplink. Virtual phones are told apart by their
+    127.x.y.z source address, which is all the portal and the rate limiter look at.
+*/
+
+static const char *TAG = "WIFI_SIM";
+
+static wifi_ap_client_stats_t client_stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Loopback interface under the key of a default WiFi interface, for code that looks those up
+static void create_loopback_netif(const char *if_key, const char *if_desc, int route_prio)
+{
+    static const esp_netif_ip_info_t loopback = {
+        .ip = {.addr = ESP_IP4TOADDR(127, 0, 0, 1)},
+        .netmask = {.addr = ESP_IP4TOADDR(255, 0, 0, 0)},
+        .gw = {.addr = ESP_IP4TOADDR(127, 0, 0, 1)},
+    };
+
+    esp_netif_inherent_config_t base = {};
+    base.flags = ESP_NETIF_FLAG_AUTOUP;
+    base.ip_info = &loopback;
+    base.if_key = if_key;
+    base.if_desc = if_desc;
+    base.route_prio = route_prio;
+
+    esp_netif_config_t config = {};
+    config.base = &base;
+    if (esp_netif_new(&config) == NULL)
+        ESP_LOGE(TAG, "Failed to create the %s stand-in", if_key);
+}
+
+void wifi_netif_init(void)
+{
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    create_loopback_netif("WIFI_AP_DEF", "ap", 10);
+    create_loopback_netif("WIFI_STA_DEF", "sta", 100);
+}
+
+void wifi_init_softap(const task_config_t *scan_task)
+{
+    // Nothing to scan for, the uplink is there from the start
+    system_ready_set(SYSTEM_READY_STA_CONNECTED | SYSTEM_READY_STA_GOT_IP);
+    ESP_LOGI(TAG, "SoftAP and STA stand-ins up on 127.0.0.1");
+}
+
+bool is_sta_connected(void) { return system_ready_is_set(SYSTEM_READY_STA_CONNECTED); }
+
+void wifi_note_portal_activity(void) {}
+
+void wifi_ap_get_client_stats(wifi_ap_client_stats_t *stats)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    *stats = client_stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+void wifi_get_scan_stats(wifi_scan_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void wifi_get_reconnect_stats(wifi_reconnect_stats_t stats[WIFI_RECONNECT_STRATEGY_MAX])
+{
+    memset(stats, 0, sizeof(wifi_reconnect_stats_t) * WIFI_RECONNECT_STRATEGY_MAX);
+}
+
+// Phones never associate, so there is nobody to track or evict, only the links are counted
+
+void softap_clients_init(void) {}
+
+void softap_clients_on_join(const uint8_t mac[6]) {}
+
+void softap_clients_on_leave(const uint8_t mac[6]) {}
+
+void softap_clients_link_served(uint32_t ip)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    client_stats.links_served++;
+    taskEXIT_CRITICAL(&stats_lock);
+}
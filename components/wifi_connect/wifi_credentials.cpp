@@ -0,0 +1,165 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "wifi_credentials.h"
+#include "wifi_ap_sta.h"
+
+static const char *TAG = "WIFI_CREDENTIALS";
+
+#define NVS_NAMESPACE "wifi_sta"
+#define NVS_KEY "networks"
+
+static SemaphoreHandle_t credentials_mutex = NULL;
+static wifi_credential_t credentials[WIFI_CREDENTIALS_MAX];
+static size_t num_credentials = 0;
+
+// Must hold credentials_mutex
+static int find_index(const char *ssid)
+{
+    for (size_t i = 0; i < num_credentials; i++)
+    {
+        if (strncmp(credentials[i].ssid, ssid, sizeof(credentials[i].ssid)) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+// Must hold credentials_mutex
+static esp_err_t persist(void)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_set_blob(handle, NVS_KEY, credentials, num_credentials * sizeof(credentials[0]));
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to persist networks: %s", esp_err_to_name(err));
+    return err;
+}
+
+void wifi_credentials_init(void)
+{
+    if (credentials_mutex != NULL)
+        return;
+    static StaticSemaphore_t credentials_mutex_buffer;
+    credentials_mutex = xSemaphoreCreateMutexStatic(&credentials_mutex_buffer);
+
+    nvs_handle_t handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        size_t len = sizeof(credentials);
+        if (nvs_get_blob(handle, NVS_KEY, credentials, &len) == ESP_OK && len % sizeof(credentials[0]) == 0)
+            num_credentials = len / sizeof(credentials[0]);
+        nvs_close(handle);
+    }
+
+    for (size_t i = 0; i < num_credentials; i++)
+    {
+        credentials[i].ssid[sizeof(credentials[i].ssid) - 1] = '\0';
+        credentials[i].password[sizeof(credentials[i].password) - 1] = '\0';
+    }
+
+    if (num_credentials == 0)
+    {
+        ESP_LOGI(TAG, "No stored networks, seeding with '%s'", WIFI_SSID_FOR_SYNC);
+        wifi_credentials_add(WIFI_SSID_FOR_SYNC, WIFI_PASS_FOR_SYNC, WIFI_CREDENTIAL_DEFAULT_PRIORITY);
+    }
+    else
+        ESP_LOGI(TAG, "Loaded %d stored networks", (int)num_credentials);
+}
+
+esp_err_t wifi_credentials_add(const char *ssid, const char *password, uint8_t priority)
+{
+    if (ssid == NULL || password == NULL || ssid[0] == '\0' || strlen(ssid) >= sizeof(credentials[0].ssid) ||
+        strlen(password) >= sizeof(credentials[0].password))
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(credentials_mutex, portMAX_DELAY);
+
+    int index = find_index(ssid);
+    if (index < 0)
+    {
+        if (num_credentials == WIFI_CREDENTIALS_MAX)
+        {
+            xSemaphoreGive(credentials_mutex);
+            return ESP_ERR_NO_MEM;
+        }
+        index = (int)num_credentials++;
+    }
+
+    wifi_credential_t *credential = &credentials[index];
+    memset(credential, 0, sizeof(*credential));
+    strcpy(credential->ssid, ssid);
+    strcpy(credential->password, password);
+    credential->priority = priority;
+
+    esp_err_t err = persist();
+    xSemaphoreGive(credentials_mutex);
+    return err;
+}
+
+esp_err_t wifi_credentials_remove(const char *ssid)
+{
+    xSemaphoreTake(credentials_mutex, portMAX_DELAY);
+
+    int index = find_index(ssid);
+    if (index < 0)
+    {
+        xSemaphoreGive(credentials_mutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    memmove(&credentials[index], &credentials[index + 1], (num_credentials - index - 1) * sizeof(credentials[0]));
+    num_credentials--;
+
+    esp_err_t err = persist();
+    xSemaphoreGive(credentials_mutex);
+    return err;
+}
+
+size_t wifi_credentials_list(wifi_credential_t *list, size_t max_entries)
+{
+    xSemaphoreTake(credentials_mutex, portMAX_DELAY);
+
+    size_t count = num_credentials < max_entries ? num_credentials : max_entries;
+    memcpy(list, credentials, count * sizeof(credentials[0]));
+
+    xSemaphoreGive(credentials_mutex);
+    return count;
+}
+
+bool wifi_credentials_find(const char *ssid, wifi_credential_t *credential)
+{
+    xSemaphoreTake(credentials_mutex, portMAX_DELAY);
+
+    int index = find_index(ssid);
+    if (index >= 0)
+        *credential = credentials[index];
+
+    xSemaphoreGive(credentials_mutex);
+    return index >= 0;
+}
+
+int32_t wifi_credentials_score(const char *ssid, int8_t rssi)
+{
+    if (rssi < WIFI_MIN_RSSI)
+        return INT32_MIN;
+
+    xSemaphoreTake(credentials_mutex, portMAX_DELAY);
+
+    int index = find_index(ssid);
+    int32_t score = (index < 0) ? INT32_MIN : credentials[index].priority * WIFI_SCORE_DB_PER_PRIORITY + rssi;
+
+    xSemaphoreGive(credentials_mutex);
+    return score;
+}
@@ -6,9 +6,113 @@
 #include "hmac_token_generator.h"
 #include "time_sync.h"
 #include "nfc.h"
+#include "system_ready.h"
+#include "fastlog.h"
+#include "trace.h"
+#include "alloc_trace.h"
+#include "journal.h"
+#include "boot_timeline.h"
+#include "power.h"
+#include "task_layout.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "nfc_sim.h"
+#endif
 
+static HMACTokenGenerator *hmac_generator = nullptr;
+
+// A boot stage run in a task of its own, which tells app_main when it is done and deletes itself
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+    const task_config_t *task;
+} boot_lane_t;
+
+static TaskHandle_t boot_task_handle = NULL;
+
+static void boot_lane_run(const boot_lane_t *lane)
+{
+    boot_stage_begin(lane->name);
+    lane->run();
+    boot_stage_end(lane->name);
+}
+
+static void boot_lane_task(void *pvParameters)
+{
+    boot_lane_run((const boot_lane_t *)pvParameters);
+    xTaskNotifyGive(boot_task_handle);
+    vTaskDelete(NULL);
+}
+
+// I2C, the tag, the GPO interrupt and the token refresh; the tag is written as soon as the time is valid
+static void boot_nfc(void)
+{
+    start_nfc_task(hmac_generator, &TASK_NFC_GPO);
+#if CONFIG_IDF_TARGET_LINUX
+    // Simulation build: GPO edges come in over UDP from tools/sim_load.py or any other script
+    nfc_sim_start(&TASK_NFC_SIM_GPO);
+#endif
+}
+
+// Web server, DNS and the journal, which only need lwIP and the interfaces, not the WiFi driver
+static void boot_portal(void)
+{
+    static const dns_entry_pair_t dns_rules[] = {
+        {.name = "*", .if_key = "WIFI_AP_DEF"},
+    };
+
+#if NET_REACTOR_ENABLED
+    // One task answers DNS and serves the portal, the DNS server only opens its socket
+    dns_server_config_t config = {
+        .num_of_entries = sizeof(dns_rules) / sizeof(dns_rules[0]),
+        .item = dns_rules,
+        .task = NULL,
+    };
+    dns_server_handle_t dns = start_dns_server(&config);
+
+    net_reactor_udp_t dns_socket = {
+        .sock = dns_server_socket(dns),
+        .on_readable = dns_server_on_readable,
+        .ctx = dns,
+    };
+    start_portal_reactor(hmac_generator, &dns_socket, &TASK_NET_REACTOR);
+#else
+    start_webserver(hmac_generator, &TASK_HTTPD);
+
+    dns_server_config_t config = {
+        .num_of_entries = sizeof(dns_rules) / sizeof(dns_rules[0]),
+        .item = dns_rules,
+        .task = &TASK_DNS_SERVER,
+    };
+    start_dns_server(&config);
+#endif
+
+    // Record of every token handed out, uploaded whenever the STA is up
+    journal_init(&TASK_JOURNAL);
+}
+
+static const boot_lane_t boot_lanes[] = {
+    {.name = "nfc", .run = boot_nfc, .task = &TASK_BOOT_NFC},
+    {.name = "portal", .run = boot_portal, .task = &TASK_BOOT_PORTAL},
+};
+
+/*
+    Boot stages and what each one needs:
+
+        core    NVS, readiness bits, deferred log, trace, PM, HMAC    -
+        time    last known good time, SNTP task                       core
+        netif   lwIP, event loop, AP and STA interfaces                core
+        nfc     I2C, tag, GPO interrupt, token refresh                 core, time     own task, APP CPU
+        portal  web server, DNS, journal                               netif          own task, PRO CPU
+        wifi    WiFi driver in AP+STA, STA scan task                   netif          app_main
+
+    nfc and portal run while the WiFi driver starts, which is the slowest stage. Boot is done when all
+    three are, from then on allocations on the steady-state paths are counted.
+*/
 extern "C" void app_main(void)
 {
+    boot_timeline_init();
+    boot_stage_begin("core");
     esp_log_level_set("httpd_uri", ESP_LOG_ERROR);
     esp_log_level_set("httpd_txrx", ESP_LOG_ERROR);
     esp_log_level_set("httpd_parse", ESP_LOG_ERROR);
@@ -22,20 +126,54 @@ extern "C" void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    // Initialize WiFi in SoftAP mode
-    wifi_init_softap();
+    // Readiness bits shared by all components, must exist before any of them starts
+    system_ready_init();
+
+    // Printer for the deferred hot-path logs, entries queued before this are kept
+    fastlog_init(&TASK_FASTLOG_DRAIN);
+
+    // Flight recorder of context switches and component spans, dumped through GET /trace
+    trace_start();
 
-    // Initialize and start time synchronization
-    time_sync_init();
+    // Scaled-down clock from here on, as far as the SoftAP allows; the tap, token and page paths raise it while they run
+    power_init();
 
     // Initialize HMAC token generator with a secret key
-    HMACTokenGenerator *hmac_generator = new HMACTokenGenerator("your-very-secret-key");
+    static HMACTokenGenerator generator("your-very-secret-key");
+    hmac_generator = &generator;
+    boot_stage_end("core");
 
-    // Initialize Webserver and DNS Server
-    start_webserver(hmac_generator);
-    dns_server_config_t config = DNS_SERVER_CONFIG_SINGLE("*", "WIFI_AP_DEF");
-    start_dns_server(&config);
+    // Restores the last known good time, so the tag can be written before WiFi is up
+    boot_stage_begin("time");
+    time_sync_init(&TASK_TIME_SYNC);
+    boot_stage_end("time");
+
+    boot_stage_begin("netif");
+    wifi_netif_init();
+    boot_stage_end("netif");
+
+    boot_task_handle = xTaskGetCurrentTaskHandle();
+    size_t lanes_started = 0;
+    for (size_t i = 0; i < sizeof(boot_lanes) / sizeof(boot_lanes[0]); i++)
+    {
+        if (task_config_create(boot_lane_task, (void *)&boot_lanes[i], boot_lanes[i].task, NULL) == pdPASS)
+            lanes_started++;
+        else
+        {
+            // The lanes are the one place task_config_create() allocates, they have no static stack, so only a heap
+            // too small for the lane's stack and TCB gets here. Run it inline, better late than never.
+            boot_lane_run(&boot_lanes[i]);
+        }
+    }
+
+    boot_stage_begin("wifi");
+    wifi_init_softap(&TASK_WIFI_SCAN);
+    boot_stage_end("wifi");
+
+    for (size_t i = 0; i < lanes_started; i++)
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    boot_timeline_done();
 
-    // Start NFC task for periodic updates and tap detection
-    start_nfc_task(hmac_generator);
-}
\ No newline at end of file
+    // Everything from here on is steady state, allocations on its paths are counted
+    alloc_trace_arm();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "task_config.h"
+#include "net_reactor.h"
+
+/*
+    Every task the application creates, in one place. Stacks and TCBs are static, only httpd and the
+    boot stage tasks, which are gone once boot is done, allocate theirs.
+
+    Core: the tap path and token generation run on the APP CPU, away from the WiFi and lwIP tasks, which
+    ESP-IDF keeps on the PRO CPU together with everything that talks to the network.
+
+    Priority tiers: tap handling preempts everything of ours, the request/reply services come next, and
+    work nobody waits on runs last. All of them stay below lwIP (18) and the WiFi driver (23).
+
+    Stack sizes: none is below the former blanket 4096 until a TASK_CONFIG_PROFILE build has measured it,
+    that build logs the high-water marks and a suggested size for every task in this table. Sizes above
+    4096 are estimates of what the task keeps on its stack plus margin. Replace a size only with the
+    profiled figure, and profile again after changing what a task does.
+
+    The timer daemon, which refreshes the NFC token, is not created here: sdkconfig pins it to the APP CPU
+    at priority 8 (CONFIG_FREERTOS_TIMER_TASK_*), between the tap path and the network services.
+*/
+
+// Boot stages running next to the WiFi start in app_main, tag on the APP CPU and portal on the PRO CPU
+static const task_config_t TASK_BOOT_NFC = {
+    .name = "boot_nfc",
+    .stack_size = 4096,
+    .priority = 5,
+    .core = TASK_CORE_APP,
+    .stack = NULL,
+    .tcb = NULL,
+};
+
+static const task_config_t TASK_BOOT_PORTAL = {
+    .name = "boot_portal",
+    .stack_size = 4096,
+    .priority = 5,
+    .core = TASK_CORE_PRO,
+    .stack = NULL,
+    .tcb = NULL,
+};
+
+// Tap path, blocked on the GPO interrupt and writing the tag while the phone is in the field
+TASK_CONFIG_DEFINE(TASK_NFC_GPO, "gpo_event_task", 4096, 10, TASK_CORE_APP);
+
+#if CONFIG_IDF_TARGET_LINUX
+// Simulation build: stands in for the GPO interrupt, waits on the tap path it triggers so stays below it
+TASK_CONFIG_DEFINE(TASK_NFC_SIM_GPO, "nfc_sim_gpo", 4096, 9, TASK_CORE_APP);
+#endif
+
+// Request/reply services
+#if NET_REACTOR_ENABLED
+// DNS and the portal's HTTP connections in one select() loop; a DNS reply can run on top of a page whose send is
+// waiting for the client, so it is as deep as both together
+TASK_CONFIG_DEFINE(TASK_NET_REACTOR, "net_reactor", 6144, 6, TASK_CORE_PRO);
+#else
+// httpd creates its own task, only the stack size, priority and core are taken from here
+static const task_config_t TASK_HTTPD = {
+    .name = "httpd",
+    .stack_size = 4608,
+    .priority = 6,
+    .core = TASK_CORE_PRO,
+    .stack = NULL,
+    .tcb = NULL,
+};
+
+TASK_CONFIG_DEFINE(TASK_DNS_SERVER, "dns_server", 4096, 6, TASK_CORE_PRO);
+#endif
+
+// Background
+TASK_CONFIG_DEFINE(TASK_WIFI_SCAN, "wifi_scan_task", 4096, 4, TASK_CORE_PRO);
+
+TASK_CONFIG_DEFINE(TASK_TIME_SYNC, "periodic_time_sync_task", 4096, 3, TASK_CORE_PRO);
+
+// Flash writes and the HTTP upload of the attendance journal. The esp_http_client request path is likely the deepest
+// of the background tasks, but it hasn't been profiled yet, so it keeps the blanket 4096 until it is
+TASK_CONFIG_DEFINE(TASK_JOURNAL, "journal_task", 4096, 2, TASK_CORE_PRO);
+
+TASK_CONFIG_DEFINE(TASK_FASTLOG_DRAIN, "fastlog_drain", 4096, 1, tskNO_AFFINITY);
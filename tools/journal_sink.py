@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Stand-in for the journal collector: accepts the batches the device posts and prints them as CSV.
+
+Point JOURNAL_UPLOAD_URL in journal.h at the machine running this, then:
+
+    python3 tools/journal_sink.py --port 8080 >> journal.csv
+
+Batches are acknowledged with 200, so the device moves on; a batch the device sends again after a lost
+acknowledgement is recognized by its first record index and not printed twice.
+"""
+
+import argparse
+import sys
+from datetime import datetime, timezone
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+ACCESS_METHODS = {0: "portal", 1: "nfc"}
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def decode(data):
+    """Yield (index, record) for one batch, record is None for one torn by a power cut."""
+    if data[:2] != b"J1":
+        raise ValueError("not a journal batch")
+
+    first, pos = read_varint(data, 2)
+    count, pos = read_varint(data, pos)
+    timestamp = 0
+    for index in range(first, first + count):
+        if data[pos] == 0xFF:
+            pos += 1
+            yield index, None
+            continue
+
+        delta, pos = read_varint(data, pos)
+        timestamp = (timestamp + ((delta >> 1) ^ -(delta & 1))) & 0xFFFFFFFF
+        method = data[pos]
+        mac = data[pos + 1:pos + 5].hex()
+        latency, pos = read_varint(data, pos + 5)
+        yield index, (timestamp, method, mac, latency)
+
+
+class SinkHandler(BaseHTTPRequestHandler):
+    # HTTP/1.1 so the device can send all its batches over one connection
+    protocol_version = "HTTP/1.1"
+    seen = {}  # device -> next index not printed yet
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        device = self.headers.get("X-Device-Id", "unknown")
+        try:
+            records = list(decode(body))
+        except (ValueError, IndexError) as err:
+            self.log_message("bad batch from %s: %s", device, err)
+            self.reply(400)
+            return
+
+        next_index = self.seen.get(device, 0)
+        for index, record in records:
+            if index < next_index:
+                continue
+            if record is None:
+                print(f"{device},{index},,,torn,", flush=True)
+                continue
+            timestamp, method, mac, latency = record
+            when = datetime.fromtimestamp(timestamp, timezone.utc).isoformat()
+            print(f"{device},{index},{when},{ACCESS_METHODS.get(method, method)},{mac},{latency}", flush=True)
+        if records:
+            self.seen[device] = max(next_index, records[-1][0] + 1)
+
+        self.log_message("%s: %d records from index %d", device, len(records), records[0][0] if records else 0)
+        self.reply(200)
+
+    def reply(self, status):
+        self.send_response(status)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        sys.stderr.write("%s\n" % (format % args))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=8080)
+    args = parser.parse_args()
+
+    print("device,index,time,method,hmac_prefix,latency_ms", flush=True)
+    ThreadingHTTPServer(("", args.port), SinkHandler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Compare the heap and task stack figures of two /metrics dumps, e.g. the two-task build and the reactor build.
+
+Flash each build in turn, put it through the same load (sim_load.py against the simulator, or phones on the
+SoftAP) and save /metrics afterwards:
+
+    curl -s http://<sta-ip>/metrics > two_tasks.txt
+    curl -s http://<sta-ip>/metrics > reactor.txt
+    python3 tools/metrics_compare.py two_tasks.txt reactor.txt
+
+Prints free and lowest free heap, and the lowest free stack of every task, side by side with the difference.
+"""
+
+import re
+import sys
+
+SAMPLE = re.compile(r'^([a-z_]+)(?:\{task="([^"]*)"\})? (-?\d+)$')
+FIGURES = ("heap_free_bytes", "heap_min_free_bytes")
+
+
+def parse(path):
+    """Return {name or (name, task): value} for the figures compared."""
+    values = {}
+    with open(path) as f:
+        for line in f:
+            match = SAMPLE.match(line.strip())
+            if not match:
+                continue
+            name, task, value = match.group(1), match.group(2), int(match.group(3))
+            if name in FIGURES:
+                values[name] = value
+            elif name == "task_stack_free_min_bytes" and task is not None:
+                values[(name, task)] = value
+    return values
+
+
+def label(key):
+    return key if isinstance(key, str) else f"stack free min {key[1]}"
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__, file=sys.stderr)
+        return 2
+
+    before, after = parse(sys.argv[1]), parse(sys.argv[2])
+    missing = [name for name in FIGURES if name not in before or name not in after]
+    if missing:
+        print(f"metrics compare: {', '.join(missing)} missing, is this a /metrics dump?", file=sys.stderr)
+        return 1
+
+    tasks = sorted({key for key in list(before) + list(after) if not isinstance(key, str)}, key=lambda k: k[1])
+    print(f"{'':36} {sys.argv[1][-12:]:>12} {sys.argv[2][-12:]:>12} {'change':>8}")
+    for key in list(FIGURES) + tasks:
+        a, b = before.get(key), after.get(key)
+        change = f"{b - a:+d}" if a is not None and b is not None else ""
+        print(f"{label(key):36} {'-' if a is None else a:>12} {'-' if b is None else b:>12} {change:>8}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""Drive the simulation build with virtual phones: DNS lookups, portal loads and NFC taps, and report latency.
+
+Start the simulator first (see "Simulation" in README.md), then:
+
+    python3 tools/sim_load.py --phones 2000 --concurrency 64
+
+Every phone uses a 127.x.y.z source address of its own, so the portal and the rate limiter see it as a
+separate client. A phone resolves the captive portal probe host, requests the probe URL (redirected) and
+then the portal page, which must carry a tokenized link. Taps raise a GPO edge every --tap-interval seconds
+for as long as the phones run; taps closer together than the firmware's debounce are answered "ignored".
+"""
+
+import argparse
+import asyncio
+import socket
+import struct
+import sys
+import time
+
+PROBE_HOST = "connectivitycheck.gstatic.com"
+
+
+def phone_address(index):
+    # 127.0.0.0/8 is all loopback on Linux, skip 127.0.x.x so no phone shares the simulator's address
+    index += 1 << 16
+    return f"127.{(index >> 16) & 0xFF}.{(index >> 8) & 0xFF}.{index & 0xFF}"
+
+
+def dns_query(query_id, name):
+    header = struct.pack(">HHHHHH", query_id, 0x0100, 1, 0, 0, 0)
+    labels = b"".join(bytes([len(part)]) + part.encode() for part in name.split("."))
+    return header + labels + b"\x00" + struct.pack(">HH", 1, 1)
+
+
+def dns_answer_ip(reply):
+    """Address of the first A record in a reply, None if there is none."""
+    _, flags, questions, answers, _, _ = struct.unpack(">HHHHHH", reply[:12])
+    if flags & 0x000F or answers == 0:
+        return None
+    pos = 12
+    for _ in range(questions):
+        while reply[pos] != 0:
+            pos += reply[pos] + 1
+        pos += 5
+    for _ in range(answers):
+        pos += 2 if reply[pos] & 0xC0 == 0xC0 else reply.index(0, pos) + 1 - pos
+        rtype, _, _, length = struct.unpack(">HHIH", reply[pos:pos + 10])
+        pos += 10
+        if rtype == 1 and length == 4:
+            return socket.inet_ntoa(reply[pos:pos + 4])
+        pos += length
+    return None
+
+
+class Datagram(asyncio.DatagramProtocol):
+    def __init__(self):
+        self.reply = asyncio.get_running_loop().create_future()
+
+    def datagram_received(self, data, addr):
+        if not self.reply.done():
+            self.reply.set_result(data)
+
+    def error_received(self, exc):
+        if not self.reply.done():
+            self.reply.set_exception(exc)
+
+
+async def udp_request(host, port, payload, timeout, source=None):
+    loop = asyncio.get_running_loop()
+    transport, protocol = await loop.create_datagram_endpoint(
+        Datagram, local_addr=(source, 0) if source else None, remote_addr=(host, port))
+    try:
+        transport.sendto(payload)
+        return await asyncio.wait_for(protocol.reply, timeout)
+    finally:
+        transport.close()
+
+
+async def http_get(host, port, path, source, timeout):
+    """Return (status, body) of one GET on a fresh connection."""
+    reader, writer = await asyncio.wait_for(
+        asyncio.open_connection(host, port, local_addr=(source, 0)), timeout)
+    try:
+        writer.write(f"GET {path} HTTP/1.1\r\nHost: {PROBE_HOST}\r\nConnection: close\r\n\r\n".encode())
+        await writer.drain()
+        response = await asyncio.wait_for(reader.read(), timeout)
+    finally:
+        writer.close()
+    status_line, _, rest = response.partition(b"\r\n")
+    _, _, body = rest.partition(b"\r\n\r\n")
+    return int(status_line.split()[1]), body
+
+
+class Stats:
+    def __init__(self):
+        self.latencies = {}
+        self.errors = {}
+
+    def ok(self, name, started):
+        self.latencies.setdefault(name, []).append((time.perf_counter() - started) * 1000)
+
+    def fail(self, name, reason):
+        self.errors.setdefault(name, {}).setdefault(reason, 0)
+        self.errors[name][reason] += 1
+
+
+def percentile(values, fraction):
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+async def phone(index, args, stats):
+    source = phone_address(index)
+
+    started = time.perf_counter()
+    try:
+        reply = await udp_request(args.host, args.dns_port, dns_query(index & 0xFFFF, PROBE_HOST),
+                                  args.timeout, source)
+        if dns_answer_ip(reply) is None:
+            stats.fail("dns", "no address")
+        else:
+            stats.ok("dns", started)
+    except (OSError, asyncio.TimeoutError) as err:
+        stats.fail("dns", type(err).__name__)
+
+    for name, path, status, marker in (("probe", "/generate_204", 302, None), ("page", "/", 200, b"/scan?ts=")):
+        started = time.perf_counter()
+        try:
+            code, body = await http_get(args.host, args.http_port, path, source, args.timeout)
+            if code != status:
+                stats.fail(name, f"status {code}")
+            elif marker and marker not in body:
+                stats.fail(name, "no tokenized link")
+            else:
+                stats.ok(name, started)
+        except (OSError, asyncio.TimeoutError, IndexError, ValueError) as err:
+            stats.fail(name, type(err).__name__)
+
+
+async def tapper(args, stats, done):
+    while not done.is_set():
+        started = time.perf_counter()
+        try:
+            reply = (await udp_request(args.host, args.gpo_port, b"tap", args.timeout)).decode()
+            if reply.startswith("written"):
+                stats.ok("tap", started)
+                stats.latencies.setdefault("tap write", []).append(int(reply.split()[1]) / 1000)
+            else:
+                stats.fail("tap", reply)
+        except (OSError, asyncio.TimeoutError) as err:
+            stats.fail("tap", type(err).__name__)
+        try:
+            await asyncio.wait_for(done.wait(), args.tap_interval)
+        except asyncio.TimeoutError:
+            pass
+
+
+async def run(args):
+    stats = Stats()
+    done = asyncio.Event()
+    limit = asyncio.Semaphore(args.concurrency)
+
+    async def limited(index):
+        async with limit:
+            await phone(index, args, stats)
+
+    started = time.perf_counter()
+    taps = asyncio.create_task(tapper(args, stats, done)) if args.tap_interval > 0 else None
+    await asyncio.gather(*(limited(i) for i in range(args.phones)))
+    elapsed = time.perf_counter() - started
+    done.set()
+    if taps:
+        await taps
+    return stats, elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--dns-port", type=int, default=8053)
+    parser.add_argument("--http-port", type=int, default=8000)
+    parser.add_argument("--gpo-port", type=int, default=8054)
+    parser.add_argument("--phones", type=int, default=1000)
+    parser.add_argument("--concurrency", type=int, default=32, help="phones in flight at once")
+    parser.add_argument("--tap-interval", type=float, default=6.0, help="seconds between taps, 0 for none")
+    parser.add_argument("--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+
+    stats, elapsed = asyncio.run(run(args))
+
+    print(f"{args.phones} phones in {elapsed:.1f} s, {args.concurrency} at a time")
+    print(f"{'':10} {'ok':>7} {'failed':>7} {'per s':>8} {'p50 ms':>8} {'p95 ms':>8} {'p99 ms':>8} {'max ms':>8}")
+    for name in ("dns", "probe", "page", "tap", "tap write"):
+        values = sorted(stats.latencies.get(name, []))
+        failed = sum(stats.errors.get(name, {}).values())
+        if not values and not failed:
+            continue
+        row = f"{name:10} {len(values):7} {failed:7} {len(values) / elapsed:8.1f}"
+        if values:
+            row += "".join(f" {percentile(values, p):8.1f}" for p in (0.5, 0.95, 0.99)) + f" {values[-1]:8.1f}"
+        print(row)
+    for name, reasons in stats.errors.items():
+        print(f"{name} failures: " + ", ".join(f"{reason} {count}" for reason, count in reasons.items()))
+
+    return 1 if any(name != "tap" for name in stats.errors) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
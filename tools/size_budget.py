@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Check the flash, DRAM and IRAM taken by each library of the firmware against a recorded budget.
+
+Run after every link by the top-level CMakeLists.txt; a library growing past its budget fails the build.
+The budget lives in size_budget.json next to it, record it from a clean build with:
+
+    python3 tools/size_budget.py build/rig-attendance.map size_budget.json --update
+
+and commit the file. Growing a budget is then a reviewed change like any other. A build without a budget file
+records one from its own sizes, which has to be committed for the check to mean anything. Libraries without a
+budget entry, such as a newly added component, are only reported until the budget is recorded again.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+REGIONS = ("flash", "dram", "iram")
+
+
+def region_of(memory_type):
+    """Map an esp_idf_size memory type or section key to flash, dram, iram or None."""
+    name = memory_type.lower()
+    for region in REGIONS:
+        if name.startswith(region) or region in name.split():
+            return region
+    return None
+
+
+def archive_sizes(map_file):
+    """Return {library: {region: bytes}} from esp_idf_size's per-archive report."""
+    output = subprocess.run([sys.executable, "-m", "esp_idf_size", "--archives", "--format", "json2", map_file],
+                            check=True, capture_output=True, text=True).stdout
+    report = json.loads(output)
+    archives = report.get("archives", report)
+
+    sizes = {}
+    for archive, info in archives.items():
+        name = os.path.basename(archive)
+        totals = dict.fromkeys(REGIONS, 0)
+
+        # json2 groups sizes by memory type, the older json format has flat flash_text, dram_bss, ... keys
+        for key, value in info.get("memory_types", info).items():
+            size = value.get("size", 0) if isinstance(value, dict) else value
+            region = region_of(key)
+            if region and isinstance(size, int):
+                totals[region] += size
+        sizes[name] = totals
+
+    sizes["total"] = {region: sum(s[region] for s in sizes.values()) for region in REGIONS}
+    return sizes
+
+
+def record(sizes, budget_file):
+    with open(budget_file, "w") as f:
+        json.dump(dict(sorted(sizes.items())), f, indent=2)
+        f.write("\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map_file")
+    parser.add_argument("budget_file")
+    parser.add_argument("--update", action="store_true", help="record the current sizes as the budget")
+    args = parser.parse_args()
+
+    sizes = archive_sizes(args.map_file)
+
+    if args.update:
+        record(sizes, args.budget_file)
+        print(f"size budget: recorded {len(sizes) - 1} libraries in {args.budget_file}")
+        return 0
+
+    # The first build of a checkout without a budget records one instead of failing; until it's committed every
+    # fresh checkout starts from its own sizes, so say so loudly
+    if not os.path.exists(args.budget_file):
+        record(sizes, args.budget_file)
+        print(f"size budget: WARNING: {args.budget_file} not found, recorded {len(sizes) - 1} libraries from this "
+              f"build; commit it", file=sys.stderr)
+        return 0
+
+    with open(args.budget_file) as f:
+        budget = json.load(f)
+
+    new = sorted(name for name in sizes if name not in budget and any(sizes[name].values()))
+    for name in new:
+        print(f"size budget: WARNING: {name} has no budget yet "
+              f"({', '.join(f'{r} {sizes[name][r]}' for r in REGIONS)}), record it with --update",
+              file=sys.stderr)
+
+    # The total is held to the libraries that have a budget, otherwise a new one would fail it anyway
+    budgeted = {name: dict(size) for name, size in sizes.items()}
+    for name in new:
+        for region in REGIONS:
+            budgeted["total"][region] -= sizes[name][region]
+
+    over = []
+    for name, limits in sorted(budget.items()):
+        current = budgeted.get(name, dict.fromkeys(REGIONS, 0))
+        for region in REGIONS:
+            if current[region] > limits.get(region, 0):
+                over.append((name, region, current[region], limits.get(region, 0)))
+
+    total = sizes["total"]
+    print(f"size budget: flash {total['flash']}, DRAM {total['dram']}, IRAM {total['iram']} bytes")
+    for name, region, size, limit in over:
+        print(f"size budget: {name} {region} {size} bytes, budget {limit} (+{size - limit})", file=sys.stderr)
+    return 1 if over else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Convert a trace dump (GET /trace or trace_dump_uart()) to Chrome trace JSON.
+
+Open the output in https://ui.perfetto.dev or chrome://tracing. Each core becomes a track showing which
+task ran when, and each task gets its own track with the spans it marked.
+
+    curl -s http://<sta-ip>/trace > trace.txt
+    python3 tools/trace_to_chrome.py trace.txt > trace.json
+"""
+
+import json
+import sys
+
+CPU_PID = 1
+TASK_PID = 2
+
+
+def convert(lines):
+    events = []
+    task_ids = {}
+    running = {}  # core -> (task, since_us)
+    last_us = 0
+
+    def task_id(name):
+        if name not in task_ids:
+            task_ids[name] = len(task_ids) + 1
+            events.append({"ph": "M", "name": "thread_name", "pid": TASK_PID, "tid": task_ids[name],
+                           "args": {"name": name}})
+        return task_ids[name]
+
+    for line in lines:
+        line = line.rstrip("\n")
+        if not line or line.startswith("#"):
+            continue
+
+        # Skip log lines interleaved with a UART dump
+        fields = line.split(" ", 3)
+        if len(fields) < 4 or not fields[0].isdigit() or fields[2] not in ("S", "B", "E"):
+            continue
+
+        ts, core, kind, rest = int(fields[0]), int(fields[1]), fields[2], fields[3]
+        last_us = max(last_us, ts)
+
+        if kind == "S":
+            previous = running.get(core)
+            if previous is not None:
+                events.append({"ph": "X", "name": previous[0], "pid": CPU_PID, "tid": core,
+                               "ts": previous[1], "dur": max(ts - previous[1], 0)})
+            running[core] = (rest, ts)
+        else:
+            span, _, task = rest.partition(" ")
+            events.append({"ph": kind, "name": span, "pid": TASK_PID, "tid": task_id(task), "ts": ts})
+
+    # Close what was still running when the dump was taken
+    for core, (task, since) in running.items():
+        events.append({"ph": "X", "name": task, "pid": CPU_PID, "tid": core, "ts": since, "dur": last_us - since})
+
+    events.append({"ph": "M", "name": "process_name", "pid": CPU_PID, "args": {"name": "Cores"}})
+    events.append({"ph": "M", "name": "process_name", "pid": TASK_PID, "args": {"name": "Spans"}})
+    for core in sorted(running):
+        events.append({"ph": "M", "name": "thread_name", "pid": CPU_PID, "tid": core, "args": {"name": f"CPU{core}"}})
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    json.dump(convert(source), sys.stdout)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()